@@ -0,0 +1,134 @@
+// Helpers shared by benchmarks. Benchmarks are standalone programs that are
+// linked with compiler objects, like tests. They are run with 'make bench'
+// from the root of repository, so relative paths to sources can be used as
+// inputs.
+//
+// Results are printed in human-readable form, and also written as JSON next to
+// executable (build/bench/bench_lexer.exe writes build/bench/bench_lexer.json),
+// so they can be collected and compared between commits.
+#ifndef BENCH_H
+#define BENCH_H
+
+// clock_gettime and getrusage are POSIX
+#define _POSIX_C_SOURCE 200809L
+
+#include "general.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// Commit benchmark is built from, passed by Makefile
+#ifndef BENCH_COMMIT
+#define BENCH_COMMIT "unknown"
+#endif
+
+#define BENCH_MAX_RESULTS 256
+
+typedef struct bench_result {
+    // What is measured
+    char *name;
+    // Input that is measured on, see bench_corpus.h
+    char *corpus;
+    uint64_t bytes;
+    uint64_t tokens;
+    // Best time over all repeats
+    double seconds;
+    // Peak resident set size of the whole process at the time of report
+    uint64_t peak_rss_kb;
+} bench_result;
+
+static bench_result bench_results[BENCH_MAX_RESULTS];
+static uint32_t bench_result_count;
+
+// Returns monotonic time in seconds
+static inline double
+bench_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline uint64_t
+bench_peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // ru_maxrss is in kilobytes on Linux and in bytes on macOS
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// Reads whole file into zero-terminated buffer allocated with malloc.
+static inline string
+bench_read_file(char *filename) {
+    string result = {0};
+    FILE *f       = fopen(filename, "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        result.data             = malloc(size + 1);
+        result.len              = fread(result.data, 1, size, f);
+        result.data[result.len] = 0;
+        fclose(f);
+    } else {
+        fprintf(stderr, "failed to open '%s'\n", filename);
+        exit(1);
+    }
+    return result;
+}
+
+// Prints result and records it for bench_write_json. Peak RSS is filled here.
+static inline void
+bench_report(bench_result result) {
+    result.peak_rss_kb = bench_peak_rss_kb();
+    double mb          = result.bytes / (1024.0 * 1024.0);
+    printf("%s [%s]: %.1f MB, %llu tokens in %.3f s: %.1f MB/s, %.2f Mtok/s, peak rss %llu KB\n",
+           result.name, result.corpus, mb, (unsigned long long)result.tokens, result.seconds,
+           mb / result.seconds, result.tokens / result.seconds * 1e-6,
+           (unsigned long long)result.peak_rss_kb);
+    if (bench_result_count < BENCH_MAX_RESULTS) {
+        bench_results[bench_result_count++] = result;
+    }
+}
+
+// Writes all reported results as JSON. File name is made from path of
+// executable by replacing extension with .json.
+static inline void
+bench_write_json(char *exe_path) {
+    char filename[4096];
+    uint32_t len = snprintf(filename, sizeof(filename) - 8, "%s", exe_path);
+    char *ext    = strrchr(filename, '.');
+    if (ext && !strchr(ext, '/')) {
+        len = ext - filename;
+    }
+    strcpy(filename + len, ".json");
+
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        fprintf(stderr, "failed to create '%s'\n", filename);
+        exit(1);
+    }
+    fprintf(f, "{\n  \"executable\": \"%s\",\n  \"commit\": \"%s\",\n  \"results\": [", exe_path,
+            BENCH_COMMIT);
+    for (uint32_t i = 0; i < bench_result_count; ++i) {
+        bench_result *r = bench_results + i;
+        fprintf(f,
+                "%s\n    {\"name\": \"%s\", \"corpus\": \"%s\", \"bytes\": %llu, \"tokens\": "
+                "%llu, \"seconds\": %.6f, \"mb_per_second\": %.3f, \"tokens_per_second\": %.0f, "
+                "\"peak_rss_kb\": %llu}",
+                i ? "," : "", r->name, r->corpus, (unsigned long long)r->bytes,
+                (unsigned long long)r->tokens, r->seconds,
+                r->bytes / (1024.0 * 1024.0) / r->seconds, r->tokens / r->seconds,
+                (unsigned long long)r->peak_rss_kb);
+    }
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+}
+
+#endif
@@ -0,0 +1,381 @@
+// Generator of synthetic C sources for benchmarks. Each corpus stresses one
+// aspect of compiler: deep include trees, macro expansion, long string
+// literals, huge enums, numeric literals and expressions for parser.
+//
+// Corpus is written to disk, because preprocessor loads files through
+// file_storage. It consists of translation units and headers. Every
+// translation unit includes each header exactly once (headers have include
+// guards), so number of bytes processed in all units is known without running
+// preprocessor. Generation is deterministic, so results are comparable between
+// runs.
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include "bench.h"
+
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "darray.h"
+
+#define BENCH_CORPUS_DIR "build/bench_corpus"
+
+typedef enum {
+    // Tree of headers, each including its children
+    BENCH_CORPUS_INCLUDE_TREE,
+    // Nested function-like and object-like macro invocations, including
+    // variadic macros, token pasting and stringizing
+    BENCH_CORPUS_MACROS,
+    // Long string literals with escapes
+    BENCH_CORPUS_STRINGS,
+    // Enums with thousands of enumerators
+    BENCH_CORPUS_ENUMS,
+    // Arrays of numeric literals of all kinds
+    BENCH_CORPUS_NUMBERS,
+    // Constant expressions, which is subset of language parser supports
+    BENCH_CORPUS_EXPRESSIONS,
+    BENCH_CORPUS_COUNT
+} bench_corpus_kind;
+
+typedef struct bench_corpus {
+    char *name;
+    // Names of translation units
+    string *units;  // da
+    // Names of all files, including units
+    string *files;  // da
+    // Total size of all files
+    uint64_t bytes;
+    // Total size of sources that preprocessor goes through when it processes
+    // all units, counting headers once per unit
+    uint64_t processed_bytes;
+} bench_corpus;
+
+static char *bench_corpus_names[] = {
+    [BENCH_CORPUS_INCLUDE_TREE] = "include_tree", [BENCH_CORPUS_MACROS] = "macros",
+    [BENCH_CORPUS_STRINGS] = "strings",           [BENCH_CORPUS_ENUMS] = "enums",
+    [BENCH_CORPUS_NUMBERS] = "numbers",           [BENCH_CORPUS_EXPRESSIONS] = "expressions",
+};
+
+// Generation state
+typedef struct bench_corpus_gen {
+    bench_corpus *corpus;
+    char dir[256];
+    uint32_t random_state;
+    FILE *f;
+    string filename;
+    uint64_t header_bytes;
+    uint64_t unit_bytes;
+} bench_corpus_gen;
+
+static uint32_t
+bench_random(bench_corpus_gen *gen) {
+    uint32_t x = gen->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    gen->random_state = x;
+    return x;
+}
+
+static void
+bench_begin_file(bench_corpus_gen *gen, char *name) {
+    char path[512];
+    uint32_t len = snprintf(path, sizeof(path), "%s/%s", gen->dir, name);
+    gen->f       = fopen(path, "wb");
+    if (!gen->f) {
+        fprintf(stderr, "failed to create '%s'\n", path);
+        exit(1);
+    }
+    gen->filename = (string){malloc(len + 1), len};
+    memcpy(gen->filename.data, path, len + 1);
+}
+
+static void
+bench_end_file(bench_corpus_gen *gen, bool is_unit) {
+    uint64_t size = ftell(gen->f);
+    fclose(gen->f);
+    gen->f = NULL;
+    da_push(gen->corpus->files, gen->filename);
+    if (is_unit) {
+        da_push(gen->corpus->units, gen->filename);
+        gen->unit_bytes += size;
+    } else {
+        gen->header_bytes += size;
+    }
+    gen->corpus->bytes += size;
+}
+
+// Header with include guard that has children 'depth' levels deep
+static void
+bench_gen_tree_header(bench_corpus_gen *gen, uint32_t depth, uint32_t idx) {
+    uint32_t fanout = 3;
+    char name[64];
+    snprintf(name, sizeof(name), "tree_%u_%u.h", depth, idx);
+    bench_begin_file(gen, name);
+    fprintf(gen->f, "#ifndef TREE_%u_%u_H\n#define TREE_%u_%u_H\n", depth, idx, depth, idx);
+    if (depth) {
+        for (uint32_t i = 0; i < fanout; ++i) {
+            fprintf(gen->f, "#include \"tree_%u_%u.h\"\n", depth - 1, idx * fanout + i);
+        }
+    }
+    for (uint32_t i = 0; i < 40; ++i) {
+        uint32_t arg = bench_random(gen) % 1000;
+        switch (bench_random(gen) % 4) {
+        case 0:
+            fprintf(gen->f, "typedef struct s_%u_%u_%u { int a; long b; } s_%u_%u_%u;\n", depth,
+                    idx, i, depth, idx, i);
+            break;
+        case 1:
+            fprintf(gen->f, "extern int func_%u_%u_%u(int x, char *y);\n", depth, idx, i);
+            break;
+        case 2:
+            fprintf(gen->f, "#define CONST_%u_%u_%u %u\n", depth, idx, i, arg);
+            break;
+        case 3:
+            fprintf(gen->f, "// Comment describing declaration %u\n", arg);
+            break;
+        }
+    }
+    fprintf(gen->f, "#endif\n");
+    bench_end_file(gen, false);
+    if (depth) {
+        for (uint32_t i = 0; i < fanout; ++i) {
+            bench_gen_tree_header(gen, depth - 1, idx * fanout + i);
+        }
+    }
+}
+
+static void
+bench_gen_include_tree(bench_corpus_gen *gen) {
+    uint32_t depth = 5;
+    bench_gen_tree_header(gen, depth, 0);
+    for (uint32_t unit_idx = 0; unit_idx < 16; ++unit_idx) {
+        char name[64];
+        snprintf(name, sizeof(name), "unit_%u.c", unit_idx);
+        bench_begin_file(gen, name);
+        fprintf(gen->f, "#include \"tree_%u_0.h\"\n", depth);
+        for (uint32_t i = 0; i < 200; ++i) {
+            fprintf(gen->f, "static int value_%u = %u;\n", i, bench_random(gen) % 1000);
+        }
+        bench_end_file(gen, true);
+    }
+}
+
+static void
+bench_gen_macros(bench_corpus_gen *gen) {
+    bench_begin_file(gen, "macros.h");
+    fprintf(gen->f, "#ifndef MACROS_H\n"
+                    "#define MACROS_H\n"
+                    "#define MAX_COUNT 1024\n"
+                    "#define ADD(_a, _b) ((_a) + (_b))\n"
+                    "#define MUL(_a, _b) ((_a) * (_b))\n"
+                    "#define MADD(_a, _b, _c) ADD(MUL(_a, _b), _c)\n"
+                    "#define SQUARE(_x) MUL(_x, _x)\n"
+                    "#define CLAMP(_x, _lo, _hi) ((_x) < (_lo) ? (_lo) : (_x) > (_hi) ? (_hi) : "
+                    "(_x))\n"
+                    "#define FIELD(_p, _f) ((_p)->_f)\n"
+                    "#define STR(_x) #_x\n"
+                    "#define CALL2(_f, _a, _b) _f(_a, _b)\n"
+                    "#define CAT(_a, _b) _a##_b\n"
+                    "#define XCAT(_a, _b) CAT(_a, _b)\n"
+                    "#define FIRST(_a, ...) _a\n"
+                    "#define LOG(_fmt, ...) printf(_fmt, __VA_ARGS__)\n"
+                    "#define STR_ALL(...) #__VA_ARGS__\n"
+                    "#endif\n");
+    bench_end_file(gen, false);
+
+    static char *lines[] = {
+        "int a_%u = MADD(%u, SQUARE(%u), CLAMP(x, 0, MAX_COUNT));\n",
+        "long b_%u = ADD(ADD(%u, MAX_COUNT), MUL(SQUARE(%u), 3));\n",
+        "int c_%u = FIELD(ptr, value) + CLAMP(SQUARE(%u), %u, MAX_COUNT);\n",
+        "char *d_%u = STR(value %u) STR(%u);\n",
+        "void f_%u(void) { CALL2(printf, \"%%d\", SQUARE(%u)); MAX_COUNT; %u; }\n",
+        "int CAT(e_, %u) = FIRST(SQUARE(%u), ADD(%u, MAX_COUNT), 0);\n",
+        "void g_%u(void) { LOG(\"%%d %%d\", SQUARE(%u), XCAT(0x, %u)); }\n",
+        "char *h_%u = STR_ALL(%u, SQUARE(%u), \"quoted\", 'c');\n",
+    };
+    for (uint32_t unit_idx = 0; unit_idx < 16; ++unit_idx) {
+        char name[64];
+        snprintf(name, sizeof(name), "unit_%u.c", unit_idx);
+        bench_begin_file(gen, name);
+        fprintf(gen->f, "#include \"macros.h\"\n");
+        for (uint32_t i = 0; i < 2000; ++i) {
+            char *line   = lines[bench_random(gen) % ARRAY_SIZE(lines)];
+            uint32_t arg = bench_random(gen) % 1000;
+            fprintf(gen->f, line, i, arg, arg + 1);
+        }
+        bench_end_file(gen, true);
+    }
+}
+
+static void
+bench_gen_strings(bench_corpus_gen *gen) {
+    static char *pieces[] = {
+        "lorem ", "ipsum ", "dolor ", "sit ", "amet ", "\\n", "\\t", "\\\"quoted\\\" ", "\\\\",
+    };
+    for (uint32_t unit_idx = 0; unit_idx < 16; ++unit_idx) {
+        char name[64];
+        snprintf(name, sizeof(name), "unit_%u.c", unit_idx);
+        bench_begin_file(gen, name);
+        for (uint32_t i = 0; i < 400; ++i) {
+            fprintf(gen->f, "static const char *str_%u =", i);
+            // Some literals are concatenated from several lines
+            uint32_t part_count = 1 + bench_random(gen) % 3;
+            for (uint32_t part = 0; part < part_count; ++part) {
+                fprintf(gen->f, "\n    \"");
+                // Literal is kept below size of buffers used by preprocessor
+                uint32_t piece_count = 8 + bench_random(gen) % 150;
+                for (uint32_t piece = 0; piece < piece_count; ++piece) {
+                    fputs(pieces[bench_random(gen) % ARRAY_SIZE(pieces)], gen->f);
+                }
+                fprintf(gen->f, "\"");
+            }
+            fprintf(gen->f, ";\n");
+        }
+        bench_end_file(gen, true);
+    }
+}
+
+static void
+bench_gen_enums(bench_corpus_gen *gen) {
+    for (uint32_t unit_idx = 0; unit_idx < 16; ++unit_idx) {
+        char name[64];
+        snprintf(name, sizeof(name), "unit_%u.c", unit_idx);
+        bench_begin_file(gen, name);
+        for (uint32_t enum_idx = 0; enum_idx < 4; ++enum_idx) {
+            fprintf(gen->f, "typedef enum {\n");
+            for (uint32_t i = 0; i < 5000; ++i) {
+                if (bench_random(gen) % 8 == 0) {
+                    fprintf(gen->f, "    ENUM_%u_VALUE_%u = 0x%x,\n", enum_idx, i, i);
+                } else {
+                    fprintf(gen->f, "    ENUM_%u_VALUE_%u,\n", enum_idx, i);
+                }
+            }
+            fprintf(gen->f, "} enum_%u;\n", enum_idx);
+        }
+        bench_end_file(gen, true);
+    }
+}
+
+static void
+bench_gen_numbers(bench_corpus_gen *gen) {
+    static char *formats[] = {
+        "%u", "%uu", "%ul", "%uull", "0x%x", "0x%XU", "0%o", "%u.5", "%u.25e-3", "%u.0f", "1e%u",
+    };
+    for (uint32_t unit_idx = 0; unit_idx < 16; ++unit_idx) {
+        char name[64];
+        snprintf(name, sizeof(name), "unit_%u.c", unit_idx);
+        bench_begin_file(gen, name);
+        for (uint32_t i = 0; i < 500; ++i) {
+            fprintf(gen->f, "static const double table_%u[] = {\n", i);
+            for (uint32_t line = 0; line < 4; ++line) {
+                fprintf(gen->f, "   ");
+                for (uint32_t n = 0; n < 12; ++n) {
+                    char *format = formats[bench_random(gen) % ARRAY_SIZE(formats)];
+                    fprintf(gen->f, " ");
+                    fprintf(gen->f, format, bench_random(gen) % 300);
+                    fprintf(gen->f, ",");
+                }
+                fprintf(gen->f, "\n");
+            }
+            fprintf(gen->f, "};\n");
+        }
+        bench_end_file(gen, true);
+    }
+}
+
+static void
+bench_gen_expr(bench_corpus_gen *gen, uint32_t depth) {
+    static char *binary_ops[] = {"+",  "-",  "*",  "/",  "%", "<<", ">>", "<", ">",
+                                 "<=", ">=", "==", "!=", "&", "|",  "^",  "&&", "||"};
+    static char *unary_ops[]  = {"-", "~", "!"};
+    uint32_t choice           = bench_random(gen) % 8;
+    if (!depth || choice < 2) {
+        if (bench_random(gen) % 4) {
+            fprintf(gen->f, "%u", 1 + bench_random(gen) % 1000);
+        } else {
+            fprintf(gen->f, "%u.5", bench_random(gen) % 100);
+        }
+    } else if (choice < 6) {
+        bench_gen_expr(gen, depth - 1);
+        fprintf(gen->f, " %s ", binary_ops[bench_random(gen) % ARRAY_SIZE(binary_ops)]);
+        bench_gen_expr(gen, depth - 1);
+    } else if (choice < 7) {
+        fprintf(gen->f, "%s(", unary_ops[bench_random(gen) % ARRAY_SIZE(unary_ops)]);
+        bench_gen_expr(gen, depth - 1);
+        fprintf(gen->f, ")");
+    } else {
+        fprintf(gen->f, "(");
+        bench_gen_expr(gen, depth - 1);
+        fprintf(gen->f, " ? ");
+        bench_gen_expr(gen, depth - 1);
+        fprintf(gen->f, " : ");
+        bench_gen_expr(gen, depth - 1);
+        fprintf(gen->f, ")");
+    }
+}
+
+// Parser handles only expressions for now, so units are sequences of
+// constant expressions, one on each line
+static void
+bench_gen_expressions(bench_corpus_gen *gen) {
+    for (uint32_t unit_idx = 0; unit_idx < 16; ++unit_idx) {
+        char name[64];
+        snprintf(name, sizeof(name), "unit_%u.c", unit_idx);
+        bench_begin_file(gen, name);
+        for (uint32_t i = 0; i < 4000; ++i) {
+            bench_gen_expr(gen, 6);
+            fprintf(gen->f, "\n");
+        }
+        bench_end_file(gen, true);
+    }
+}
+
+// Writes corpus of given kind to BENCH_CORPUS_DIR/<name>
+static bench_corpus
+bench_generate_corpus(bench_corpus_kind kind) {
+    bench_corpus corpus  = {0};
+    corpus.name          = bench_corpus_names[kind];
+    bench_corpus_gen gen = {0};
+    gen.corpus           = &corpus;
+    gen.random_state     = 12345 + kind;
+    mkdir("build", 0777);
+    mkdir(BENCH_CORPUS_DIR, 0777);
+    snprintf(gen.dir, sizeof(gen.dir), BENCH_CORPUS_DIR "/%s", corpus.name);
+    mkdir(gen.dir, 0777);
+    switch (kind) {
+        INVALID_DEFAULT_CASE;
+    case BENCH_CORPUS_INCLUDE_TREE:
+        bench_gen_include_tree(&gen);
+        break;
+    case BENCH_CORPUS_MACROS:
+        bench_gen_macros(&gen);
+        break;
+    case BENCH_CORPUS_STRINGS:
+        bench_gen_strings(&gen);
+        break;
+    case BENCH_CORPUS_ENUMS:
+        bench_gen_enums(&gen);
+        break;
+    case BENCH_CORPUS_NUMBERS:
+        bench_gen_numbers(&gen);
+        break;
+    case BENCH_CORPUS_EXPRESSIONS:
+        bench_gen_expressions(&gen);
+        break;
+    }
+    corpus.processed_bytes = gen.unit_bytes + gen.header_bytes * da_size(corpus.units);
+    return corpus;
+}
+
+static void
+bench_free_corpus(bench_corpus *corpus) {
+    for (uint32_t i = 0; i < da_size(corpus->files); ++i) {
+        free(corpus->files[i].data);
+    }
+    da_free(corpus->files);
+    da_free(corpus->units);
+    memset(corpus, 0, sizeof(*corpus));
+}
+
+#endif
@@ -0,0 +1,109 @@
+// Compares keyword classification with perfect hash (get_kw_kind) against
+// linear scan over all keywords, which was used before. Identifier stream is
+// taken from compiler's own sources.
+#include "bench.h"
+
+#include "c_lang.h"
+#include "pp_lexer.h"
+#include "str.h"
+
+#define MAX_IDENTS (1 << 20)
+#define REPEAT_COUNT 20
+
+static string keywords[C_KW_PRAGMA + 1];
+static string idents[MAX_IDENTS];
+static uint32_t ident_count;
+
+static c_keyword_kind
+get_kw_kind_linear(string test) {
+    c_keyword_kind kind = 0;
+    for (uint32_t i = 1; i < ARRAY_SIZE(keywords); ++i) {
+        if (string_eq(test, keywords[i])) {
+            kind = i;
+            break;
+        }
+    }
+    return kind;
+}
+
+static void
+collect_idents(char *filename) {
+    string contents = bench_read_file(filename);
+    pp_lexer lex    = {0};
+    pp_lexer_init(&lex, contents.data, STRING_END(contents));
+    for (;;) {
+        char buf[4096];
+        uint32_t buf_len = 0;
+        pp_token tok     = {0};
+        if (!pp_lexer_parse(&lex, &tok, buf, sizeof(buf), &buf_len)) {
+            break;
+        }
+        if (tok.kind == PP_TOK_ID && ident_count < MAX_IDENTS) {
+            idents[ident_count++] = tok.str;
+        }
+    }
+}
+
+int
+main(int argc, char **argv) {
+    static char *default_files[] = {
+        "src/preprocessor.c", "src/parser.c", "src/c_lang.c",
+        "src/pp_lexer.c",     "src/ast.c",    "src/file_storage.c",
+    };
+    char **files        = default_files;
+    uint32_t file_count = ARRAY_SIZE(default_files);
+    if (argc > 1) {
+        files      = argv + 1;
+        file_count = argc - 1;
+    }
+
+    for (uint32_t kw = C_KW_AUTO; kw <= C_KW_PRAGMA; ++kw) {
+        token tok = {0};
+        tok.kind  = TOK_KW;
+        tok.kw    = kw;
+        char buf[64];
+        uint32_t len = fmt_token(buf, sizeof(buf), &tok);
+        keywords[kw] = string_dup((string){buf, len});
+    }
+
+    for (uint32_t i = 0; i < file_count; ++i) {
+        collect_idents(files[i]);
+    }
+
+    uint32_t keyword_count = 0;
+    for (uint32_t i = 0; i < ident_count; ++i) {
+        c_keyword_kind expected = get_kw_kind_linear(idents[i]);
+        if (get_kw_kind(idents[i]) != expected) {
+            fprintf(stderr, "classification mismatch on '%.*s'\n", idents[i].len,
+                    idents[i].data);
+            return 1;
+        }
+        keyword_count += expected != 0;
+    }
+    printf("%u identifiers, %u keywords\n", ident_count, keyword_count);
+
+    // Sum of kinds is printed, so that compiler can't optimize calls away
+    uint64_t checksum = 0;
+    double start      = bench_time();
+    for (uint32_t repeat = 0; repeat < REPEAT_COUNT; ++repeat) {
+        for (uint32_t i = 0; i < ident_count; ++i) {
+            checksum += get_kw_kind_linear(idents[i]);
+        }
+    }
+    double linear_time = bench_time() - start;
+
+    start = bench_time();
+    for (uint32_t repeat = 0; repeat < REPEAT_COUNT; ++repeat) {
+        for (uint32_t i = 0; i < ident_count; ++i) {
+            checksum += get_kw_kind(idents[i]);
+        }
+    }
+    double hash_time = bench_time() - start;
+
+    double total = (double)ident_count * REPEAT_COUNT;
+    printf("linear scan:  %6.2f ns/ident\n", linear_time * 1e9 / total);
+    printf("perfect hash: %6.2f ns/ident (%.1fx faster)\n", hash_time * 1e9 / total,
+           linear_time / hash_time);
+    printf("checksum: %llu\n", (unsigned long long)checksum);
+    return 0;
+}
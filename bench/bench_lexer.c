@@ -0,0 +1,88 @@
+// Measures throughput of pp_lexer on synthetic corpora (see bench_corpus.h).
+// All files of corpus are read to memory before measurement, so only lexing is
+// measured. Both lexing token by token and lexing the whole file into array
+// with pp_lexer_lex_all are measured.
+#include "bench.h"
+#include "bench_corpus.h"
+
+#include "bump_allocator.h"
+#include "pp_lexer.h"
+#include "str.h"
+
+#define REPEAT_COUNT 3
+
+static void
+bench_corpus_lexing(bench_corpus *corpus) {
+    uint32_t file_count = da_size(corpus->files);
+    string *files       = calloc(file_count, sizeof(string));
+    for (uint32_t i = 0; i < file_count; ++i) {
+        files[i] = bench_read_file(corpus->files[i].data);
+    }
+
+    bench_result result = {
+        .name = "pp_lexer_parse", .corpus = corpus->name, .bytes = corpus->bytes};
+    uint32_t token_count = 0;
+    for (uint32_t repeat = 0; repeat < REPEAT_COUNT; ++repeat) {
+        token_count  = 0;
+        double start = bench_time();
+        for (uint32_t i = 0; i < file_count; ++i) {
+            pp_lexer lex = {0};
+            pp_lexer_init(&lex, files[i].data, STRING_END(files[i]));
+            for (;;) {
+                char buf[4096];
+                uint32_t buf_len = 0;
+                pp_token tok     = {0};
+                if (!pp_lexer_parse(&lex, &tok, buf, sizeof(buf), &buf_len)) {
+                    break;
+                }
+                ++token_count;
+            }
+        }
+        double time = bench_time() - start;
+        if (!repeat || time < result.seconds) {
+            result.seconds = time;
+        }
+    }
+    result.tokens = token_count;
+    bench_report(result);
+
+    result = (bench_result){
+        .name = "pp_lexer_lex_all", .corpus = corpus->name, .bytes = corpus->bytes};
+    bump_allocator a = {0};
+    for (uint32_t repeat = 0; repeat < REPEAT_COUNT; ++repeat) {
+        token_count  = 0;
+        double start = bench_time();
+        for (uint32_t i = 0; i < file_count; ++i) {
+            pp_lexer lex = {0};
+            pp_lexer_init(&lex, files[i].data, STRING_END(files[i]));
+            pp_token_array *tokens = pp_lexer_lex_all(&lex, &a);
+            // EOF token is not counted
+            token_count += tokens->token_count - 1;
+            ba_clear(&a);
+        }
+        double time = bench_time() - start;
+        if (!repeat || time < result.seconds) {
+            result.seconds = time;
+        }
+    }
+    result.tokens = token_count;
+    bench_report(result);
+
+    ba_free(&a);
+    for (uint32_t i = 0; i < file_count; ++i) {
+        free(files[i].data);
+    }
+    free(files);
+}
+
+int
+main(int argc, char **argv) {
+    (void)argc;
+    for (uint32_t kind = 0; kind < BENCH_CORPUS_COUNT; ++kind) {
+        bench_corpus corpus = bench_generate_corpus(kind);
+        bench_corpus_lexing(&corpus);
+        bench_free_corpus(&corpus);
+    }
+    bench_write_json(argv[0]);
+    return 0;
+}
@@ -0,0 +1,60 @@
+// Measures throughput of parser on corpus of constant expressions (see
+// bench_corpus.h), which is the part of language parser supports. Time
+// includes producing tokens for parser, so it is compared with token_iter
+// result of bench_preprocessor on the same corpus to get the cost of parsing
+// itself.
+#include "bench.h"
+#include "bench_corpus.h"
+
+#include "c_lang.h"
+#include "parser.h"
+#include "preprocessor.h"
+#include "token_iter.h"
+
+#define REPEAT_COUNT 3
+
+int
+main(int argc, char **argv) {
+    (void)argc;
+    bench_corpus corpus = bench_generate_corpus(BENCH_CORPUS_EXPRESSIONS);
+
+    // Tokens are counted separately, so that parser loop is not affected
+    uint64_t token_count = 0;
+    for (uint32_t i = 0; i < da_size(corpus.units); ++i) {
+        token_iter ti = {0};
+        ti_init(&ti, corpus.units[i]);
+        while (ti_peek(&ti)->kind != TOK_EOF) {
+            ti_eat(&ti);
+            ++token_count;
+        }
+        ti_free(&ti);
+    }
+
+    bench_result result = {.name   = "parse_expr",
+                           .corpus = corpus.name,
+                           .bytes  = corpus.processed_bytes,
+                           .tokens = token_count};
+    for (uint32_t repeat = 0; repeat < REPEAT_COUNT; ++repeat) {
+        double start = bench_time();
+        for (uint32_t i = 0; i < da_size(corpus.units); ++i) {
+            token_iter ti = {0};
+            ti_init(&ti, corpus.units[i]);
+            parser p = {0};
+            p.it     = &ti;
+            p.a      = ti.pp->a;
+            while (parse_expr(&p)) {
+                // Parsed expressions are left in allocator
+            }
+            ti_free(&ti);
+        }
+        double time = bench_time() - start;
+        if (!repeat || time < result.seconds) {
+            result.seconds = time;
+        }
+    }
+    bench_report(result);
+
+    bench_free_corpus(&corpus);
+    bench_write_json(argv[0]);
+    return 0;
+}
@@ -0,0 +1,51 @@
+// Measures throughput of the whole token pipeline, the same one that is used
+// by 'holoc --tp': file loading, lexing, macro expansion, directive processing
+// and conversion to c tokens, as seen by parser through token_iter. Each
+// translation unit of synthetic corpora (see bench_corpus.h) is processed
+// with its own token_iter. Files and their tokens are shared between
+// translation units (see token_cache.h), so the best time is measured with
+// warm caches, like in a run of compiler with many inputs.
+#include "bench.h"
+#include "bench_corpus.h"
+
+#include "c_lang.h"
+#include "token_iter.h"
+
+#define REPEAT_COUNT 3
+
+static void
+bench_corpus_tokens(bench_corpus *corpus) {
+    bench_result result = {
+        .name = "token_iter", .corpus = corpus->name, .bytes = corpus->processed_bytes};
+    for (uint32_t repeat = 0; repeat < REPEAT_COUNT; ++repeat) {
+        uint64_t token_count = 0;
+        double start         = bench_time();
+        for (uint32_t i = 0; i < da_size(corpus->units); ++i) {
+            token_iter ti = {0};
+            ti_init(&ti, corpus->units[i]);
+            while (ti_peek(&ti)->kind != TOK_EOF) {
+                ti_eat(&ti);
+                ++token_count;
+            }
+            ti_free(&ti);
+        }
+        double time = bench_time() - start;
+        if (!repeat || time < result.seconds) {
+            result.seconds = time;
+        }
+        result.tokens = token_count;
+    }
+    bench_report(result);
+}
+
+int
+main(int argc, char **argv) {
+    (void)argc;
+    for (uint32_t kind = 0; kind < BENCH_CORPUS_COUNT; ++kind) {
+        bench_corpus corpus = bench_generate_corpus(kind);
+        bench_corpus_tokens(&corpus);
+        bench_free_corpus(&corpus);
+    }
+    bench_write_json(argv[0]);
+    return 0;
+}
@@ -2,9 +2,9 @@
 
 #include <assert.h>
 #include <stddef.h>
-#include <stdlib.h>
 
 #include "buffer_writer.h"
+#include "bump_allocator.h"
 #include "c_lang.h"
 #include "c_types.h"
 #include "str.h"
@@ -329,7 +329,7 @@ fmt_ast_verbose(void *node, char *buf, uint32_t buf_size) {
 }
 
 void *
-make_ast(ast_kind kind, source_loc loc) {
+make_ast(bump_allocator *a, ast_kind kind, source_loc loc) {
     static uint64_t AST_STRUCT_SIZES[] = {
         sizeof(ast),        sizeof(ast_identifier), sizeof(ast_string),  sizeof(ast_number),
         sizeof(ast_unary),  sizeof(ast_binary),     sizeof(ast_ternary), sizeof(ast_if),
@@ -339,15 +339,15 @@ make_ast(ast_kind kind, source_loc loc) {
         sizeof(ast_typedef)};
 
     assert(kind < ARRAY_SIZE(AST_STRUCT_SIZES));
-    ast *node  = calloc(AST_STRUCT_SIZES[kind], 1);
+    ast *node  = ba_alloc(a, AST_STRUCT_SIZES[kind]);
     node->kind = kind;
     node->loc  = loc;
     return node;
 }
 
 ast *
-make_ast_num_int(source_loc loc, uint64_t value, struct c_type *type) {
-    ast_number *num = make_ast(AST_NUM, loc);
+make_ast_num_int(bump_allocator *a, source_loc loc, uint64_t value, struct c_type *type) {
+    ast_number *num = make_ast(a, AST_NUM, loc);
     num->uint_value = value;
     num->type       = type;
     assert(c_type_is_int(type));
@@ -355,8 +355,8 @@ make_ast_num_int(source_loc loc, uint64_t value, struct c_type *type) {
 }
 
 ast *
-make_ast_num_flt(source_loc loc, double value, struct c_type *type) {
-    ast_number *num  = make_ast(AST_NUM, loc);
+make_ast_num_flt(bump_allocator *a, source_loc loc, double value, struct c_type *type) {
+    ast_number *num  = make_ast(a, AST_NUM, loc);
     num->float_value = value;
     num->type        = type;
     assert(!c_type_is_int(type));
@@ -364,18 +364,18 @@ make_ast_num_flt(source_loc loc, double value, struct c_type *type) {
 }
 
 ast *
-make_ast_unary(source_loc loc, ast_unary_kind kind, ast *expr) {
+make_ast_unary(bump_allocator *a, source_loc loc, ast_unary_kind kind, ast *expr) {
     assert(expr);
-    ast_unary *un = make_ast(AST_UN, loc);
+    ast_unary *un = make_ast(a, AST_UN, loc);
     un->un_kind   = kind;
     un->expr      = expr;
     return (ast *)un;
 }
 
 ast *
-make_ast_binary(ast_binary_kind kind, ast *left, ast *right) {
+make_ast_binary(bump_allocator *a, ast_binary_kind kind, ast *left, ast *right) {
     assert(left && right);
-    ast_binary *bin = make_ast(AST_BIN, left->loc);
+    ast_binary *bin = make_ast(a, AST_BIN, left->loc);
     bin->bin_kind   = kind;
     bin->left       = left;
     bin->right      = right;
@@ -383,18 +383,18 @@ make_ast_binary(ast_binary_kind kind, ast *left, ast *right) {
 }
 
 ast *
-make_ast_cast(source_loc loc, ast *expr, struct c_type *type) {
+make_ast_cast(bump_allocator *a, source_loc loc, ast *expr, struct c_type *type) {
     assert(expr && type);
-    ast_cast *cast = make_ast(AST_CAST, loc);
+    ast_cast *cast = make_ast(a, AST_CAST, loc);
     cast->type     = type;
     cast->expr     = expr;
     return (ast *)cast;
 }
 
 ast *
-make_ast_ternary(ast *cond, ast *cond_true, ast *cond_false) {
+make_ast_ternary(bump_allocator *a, ast *cond, ast *cond_true, ast *cond_false) {
     assert(cond && cond_true && cond_false);
-    ast_ternary *ter = make_ast(AST_TER, cond->loc);
+    ast_ternary *ter = make_ast(a, AST_TER, cond->loc);
     ter->cond        = cond;
     ter->cond_true   = cond_true;
     ter->cond_false  = cond_false;
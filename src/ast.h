@@ -6,6 +6,7 @@
 struct c_type;
 struct buffer_writer;
 struct token;
+struct bump_allocator;
 
 typedef enum {
     AST_NONE      = 0x0,   // Do nothing
@@ -214,15 +215,17 @@ void fmt_ast_verbosew(void *ast, struct buffer_writer *w);
 uint32_t fmt_ast_verbose(void *ast, char *buf, uint32_t buf_size);
 
 // Creates ast of given kind. Allocates memory needed for structure of that kind
-// and sets kind.
-void *make_ast(ast_kind kind, source_loc loc);
-ast *make_ast_num_int(source_loc loc, uint64_t value, struct c_type *type);
-ast *make_ast_num_flt(source_loc loc, double value, struct c_type *type);
-ast *make_ast_unary(source_loc loc, ast_unary_kind kind, ast *expr);
+// from given allocator and sets kind.
+void *make_ast(struct bump_allocator *a, ast_kind kind, source_loc loc);
+ast *make_ast_num_int(struct bump_allocator *a, source_loc loc, uint64_t value,
+                      struct c_type *type);
+ast *make_ast_num_flt(struct bump_allocator *a, source_loc loc, double value,
+                      struct c_type *type);
+ast *make_ast_unary(struct bump_allocator *a, source_loc loc, ast_unary_kind kind, ast *expr);
 // NOTE: Takes loc from 'left'
-ast *make_ast_binary(ast_binary_kind kind, ast *left, ast *right);
-ast *make_ast_cast(source_loc loc, ast *expr, struct c_type *type);
-ast *make_ast_ternary(ast *cond, ast *cond_true, ast *cond_false);
-ast *make_ast_enum_field(string name, int64_t value);
+ast *make_ast_binary(struct bump_allocator *a, ast_binary_kind kind, ast *left, ast *right);
+ast *make_ast_cast(struct bump_allocator *a, source_loc loc, ast *expr, struct c_type *type);
+ast *make_ast_ternary(struct bump_allocator *a, ast *cond, ast *cond_true, ast *cond_false);
+ast *make_ast_enum_field(struct bump_allocator *a, string name, int64_t value);
 
 #endif
@@ -6,7 +6,13 @@
 
 void
 buf_writev(buffer_writer *w, char *fmt, va_list args) {
-    uint32_t wrote = vsnprintf(w->cursor, w->eof - w->cursor, fmt, args);
+    uint32_t size  = w->eof - w->cursor;
+    uint32_t wrote = vsnprintf(w->cursor, size, fmt, args);
+    // If output is truncated, leave cursor at the terminator, so that
+    // following writes don't go past the end
+    if (wrote >= size) {
+        wrote = size ? size - 1 : 0;
+    }
     w->cursor += wrote;
 }
 
@@ -18,9 +24,13 @@ buf_write(buffer_writer *w, char *fmt, ...) {
 }
 
 static void
-write_cp(buffer_writer *w, uint32_t cp) {
+write_cp(buffer_writer *w, uint32_t cp, char quote) {
     switch (cp) {
     default: {
+        // Delimiter of literal is escaped
+        if (cp == (uint32_t)quote) {
+            buf_write(w, "\\");
+        }
         char buf[5];
         buf[(char *)utf8_encode(buf, cp) - buf] = 0;
         buf_write(w, "%s", buf);
@@ -46,34 +56,40 @@ write_cp(buffer_writer *w, uint32_t cp) {
     case '\v':
         buf_write(w, "\\v");
         break;
+    case '\\':
+        buf_write(w, "\\\\");
+        break;
     }
 }
 
 void
-buf_write_raw_utf8(buffer_writer *w, void *strv) {
+buf_write_raw_utf8(buffer_writer *w, void *strv, uint32_t size, char quote) {
     uint8_t *str = strv;
-    while (*str) {
+    uint8_t *eof = str + size;
+    while (str < eof) {
         uint32_t cp;
         str = utf8_decode(str, &cp);
-        write_cp(w, cp);
+        write_cp(w, cp, quote);
     }
 }
 
 void
-buf_write_raw_utf16(buffer_writer *w, void *strv) {
+buf_write_raw_utf16(buffer_writer *w, void *strv, uint32_t size, char quote) {
     uint16_t *str = strv;
-    while (*str) {
+    uint16_t *eof = str + size / sizeof(uint16_t);
+    while (str < eof) {
         uint32_t cp;
         str = utf16_decode(str, &cp);
-        write_cp(w, cp);
+        write_cp(w, cp, quote);
     }
 }
 
 void
-buf_write_raw_utf32(buffer_writer *w, void *strv) {
+buf_write_raw_utf32(buffer_writer *w, void *strv, uint32_t size, char quote) {
     uint32_t *str = strv;
-    while (*str) {
+    uint32_t *eof = str + size / sizeof(uint32_t);
+    while (str < eof) {
         uint32_t cp = *str++;
-        write_cp(w, cp);
+        write_cp(w, cp, quote);
     }
 }
@@ -13,9 +13,10 @@ void buf_writev(buffer_writer *w, char *fmt, va_list args);
 __attribute__((format(printf, 2, 3))) void buf_write(buffer_writer *w, char *fmt, ...);
 
 // Writes string with replacing special characters as escape sequences
-// and doing decoding.
-void buf_write_raw_utf8(buffer_writer *w, void *str);
-void buf_write_raw_utf16(buffer_writer *w, void *str);
-void buf_write_raw_utf32(buffer_writer *w, void *str);
+// and doing decoding. Size of string is given in bytes. Backslash and quote,
+// which is the delimiter of literal string is written in, are escaped too.
+void buf_write_raw_utf8(buffer_writer *w, void *str, uint32_t size, char quote);
+void buf_write_raw_utf16(buffer_writer *w, void *str, uint32_t size, char quote);
+void buf_write_raw_utf32(buffer_writer *w, void *str, uint32_t size, char quote);
 
 #endif
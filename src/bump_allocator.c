@@ -0,0 +1,93 @@
+#include "bump_allocator.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "time_report.h"
+
+#define ALIGN_FORWARD(_value, _align) (((_value) + (_align)-1) & ~((uintptr_t)(_align)-1))
+
+static bump_allocator_block *
+get_block(bump_allocator *a, uintptr_t size) {
+    bump_allocator_block *block = NULL;
+    // Try to reuse one of cleared blocks
+    for (bump_allocator_block **blockp = &a->free_blocks; *blockp;
+         blockp                        = &(*blockp)->next) {
+        if ((*blockp)->size >= size) {
+            block   = *blockp;
+            *blockp = block->next;
+            break;
+        }
+    }
+
+    if (!block) {
+        uintptr_t block_size = size;
+        if (block_size < BUMP_ALLOCATOR_BLOCK_SIZE) {
+            block_size = BUMP_ALLOCATOR_BLOCK_SIZE;
+        }
+        // Block header is put in the beginning of allocated memory
+        uintptr_t header_size = ALIGN_FORWARD(sizeof(bump_allocator_block),
+                                              BUMP_ALLOCATOR_ALIGNMENT);
+        uint8_t *memory       = malloc(header_size + block_size);
+        assert(memory);
+        block       = (bump_allocator_block *)memory;
+        block->base = memory + header_size;
+        block->size = block_size;
+        a->total_allocated += block_size;
+    }
+
+    block->used = 0;
+    return block;
+}
+
+void *
+ba_alloc(bump_allocator *a, uintptr_t size) {
+    TR_COUNT(TR_COUNTER_ALLOCATIONS, 1);
+    size                        = ALIGN_FORWARD(size, BUMP_ALLOCATOR_ALIGNMENT);
+    bump_allocator_block *block = a->block;
+    if (!block || block->used + size > block->size) {
+        block       = get_block(a, size);
+        block->next = a->block;
+        a->block    = block;
+    }
+
+    void *result = block->base + block->used;
+    block->used += size;
+    a->total_used += size;
+    memset(result, 0, size);
+    return result;
+}
+
+string
+ba_string_dup(bump_allocator *a, string str) {
+    char *data = ba_alloc(a, str.len + 1);
+    // Empty string can have NULL data, which must not be passed to memcpy
+    if (str.len) {
+        memcpy(data, str.data, str.len);
+    }
+    data[str.len] = 0;
+    return (string){data, str.len};
+}
+
+void
+ba_clear(bump_allocator *a) {
+    while (a->block) {
+        bump_allocator_block *block = a->block;
+        a->block                    = block->next;
+        block->next                 = a->free_blocks;
+        a->free_blocks              = block;
+    }
+    a->total_used = 0;
+}
+
+void
+ba_free(bump_allocator *a) {
+    ba_clear(a);
+    while (a->free_blocks) {
+        bump_allocator_block *block = a->free_blocks;
+        a->free_blocks              = block->next;
+        free(block);
+    }
+    a->total_allocated = 0;
+}
@@ -0,0 +1,49 @@
+// Defines bump (arena) allocator. Arena allocates memory by advancing pointer
+// inside big blocks that are requested from system. Individual allocations are
+// never freed, instead the whole arena is released or reset at once.
+//
+// This fits compiler data well: most of structures (tokens, ast nodes, types)
+// share the lifetime of some processing stage, like translation unit or
+// evaluation of single #if expression. Such stage owns its arena and clears it
+// when finished, which costs a few free calls instead of one per object.
+#ifndef BUMP_ALLOCATOR_H
+#define BUMP_ALLOCATOR_H
+
+#include "general.h"
+
+// Default size of block requested from system. Allocations bigger than that
+// get their own block.
+#define BUMP_ALLOCATOR_BLOCK_SIZE (1 << 20)
+// All allocations are aligned to this value. This is enough for any type used
+// in compiler, including long double.
+#define BUMP_ALLOCATOR_ALIGNMENT 16
+
+typedef struct bump_allocator_block {
+    struct bump_allocator_block *next;
+    uint8_t *base;
+    uintptr_t size;
+    uintptr_t used;
+} bump_allocator_block;
+
+typedef struct bump_allocator {
+    // Block that allocations are made from. Full blocks are chained after it.
+    bump_allocator_block *block;
+    // Blocks that were released by ba_clear and can be reused.
+    bump_allocator_block *free_blocks;
+    // Statistics
+    uintptr_t total_allocated;
+    uintptr_t total_used;
+} bump_allocator;
+
+// Allocates zero-initialized memory of given size.
+void *ba_alloc(bump_allocator *a, uintptr_t size);
+#define ba_alloc_struct(_a, _type) ((_type *)ba_alloc((_a), sizeof(_type)))
+#define ba_alloc_array(_a, _type, _count) ((_type *)ba_alloc((_a), sizeof(_type) * (_count)))
+// Copies string to memory of allocator. Resulting string is zero-terminated.
+string ba_string_dup(bump_allocator *a, string str);
+// Releases all allocations, but keeps memory blocks for future use.
+void ba_clear(bump_allocator *a);
+// Returns all memory to system.
+void ba_free(bump_allocator *a);
+
+#endif
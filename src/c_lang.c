@@ -6,8 +6,11 @@
 #include <string.h>
 
 #include "buffer_writer.h"
+#include "bump_allocator.h"
 #include "c_types.h"
+#include "intern.h"
 #include "pp_lexer.h"
+#include "source_manager.h"
 #include "str.h"
 #include "unicode.h"
 
@@ -37,7 +40,7 @@ static string KEYWORD_STRINGS[] = {
     WRAPZ("return"),
     WRAPZ("short"),
     WRAPZ("signed"),
-    WRAPZ("unsigned"),
+    WRAPZ("sizeof"),
     WRAPZ("static"),
     WRAPZ("struct"),
     WRAPZ("switch"),
@@ -67,7 +70,7 @@ static string PUNCTUATOR_STRINGS[] = {
     WRAPZ("(unknown)"), WRAPZ(">>="), WRAPZ("<<="), WRAPZ("+="), WRAPZ("-="), WRAPZ("*="),
     WRAPZ("/="),        WRAPZ("%="),  WRAPZ("&="),  WRAPZ("|="), WRAPZ("^="), WRAPZ("++"),
     WRAPZ("--"),        WRAPZ(">>"),  WRAPZ("<<"),  WRAPZ("&&"), WRAPZ("||"), WRAPZ("=="),
-    WRAPZ("!="),        WRAPZ("<="),  WRAPZ(">="),  WRAPZ("...")};
+    WRAPZ("!="),        WRAPZ("<="),  WRAPZ(">="),  WRAPZ("..."), WRAPZ("->")};
 
 static string
 get_kw_str(c_keyword_kind kind) {
@@ -83,98 +86,51 @@ get_punct_str(c_punct_kind kind) {
     return PUNCTUATOR_STRINGS[kind - 0x100];
 }
 
-static c_punct_kind
-get_c_punct_kind_from_pp(pp_punct_kind kind) {
-    c_punct_kind result = 0;
-    if (kind < 0x100) {
-        if (kind != '#') {
-            result = (uint32_t)kind;
-        }
-    } else {
-        switch (kind) {
-            INVALID_DEFAULT_CASE;
-        case PP_TOK_PUNCT_IRSHIFT:
-            result = C_PUNCT_IRSHIFT;
-            break;
-        case PP_TOK_PUNCT_ILSHIFT:
-            result = C_PUNCT_ILSHIFT;
-            break;
-        case PP_TOK_PUNCT_VARARGS:
-            result = C_PUNCT_VARARGS;
-            break;
-        case PP_TOK_PUNCT_IADD:
-            result = C_PUNCT_IADD;
-            break;
-        case PP_TOK_PUNCT_ISUB:
-            result = C_PUNCT_ISUB;
-            break;
-        case PP_TOK_PUNCT_IMUL:
-            result = C_PUNCT_IMUL;
-            break;
-        case PP_TOK_PUNCT_IDIV:
-            result = C_PUNCT_IDIV;
-            break;
-        case PP_TOK_PUNCT_IMOD:
-            result = C_PUNCT_IMOD;
-            break;
-        case PP_TOK_PUNCT_IAND:
-            result = C_PUNCT_IAND;
-            break;
-        case PP_TOK_PUNCT_IOR:
-            result = C_PUNCT_IOR;
-            break;
-        case PP_TOK_PUNCT_IXOR:
-            result = C_PUNCT_IXOR;
-            break;
-        case PP_TOK_PUNCT_INC:
-            result = C_PUNCT_INC;
-            break;
-        case PP_TOK_PUNCT_DEC:
-            result = C_PUNCT_DEC;
-            break;
-        case PP_TOK_PUNCT_RSHIFT:
-            result = C_PUNCT_RSHIFT;
-            break;
-        case PP_TOK_PUNCT_LSHIFT:
-            result = C_PUNCT_LSHIFT;
-            break;
-        case PP_TOK_PUNCT_LAND:
-            result = C_PUNCT_LAND;
-            break;
-        case PP_TOK_PUNCT_LOR:
-            result = C_PUNCT_LOR;
-            break;
-        case PP_TOK_PUNCT_EQ:
-            result = C_PUNCT_EQ;
-            break;
-        case PP_TOK_PUNCT_NEQ:
-            result = C_PUNCT_NEQ;
-            break;
-        case PP_TOK_PUNCT_LEQ:
-            result = C_PUNCT_LEQ;
-            break;
-        case PP_TOK_PUNCT_GEQ:
-            result = C_PUNCT_GEQ;
-            break;
-        }
-    }
-    return result;
-}
+// Keywords are classified with perfect hash. Key is made of first two
+// characters, last character and length of identifier, which are distinct for
+// all keywords. Multiplier was found with brute-force search, so that all
+// keywords are mapped to different slots of KEYWORD_HASH_TABLE. Table must be
+// regenerated if keywords are changed (test_c_lang checks that it is correct).
+#define KEYWORD_HASH_MULTIPLIER 0x9890E999u
+#define KEYWORD_HASH_BITS 7
+#define KEYWORD_MIN_LEN 2
+#define KEYWORD_MAX_LEN 14
+
+// Maps hash value to keyword kind. Zero means there is no keyword with such
+// hash.
+static const uint8_t KEYWORD_HASH_TABLE[1 << KEYWORD_HASH_BITS] = {
+    0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x16, 0x0C, 0x00,
+    0x21, 0x00, 0x00, 0x1A, 0x23, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x17, 0x00, 0x00, 0x24, 0x00,
+    0x04, 0x00, 0x00, 0x0B, 0x00, 0x2C, 0x00, 0x00, 0x00, 0x1E, 0x00, 0x00,
+    0x1C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0E, 0x00, 0x03, 0x00,
+    0x00, 0x2F, 0x12, 0x00, 0x00, 0x26, 0x2D, 0x00, 0x2A, 0x00, 0x00, 0x02,
+    0x00, 0x13, 0x10, 0x11, 0x30, 0x00, 0x00, 0x00, 0x19, 0x1B, 0x00, 0x00,
+    0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x29, 0x01, 0x00, 0x00, 0x00, 0x15,
+    0x00, 0x0D, 0x00, 0x06, 0x28, 0x20, 0x07, 0x18, 0x2E, 0x27, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x0A, 0x1D, 0x0F, 0x00, 0x08, 0x14, 0x2B, 0x25,
+    0x22, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
 
-static c_keyword_kind
+c_keyword_kind
 get_kw_kind(string test) {
     c_keyword_kind kind = 0;
-    for (uint32_t i = 0; i < ARRAY_SIZE(KEYWORD_STRINGS); ++i) {
-        if (string_eq(test, KEYWORD_STRINGS[i])) {
-            kind = i;
-            break;
+    if (test.len >= KEYWORD_MIN_LEN && test.len <= KEYWORD_MAX_LEN) {
+        uint8_t *data = (uint8_t *)test.data;
+        uint32_t key =
+            data[0] | (data[1] << 8) | (data[test.len - 1] << 16) | (test.len << 24);
+        uint32_t hash = (key * KEYWORD_HASH_MULTIPLIER) >> (32 - KEYWORD_HASH_BITS);
+
+        c_keyword_kind candidate = KEYWORD_HASH_TABLE[hash];
+        if (candidate && string_eq(test, KEYWORD_STRINGS[candidate])) {
+            kind = candidate;
         }
     }
     return kind;
 }
 
 bool
-convert_pp_token(pp_token *pp_tok, token *tok, char *buf, uint32_t buf_size,
+convert_pp_token(bump_allocator *a, pp_token *pp_tok, token *tok, char *buf, uint32_t buf_size,
                  uint32_t *buf_writtenp) {
     bool result         = false;
     tok->at_line_start  = pp_tok->at_line_start;
@@ -186,19 +142,30 @@ convert_pp_token(pp_token *pp_tok, token *tok, char *buf, uint32_t buf_size,
         result    = true;
     } break;
     case PP_TOK_ID: {
-        c_keyword_kind kw = get_kw_kind(pp_tok->str);
+        interned_string *ident = pp_tok->ident;
+        uint32_t kw_cache = __atomic_load_n(&ident->c_kw_cache, __ATOMIC_RELAXED);
+        if (!kw_cache) {
+            kw_cache = get_kw_kind(ident->str) + 1;
+            __atomic_store_n(&ident->c_kw_cache, kw_cache, __ATOMIC_RELAXED);
+        }
+
+        c_keyword_kind kw = kw_cache - 1;
         if (kw) {
             tok->kind = TOK_KW;
             tok->kw   = kw;
         } else {
-            tok->kind     = TOK_ID;
-            *buf_writtenp = snprintf(buf, buf_size, "%.*s", pp_tok->str.len, pp_tok->str.data);
-            tok->str      = (string){buf, *buf_writtenp};
+            tok->kind  = TOK_ID;
+            tok->ident = ident;
+            tok->str   = ident->str;
         }
         result = true;
     } break;
     case PP_TOK_NUM: {
-        c_number_convert_result convert = convert_c_number(pp_tok->str.data);
+        // Number spelling points to source, so copy it to make it terminated
+        assert(pp_tok->str.len < buf_size);
+        memcpy(buf, pp_tok->str.data, pp_tok->str.len);
+        buf[pp_tok->str.len]            = 0;
+        c_number_convert_result convert = convert_c_number(buf);
 
         if (convert.is_valid) {
             tok->kind = TOK_NUM;
@@ -239,18 +206,15 @@ convert_pp_token(pp_token *pp_tok, token *tok, char *buf, uint32_t buf_size,
             c_type *base_type    = get_standard_type(base_type_kind);
             uint32_t byte_stride = base_type->size;
 
-            uint32_t len = 0;
-            char *cursor = pp_tok->str.data;
-            while (*cursor) {
-                uint32_t cp;
-                cursor = utf8_decode(cursor, &cp);
-                ++len;
-            }
-            uintptr_t memory_size = byte_stride * (len + 1);
+            // Each code point takes at least as many bytes in utf8 as there
+            // are code units in any other encoding, so string length is bounded
+            // by its size in bytes.
+            uintptr_t memory_size = byte_stride * (pp_tok->str.len + 1);
             assert(memory_size <= buf_size);
             void *write_cursor = buf;
-            cursor             = pp_tok->str.data;
-            while (*cursor) {
+            char *cursor       = pp_tok->str.data;
+            char *eof          = STRING_END(pp_tok->str);
+            while (cursor < eof) {
                 uint32_t cp;
                 cursor = utf8_decode(cursor, &cp);
                 if (byte_stride == 1) {
@@ -266,13 +230,15 @@ convert_pp_token(pp_token *pp_tok, token *tok, char *buf, uint32_t buf_size,
                     UNREACHABLE;
                 }
             }
+            // Length in code units
+            uint32_t len  = ((char *)write_cursor - buf) / byte_stride;
             uint32_t zero = 0;
             memcpy(write_cursor, &zero, byte_stride);
             *buf_writtenp = byte_stride * len;
 
             tok->kind = TOK_STR;
             tok->str  = (string){buf, byte_stride * len};
-            tok->type = make_array_type(base_type, len + 1);
+            tok->type = make_array_type(a, base_type, len + 1);
             result    = true;
         } break;
         case PP_TOK_STR_CCHAR:
@@ -296,8 +262,9 @@ convert_pp_token(pp_token *pp_tok, token *tok, char *buf, uint32_t buf_size,
             // Convert it to number
             uint64_t value       = 0;
             char *cursor         = pp_tok->str.data;
+            char *eof            = STRING_END(pp_tok->str);
             uint32_t byte_stride = base_type->size;
-            while (*cursor) {
+            while (cursor < eof) {
                 uint32_t cp;
                 cursor = utf8_decode(cursor, &cp);
                 if (cp >= 1u << (8u * byte_stride)) {
@@ -316,10 +283,11 @@ convert_pp_token(pp_token *pp_tok, token *tok, char *buf, uint32_t buf_size,
         }
     } break;
     case PP_TOK_PUNCT: {
-        c_punct_kind punct = get_c_punct_kind_from_pp(pp_tok->punct_kind);
-        if (punct) {
+        // Values of pp_punct_kind match c_punct_kind, except for preprocessor
+        // only punctuators.
+        if (pp_tok->punct_kind != '#' && pp_tok->punct_kind != PP_TOK_PUNCT_DHASH) {
             tok->kind  = TOK_PUNCT;
-            tok->punct = punct;
+            tok->punct = (c_punct_kind)pp_tok->punct_kind;
             result     = true;
         }
     } break;
@@ -375,23 +343,23 @@ fmt_c_strw(fmt_c_str_args args, buffer_writer *w) {
     switch (args.type->ptr_to->kind) {
     default:
         buf_write(w, "\"");
-        buf_write_raw_utf8(w, args.str.data);
+        buf_write_raw_utf8(w, args.str.data, args.str.len, '"');
         break;
     case C_TYPE_UCHAR:
         buf_write(w, "u8\"");
-        buf_write_raw_utf8(w, args.str.data);
+        buf_write_raw_utf8(w, args.str.data, args.str.len, '"');
         break;
     case C_TYPE_CHAR16:
         buf_write(w, "u\"");
-        buf_write_raw_utf16(w, args.str.data);
+        buf_write_raw_utf16(w, args.str.data, args.str.len, '"');
         break;
     case C_TYPE_CHAR32:
         buf_write(w, "U\"");
-        buf_write_raw_utf32(w, args.str.data);
+        buf_write_raw_utf32(w, args.str.data, args.str.len, '"');
         break;
     case C_TYPE_WCHAR:
         buf_write(w, "L\"");
-        buf_write_raw_utf32(w, args.str.data);
+        buf_write_raw_utf32(w, args.str.data, args.str.len, '"');
         break;
     }
     buf_write(w, "\"");
@@ -446,8 +414,12 @@ fmt_token(char *buf, uint32_t buf_len, token *tok) {
 
 void
 fmt_token_verbosew(buffer_writer *w, token *tok) {
-    buf_write(w, "%.*s:%u:%u: ", tok->loc.filename.len, tok->loc.filename.data, tok->loc.line,
-              tok->loc.col);
+    sm_location loc = sm_resolve(tok->loc);
+    string filename = {0};
+    if (loc.buffer) {
+        filename = loc.buffer->name;
+    }
+    buf_write(w, "%.*s:%u:%u: ", filename.len, filename.data, loc.line, loc.col);
     switch (tok->kind) {
         INVALID_DEFAULT_CASE;
     case TOK_EOF:
@@ -478,3 +450,12 @@ fmt_token_verbose(char *buf, uint32_t buf_len, token *tok) {
     fmt_token_verbosew(&w, tok);
     return w.cursor - buf;
 }
+
+#if HOLOC_DEBUG
+char *
+debug_token(token *tok) {
+    static char buf[4096];
+    fmt_token_verbose(buf, sizeof(buf), tok);
+    return buf;
+}
+#endif
@@ -5,6 +5,8 @@
 
 struct pp_token;
 struct buffer_writer;
+struct bump_allocator;
+struct interned_string;
 
 typedef enum {
     C_KW_AUTO          = 0x1,   // auto
@@ -31,7 +33,7 @@ typedef enum {
     C_KW_RETURN        = 0x16,  // return
     C_KW_SHORT         = 0x17,  // short
     C_KW_SIGNED        = 0x18,  // signed
-    C_KW_SIZEOF        = 0x19,  // unsigned
+    C_KW_SIZEOF        = 0x19,  // sizeof
     C_KW_STATIC        = 0x1A,  // static
     C_KW_STRUCT        = 0x1B,  // struct
     C_KW_SWITCH        = 0x1C,  // switch
@@ -100,6 +102,8 @@ typedef struct token {
 
     token_kind kind;
     string str;
+    // Interned spelling, if token is identifier
+    struct interned_string *ident;
     uint64_t uint_value;
     long double float_value;
     struct c_type *type;
@@ -108,9 +112,6 @@ typedef struct token {
 
     bool has_whitespace;
     bool at_line_start;
-#if HOLOC_DEBUG
-    char *_debug_info;
-#endif
 } token;
 
 typedef struct {
@@ -124,8 +125,12 @@ typedef struct {
     string str;
 } fmt_c_str_args;
 
-bool convert_pp_token(struct pp_token *pp_tok, token *tok, char *buf, uint32_t buf_size,
-                      uint32_t *buf_writtenp);
+// Returns kind of keyword with given spelling, or zero if it is not a keyword
+c_keyword_kind get_kw_kind(string test);
+// Converts preprocessor token to language token. Allocator is used for types
+// created for string literals.
+bool convert_pp_token(struct bump_allocator *a, struct pp_token *pp_tok, token *tok, char *buf,
+                      uint32_t buf_size, uint32_t *buf_writtenp);
 #define IS_KW(_tok, _kw) ((_tok)->kind == TOK_KW && (_tok)->kw == (_kw))
 #define IS_PUNCT(_tok, _punct) ((_tok)->kind == TOK_PUNCT && (_tok)->punct == (_punct))
 
@@ -140,4 +145,9 @@ uint32_t fmt_token(char *buf, uint32_t buf_size, token *tok);
 
 void fmt_token_verbosew(struct buffer_writer *w, token *tok);
 uint32_t fmt_token_verbose(char *buf, uint32_t buf_size, token *tok);
+
+#if HOLOC_DEBUG
+// Debugger helper, see debug_pp_tok
+char *debug_token(token *tok);
+#endif
 #endif
@@ -7,6 +7,7 @@
 #include <string.h>
 
 #include "buffer_writer.h"
+#include "bump_allocator.h"
 
 #define MAKE_TYPE(_kind, _size)      \
     &(c_type) {                      \
@@ -140,8 +141,8 @@ get_standard_type(c_type_kind kind) {
 }
 
 c_type *
-make_ptr_type(c_type *base) {
-    c_type *type = calloc(1, sizeof(c_type));
+make_ptr_type(bump_allocator *a, c_type *base) {
+    c_type *type = ba_alloc_struct(a, c_type);
     type->size   = sizeof(void *);
     type->ptr_to = base;
     type->kind   = C_TYPE_PTR;
@@ -149,8 +150,8 @@ make_ptr_type(c_type *base) {
 }
 
 c_type *
-make_array_type(c_type *base, uint32_t len) {
-    c_type *type  = calloc(1, sizeof(c_type));
+make_array_type(bump_allocator *a, c_type *base, uint32_t len) {
+    c_type *type  = ba_alloc_struct(a, c_type);
     type->size    = len * base->size;
     type->ptr_to  = base;
     type->arr_len = len;
@@ -159,8 +160,8 @@ make_array_type(c_type *base, uint32_t len) {
 }
 
 c_type *
-make_c_type_struct(string name, c_struct_member *members) {
-    c_type *type         = calloc(1, sizeof(c_type));
+make_c_type_struct(bump_allocator *a, string name, c_struct_member *members) {
+    c_type *type         = ba_alloc_struct(a, c_type);
     type->kind           = C_TYPE_STRUCT;
     type->name           = name;
     type->struct_members = members;
@@ -4,16 +4,18 @@
 #include <stddef.h>
 
 #include "ast.h"
+#include "bump_allocator.h"
 #include "c_lang.h"
 #include "c_types.h"
+#include "error_reporter.h"
 
 ast *
-ast_cond_incl_expr_primary(token **tokp) {
+ast_cond_incl_expr_primary(bump_allocator *a, token **tokp) {
     ast *node  = NULL;
     token *tok = *tokp;
     if (IS_PUNCT(tok, '(')) {
         tok  = tok->next;
-        node = ast_cond_incl_expr(&tok);
+        node = ast_cond_incl_expr(a, &tok);
         if (!IS_PUNCT(tok, ')')) {
             NOT_IMPL;
         } else {
@@ -23,7 +25,7 @@ ast_cond_incl_expr_primary(token **tokp) {
         if (!c_type_kind_is_int(tok->type->kind)) {
             NOT_IMPL;
         } else {
-            ast_number *num = make_ast(AST_NUM, tok->loc);
+            ast_number *num = make_ast(a, AST_NUM, tok->loc);
             num->uint_value = tok->uint_value;
             num->type       = tok->type;
             node            = (ast *)num;
@@ -37,67 +39,67 @@ ast_cond_incl_expr_primary(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_unary(token **tokp) {
+ast_cond_incl_expr_unary(bump_allocator *a, token **tokp) {
     ast *node  = NULL;
     token *tok = *tokp;
     if (IS_PUNCT(tok, '+')) {
         tok           = tok->next;
-        ast_unary *un = make_ast(AST_UN, tok->loc);
+        ast_unary *un = make_ast(a, AST_UN, tok->loc);
         un->un_kind   = AST_UN_PLUS;
-        un->expr      = ast_cond_incl_expr_primary(&tok);
+        un->expr      = ast_cond_incl_expr_primary(a, &tok);
         node          = (ast *)un;
     } else if (IS_PUNCT(tok, '-')) {
         tok           = tok->next;
-        ast_unary *un = make_ast(AST_UN, tok->loc);
+        ast_unary *un = make_ast(a, AST_UN, tok->loc);
         un->un_kind   = AST_UN_MINUS;
-        un->expr      = ast_cond_incl_expr_primary(&tok);
+        un->expr      = ast_cond_incl_expr_primary(a, &tok);
         node          = (ast *)un;
     } else if (IS_PUNCT(tok, '!')) {
         tok           = tok->next;
-        ast_unary *un = make_ast(AST_UN, tok->loc);
+        ast_unary *un = make_ast(a, AST_UN, tok->loc);
         un->un_kind   = AST_UN_LNOT;
-        un->expr      = ast_cond_incl_expr_primary(&tok);
+        un->expr      = ast_cond_incl_expr_primary(a, &tok);
         node          = (ast *)un;
     } else if (IS_PUNCT(tok, '~')) {
         tok           = tok->next;
-        ast_unary *un = make_ast(AST_UN, tok->loc);
+        ast_unary *un = make_ast(a, AST_UN, tok->loc);
         un->un_kind   = AST_UN_NOT;
-        un->expr      = ast_cond_incl_expr_primary(&tok);
+        un->expr      = ast_cond_incl_expr_primary(a, &tok);
         node          = (ast *)un;
     } else {
-        node = ast_cond_incl_expr_primary(&tok);
+        node = ast_cond_incl_expr_primary(a, &tok);
     }
     *tokp = tok;
     return node;
 }
 
 ast *
-ast_cond_incl_expr_mul(token **tokp) {
-    ast *node  = ast_cond_incl_expr_unary(tokp);
+ast_cond_incl_expr_mul(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_unary(a, tokp);
     token *tok = *tokp;
     for (;;) {
         if (IS_PUNCT(tok, '*')) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_MUL;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_unary(&tok);
+            bin->right      = ast_cond_incl_expr_unary(a, &tok);
             node            = (ast *)bin;
             continue;
         } else if (IS_PUNCT(tok, '/')) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_DIV;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_unary(&tok);
+            bin->right      = ast_cond_incl_expr_unary(a, &tok);
             node            = (ast *)bin;
             continue;
         } else if (IS_PUNCT(tok, '%')) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_MOD;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_unary(&tok);
+            bin->right      = ast_cond_incl_expr_unary(a, &tok);
             node            = (ast *)bin;
             continue;
         }
@@ -109,24 +111,24 @@ ast_cond_incl_expr_mul(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_add(token **tokp) {
-    ast *node  = ast_cond_incl_expr_mul(tokp);
+ast_cond_incl_expr_add(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_mul(a, tokp);
     token *tok = *tokp;
     for (;;) {
         if (IS_PUNCT(tok, '+')) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_ADD;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_mul(&tok);
+            bin->right      = ast_cond_incl_expr_mul(a, &tok);
             node            = (ast *)bin;
             continue;
         } else if (IS_PUNCT(tok, '-')) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_SUB;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_mul(&tok);
+            bin->right      = ast_cond_incl_expr_mul(a, &tok);
             node            = (ast *)bin;
             continue;
         }
@@ -138,24 +140,24 @@ ast_cond_incl_expr_add(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_shift(token **tokp) {
-    ast *node  = ast_cond_incl_expr_add(tokp);
+ast_cond_incl_expr_shift(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_add(a, tokp);
     token *tok = *tokp;
     for (;;) {
         if (IS_PUNCT(tok, C_PUNCT_LSHIFT)) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_LSHIFT;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_add(&tok);
+            bin->right      = ast_cond_incl_expr_add(a, &tok);
             node            = (ast *)bin;
             continue;
         } else if (IS_PUNCT(tok, C_PUNCT_RSHIFT)) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_RSHIFT;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_add(&tok);
+            bin->right      = ast_cond_incl_expr_add(a, &tok);
             node            = (ast *)bin;
             continue;
         }
@@ -167,40 +169,40 @@ ast_cond_incl_expr_shift(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_rel(token **tokp) {
-    ast *node  = ast_cond_incl_expr_shift(tokp);
+ast_cond_incl_expr_rel(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_shift(a, tokp);
     token *tok = *tokp;
     for (;;) {
         if (IS_PUNCT(tok, '<')) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_L;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_shift(&tok);
+            bin->right      = ast_cond_incl_expr_shift(a, &tok);
             node            = (ast *)bin;
             continue;
         } else if (IS_PUNCT(tok, '>')) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_G;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_shift(&tok);
+            bin->right      = ast_cond_incl_expr_shift(a, &tok);
             node            = (ast *)bin;
             continue;
         } else if (IS_PUNCT(tok, C_PUNCT_LEQ)) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_LE;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_shift(&tok);
+            bin->right      = ast_cond_incl_expr_shift(a, &tok);
             node            = (ast *)bin;
             continue;
         } else if (IS_PUNCT(tok, C_PUNCT_GEQ)) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_GE;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_shift(&tok);
+            bin->right      = ast_cond_incl_expr_shift(a, &tok);
             node            = (ast *)bin;
             continue;
         }
@@ -212,24 +214,24 @@ ast_cond_incl_expr_rel(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_eq(token **tokp) {
-    ast *node  = ast_cond_incl_expr_rel(tokp);
+ast_cond_incl_expr_eq(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_rel(a, tokp);
     token *tok = *tokp;
     for (;;) {
         if (IS_PUNCT(tok, C_PUNCT_EQ)) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_EQ;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_rel(&tok);
+            bin->right      = ast_cond_incl_expr_rel(a, &tok);
             node            = (ast *)bin;
             continue;
         } else if (IS_PUNCT(tok, C_PUNCT_NEQ)) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_NEQ;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_rel(&tok);
+            bin->right      = ast_cond_incl_expr_rel(a, &tok);
             node            = (ast *)bin;
             continue;
         }
@@ -241,16 +243,16 @@ ast_cond_incl_expr_eq(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_and(token **tokp) {
-    ast *node  = ast_cond_incl_expr_eq(tokp);
+ast_cond_incl_expr_and(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_eq(a, tokp);
     token *tok = *tokp;
     for (;;) {
         if (IS_PUNCT(tok, '&')) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_AND;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_eq(&tok);
+            bin->right      = ast_cond_incl_expr_eq(a, &tok);
             node            = (ast *)bin;
             continue;
         }
@@ -262,16 +264,16 @@ ast_cond_incl_expr_and(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_xor(token **tokp) {
-    ast *node  = ast_cond_incl_expr_and(tokp);
+ast_cond_incl_expr_xor(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_and(a, tokp);
     token *tok = *tokp;
     for (;;) {
         if (IS_PUNCT(tok, '^')) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_XOR;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_and(&tok);
+            bin->right      = ast_cond_incl_expr_and(a, &tok);
             node            = (ast *)bin;
             continue;
         }
@@ -283,16 +285,16 @@ ast_cond_incl_expr_xor(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_or(token **tokp) {
-    ast *node  = ast_cond_incl_expr_xor(tokp);
+ast_cond_incl_expr_or(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_xor(a, tokp);
     token *tok = *tokp;
     for (;;) {
         if (IS_PUNCT(tok, '|')) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_OR;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_xor(&tok);
+            bin->right      = ast_cond_incl_expr_xor(a, &tok);
             node            = (ast *)bin;
             continue;
         }
@@ -304,16 +306,16 @@ ast_cond_incl_expr_or(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_land(token **tokp) {
-    ast *node  = ast_cond_incl_expr_or(tokp);
+ast_cond_incl_expr_land(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_or(a, tokp);
     token *tok = *tokp;
     for (;;) {
         if (IS_PUNCT(tok, C_PUNCT_LAND)) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_LAND;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_or(&tok);
+            bin->right      = ast_cond_incl_expr_or(a, &tok);
             node            = (ast *)bin;
             continue;
         }
@@ -325,16 +327,16 @@ ast_cond_incl_expr_land(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_lor(token **tokp) {
-    ast *node  = ast_cond_incl_expr_land(tokp);
+ast_cond_incl_expr_lor(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_land(a, tokp);
     token *tok = *tokp;
     for (;;) {
         if (IS_PUNCT(tok, C_PUNCT_LOR)) {
             tok             = tok->next;
-            ast_binary *bin = make_ast(AST_BIN, tok->loc);
+            ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
             bin->bin_kind   = AST_BIN_LOR;
             bin->left       = node;
-            bin->right      = ast_cond_incl_expr_land(&tok);
+            bin->right      = ast_cond_incl_expr_land(a, &tok);
             node            = (ast *)bin;
             continue;
         }
@@ -346,16 +348,16 @@ ast_cond_incl_expr_lor(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr_ternary(token **tokp) {
+ast_cond_incl_expr_ternary(bump_allocator *a, token **tokp) {
     token *tok = *tokp;
-    ast *node  = ast_cond_incl_expr_lor(&tok);
+    ast *node  = ast_cond_incl_expr_lor(a, &tok);
     if (IS_PUNCT(tok, '?')) {
-        ast_ternary *ter = make_ast(AST_TER, tok->loc);
+        ast_ternary *ter = make_ast(a, AST_TER, tok->loc);
         ter->cond        = node;
-        ter->cond_true   = ast_cond_incl_expr(&tok);
+        ter->cond_true   = ast_cond_incl_expr(a, &tok);
         if (IS_PUNCT(tok, ':')) {
             tok             = tok->next;
-            ter->cond_false = ast_cond_incl_expr_ternary(&tok);
+            ter->cond_false = ast_cond_incl_expr_ternary(a, &tok);
             node            = (ast *)ter;
         } else {
             NOT_IMPL;
@@ -366,15 +368,15 @@ ast_cond_incl_expr_ternary(token **tokp) {
 }
 
 ast *
-ast_cond_incl_expr(token **tokp) {
-    ast *node  = ast_cond_incl_expr_ternary(tokp);
+ast_cond_incl_expr(bump_allocator *a, token **tokp) {
+    ast *node  = ast_cond_incl_expr_ternary(a, tokp);
     token *tok = *tokp;
     if (IS_PUNCT(tok, ',')) {
         tok             = tok->next;
-        ast_binary *bin = make_ast(AST_BIN, tok->loc);
+        ast_binary *bin = make_ast(a, AST_BIN, tok->loc);
         bin->bin_kind   = AST_BIN_COMMA;
         bin->left       = node;
-        bin->right      = ast_cond_incl_expr(&tok);
+        bin->right      = ast_cond_incl_expr(a, &tok);
         *tokp           = tok;
     }
     return node;
@@ -397,7 +399,7 @@ ast_cond_incl_eval(ast *node) {
         int64_t left  = ast_cond_incl_eval(bin->left);
         int64_t right = ast_cond_incl_eval(bin->right);
 
-        switch (bin->kind) {
+        switch (bin->bin_kind) {
             INVALID_DEFAULT_CASE;
         case AST_BIN_ADD:
             result = left + right;
@@ -409,10 +411,18 @@ ast_cond_incl_eval(ast *node) {
             result = left * right;
             break;
         case AST_BIN_DIV:
-            result = left / right;
+            if (!right) {
+                report_error(node->loc, "Division by zero in preprocessor expression");
+            } else {
+                result = left / right;
+            }
             break;
         case AST_BIN_MOD:
-            result = left % right;
+            if (!right) {
+                report_error(node->loc, "Division by zero in preprocessor expression");
+            } else {
+                result = left % right;
+            }
             break;
         case AST_BIN_LE:
             result = left <= right;
@@ -460,7 +470,7 @@ ast_cond_incl_eval(ast *node) {
 
         int64_t expr = ast_cond_incl_eval(un->expr);
 
-        switch (un->kind) {
+        switch (un->un_kind) {
             INVALID_DEFAULT_CASE;
         case AST_UN_MINUS:
             result = -expr;
@@ -5,6 +5,7 @@
 
 struct ast;
 struct token;
+struct bump_allocator;
 
 // Generally, expression inside the #if are named constant, but in reality they
 // implement only a subset of them (like there is no operator sizeof in #if's).
@@ -15,45 +16,45 @@ struct token;
 //
 // primary = '(' expr ')'
 //         | num
-struct ast *ast_cond_incl_expr_primary(struct token **tokp);
+struct ast *ast_cond_incl_expr_primary(struct bump_allocator *a, struct token **tokp);
 // unary = '+' primary
 //       | '-' primary
 //       | '!' primary
 //       | '~' primary
 //       | primary
-struct ast *ast_cond_incl_expr_unary(struct token **tokp);
+struct ast *ast_cond_incl_expr_unary(struct bump_allocator *a, struct token **tokp);
 // mul = unary ('*' unary |
 //              '/' unary |
 //              '%' unary)*
-struct ast *ast_cond_incl_expr_mul(struct token **tokp);
+struct ast *ast_cond_incl_expr_mul(struct bump_allocator *a, struct token **tokp);
 // add = mul ('+' mul |
 //            '-' mul)*
-struct ast *ast_cond_incl_expr_add(struct token **tokp);
+struct ast *ast_cond_incl_expr_add(struct bump_allocator *a, struct token **tokp);
 // shift = add ('<<' add |
 //              '>>' add)*
-struct ast *ast_cond_incl_expr_shift(struct token **tokp);
+struct ast *ast_cond_incl_expr_shift(struct bump_allocator *a, struct token **tokp);
 // rel = shift ('<=' shift |
 //              '<'  shift |
 //              '>'  shift |
 //              '>=' shift)*
-struct ast *ast_cond_incl_expr_rel(struct token **tokp);
+struct ast *ast_cond_incl_expr_rel(struct bump_allocator *a, struct token **tokp);
 // eq = rel ('!=' rel |
 //           '==' rel)*
-struct ast *ast_cond_incl_expr_eq(struct token **tokp);
+struct ast *ast_cond_incl_expr_eq(struct bump_allocator *a, struct token **tokp);
 // and = eq ('&' eq)*
-struct ast *ast_cond_incl_expr_and(struct token **tokp);
+struct ast *ast_cond_incl_expr_and(struct bump_allocator *a, struct token **tokp);
 // xor = and ('^' and)*
-struct ast *ast_cond_incl_expr_xor(struct token **tokp);
+struct ast *ast_cond_incl_expr_xor(struct bump_allocator *a, struct token **tokp);
 // or = xor ('|' xor)*
-struct ast *ast_cond_incl_expr_or(struct token **tokp);
+struct ast *ast_cond_incl_expr_or(struct bump_allocator *a, struct token **tokp);
 // land = or ('&&' or)*
-struct ast *ast_cond_incl_expr_land(struct token **tokp);
+struct ast *ast_cond_incl_expr_land(struct bump_allocator *a, struct token **tokp);
 // lor = land ('||' land)*
-struct ast *ast_cond_incl_expr_lor(struct token **tokp);
+struct ast *ast_cond_incl_expr_lor(struct bump_allocator *a, struct token **tokp);
 // ternary = lor ('?' expr ':' ternary)?
-struct ast *ast_cond_incl_expr_ternary(struct token **tokp);
+struct ast *ast_cond_incl_expr_ternary(struct bump_allocator *a, struct token **tokp);
 // expr = ternary (',' expr)?
-struct ast *ast_cond_incl_expr(struct token **tokp);
+struct ast *ast_cond_incl_expr(struct bump_allocator *a, struct token **tokp);
 // Returns intmax_t for constant expression.
 int64_t ast_cond_incl_eval(struct ast *node);
 
@@ -1,21 +1,27 @@
 #include "error_reporter.h"
 
 #include <assert.h>
-#include <stdio.h>
 #include <string.h>
 
-#include "file_storage.h"
+#include "buffer_writer.h"
+#include "source_manager.h"
 #include "str.h"
 #include "unicode.h"
 
-static error_reporter er_;
+static error_reporter er_ = {.mutex = PTHREAD_MUTEX_INITIALIZER};
 static error_reporter *er = &er_;
+static THREAD_LOCAL FILE *er_output;
 
 error_reporter *
 get_error_reporter(void) {
     return er;
 }
 
+void
+er_set_output(FILE *output) {
+    er_output = output;
+}
+
 void
 er_print_final_stats(void) {
     fflush(stdout);
@@ -34,47 +40,58 @@ er_print_final_stats(void) {
 }
 
 void
-report_message_internalv(string file_contents, source_loc loc, string message_kind, char *msg,
-                         va_list args) {
-    char *file_eof        = STRING_END(file_contents);
-    char *line_start      = file_contents.data;
-    uint32_t line_counter = 1;
-    while (line_counter < loc.line && line_start < file_eof) {
-        if (*line_start == '\n') {
-            ++line_counter;
+report_message_internalv(source_loc source, string message_kind, char *msg, va_list args) {
+    // Whole message is formatted first and then written at once, so that
+    // messages are not interleaved with other output and each takes one
+    // write call on unbuffered stderr.
+    char buffer[8192];
+    buffer_writer w = {buffer, buffer + sizeof(buffer)};
+    sm_location loc = sm_resolve(source);
+    if (!loc.buffer) {
+        buf_write(&w, "\033[1m%.*s: \033[1m", message_kind.len, message_kind.data);
+        buf_writev(&w, msg, args);
+        buf_write(&w, "\033[0m\n");
+    } else {
+        // Line and column are found with line table of buffer, so line start
+        // is known without scanning file.
+        string file_contents = loc.buffer->contents;
+        char *file_eof       = STRING_END(file_contents);
+        char *line_start     = file_contents.data + loc.offset - (loc.col - 1);
+        char *line_end       = memchr(line_start, '\n', file_eof - line_start);
+        if (!line_end) {
+            line_end = file_eof;
         }
-        ++line_start;
-    }
 
-    char *line_end = line_start + 1;
-    while (*line_end != '\n' && line_end != file_eof) {
-        ++line_end;
-    }
-
-    uint32_t utf8_col_counter = 0;
-    char *utf8_col_cursor     = line_start;
-    while (utf8_col_cursor < line_start + loc.col && utf8_col_cursor < line_end) {
-        uint32_t _;
-        utf8_col_cursor = utf8_decode(utf8_col_cursor, &_);
-        ++utf8_col_counter;
-    }
+        // Column is shown in code points, not bytes
+        uint32_t utf8_col_counter = 1;
+        char *utf8_col_cursor     = line_start;
+        char *loc_cursor          = file_contents.data + loc.offset;
+        while (utf8_col_cursor < loc_cursor) {
+            uint32_t _;
+            utf8_col_cursor = utf8_decode(utf8_col_cursor, &_);
+            ++utf8_col_counter;
+        }
 
-    fprintf(stderr, "\033[1m%.*s:%u:%u: %.*s: \033[1m", loc.filename.len, loc.filename.data,
-            loc.line, utf8_col_counter, message_kind.len, message_kind.data);
-    vfprintf(stderr, msg, args);
-    fprintf(stderr, "\033[0m\n%.*s\n", (int)(line_end - line_start), line_start);
-    if (utf8_col_counter != 1) {
-        fprintf(stderr, "%*c", utf8_col_counter - 1, ' ');
+        string filename = loc.buffer->name;
+        buf_write(&w, "\033[1m%.*s:%u:%u: %.*s: \033[1m", filename.len, filename.data,
+                  loc.line, utf8_col_counter, message_kind.len, message_kind.data);
+        buf_writev(&w, msg, args);
+        buf_write(&w, "\033[0m\n%.*s\n", (int)(line_end - line_start), line_start);
+        if (utf8_col_counter != 1) {
+            buf_write(&w, "%*c", utf8_col_counter - 1, ' ');
+        }
+        buf_write(&w, "\033[32;1m^\033[0m\n");
     }
-    fprintf(stderr, "\033[32;1m^\033[0m\n");
+    fwrite(buffer, 1, w.cursor - buffer, er_output ? er_output : stderr);
 }
 
 void
 report_errorv(source_loc loc, char *fmt, va_list args) {
-    file *f              = fs_get_file(loc.filename, 0);
     string error_colored = WRAPZ("\033[31;1merror\033[0m");
-    report_message_internalv(f->contents, loc, error_colored, fmt, args);
-    ++get_error_reporter()->error_count;
+    report_message_internalv(loc, error_colored, fmt, args);
+    pthread_mutex_lock(&er->mutex);
+    ++er->error_count;
+    pthread_mutex_unlock(&er->mutex);
 }
 
 void
@@ -91,10 +108,11 @@ report_warningv(source_loc loc, char *fmt, va_list args) {
         return;
     }
 
-    file *f                = fs_get_file(loc.filename, 0);
     string warning_colored = WRAPZ("\033[35;1mwarning\033[0m");
-    report_message_internalv(f->contents, loc, warning_colored, fmt, args);
-    ++get_error_reporter()->warning_count;
+    report_message_internalv(loc, warning_colored, fmt, args);
+    pthread_mutex_lock(&er->mutex);
+    ++er->warning_count;
+    pthread_mutex_unlock(&er->mutex);
 }
 
 void
@@ -106,9 +124,8 @@ report_warning(source_loc loc, char *fmt, ...) {
 
 void
 report_notev(source_loc loc, char *fmt, va_list args) {
-    file *f             = fs_get_file(loc.filename, 0);
     string note_colored = WRAPZ("\033[90;1mnote\033[1m");
-    report_message_internalv(f->contents, loc, note_colored, fmt, args);
+    report_message_internalv(loc, note_colored, fmt, args);
 }
 
 void
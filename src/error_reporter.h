@@ -3,7 +3,13 @@
 
 #include "general.h"
 
+#include <pthread.h>
+#include <stdio.h>
+
 typedef struct error_reporter {
+    // Protects counters, which are shared by translation units processed in
+    // parallel
+    pthread_mutex_t mutex;
     uint32_t error_count;
     uint32_t warning_count;
 
@@ -12,9 +18,12 @@ typedef struct error_reporter {
 
 error_reporter *get_error_reporter(void);
 void er_print_final_stats(void);
+// Sets stream that messages of current thread are written to. NULL means
+// stderr. Used to buffer messages of translation unit processed in parallel,
+// so that they can be shown in order of input files.
+void er_set_output(FILE *output);
 
-void report_message_internalv(string file_contents, source_loc loc, string message_kind,
-                              char *msg, va_list args);
+void report_message_internalv(source_loc loc, string message_kind, char *msg, va_list args);
 
 void report_errorv(source_loc loc, char *fmt, va_list args);
 void report_error(source_loc loc, char *fmt, ...);
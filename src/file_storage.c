@@ -1,16 +1,28 @@
 #include "file_storage.h"
 
 #include <assert.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "darray.h"
 #include "filepath.h"
+#include "hashing.h"
+#include "intern.h"
 #include "llist.h"
+#include "source_manager.h"
 #include "str.h"
+#include "time_report.h"
 
-static file_storage fs_;
+static file_storage fs_ = {.mutex = PTHREAD_MUTEX_INITIALIZER};
 static file_storage *fs = &fs_;
 
 file_storage *
@@ -18,8 +30,24 @@ get_file_storage(void) {
     return fs;
 }
 
+static void
+clear_include_cache(void) {
+    for (uint32_t i = 0; i < ARRAY_SIZE(fs->include_cache); ++i) {
+        fs_include_cache_entry *entry = fs->include_cache[i];
+        while (entry) {
+            fs_include_cache_entry *next = entry->next;
+            free(entry->dir.data);
+            free(entry->name.data);
+            free(entry);
+            entry = next;
+        }
+        fs->include_cache[i] = NULL;
+    }
+}
+
 void
 fs_add_default_include_paths(void) {
+    clear_include_cache();
     // Linux folders
     da_push(fs->include_paths, (string)WRAPZ("/usr/local/include"));
     da_push(fs->include_paths, (string)WRAPZ("/usr/include/x86_64-linux-gnu"));
@@ -42,114 +70,210 @@ fs_add_default_include_paths(void) {
 
 void
 fs_add_include_paths(string *new_paths, uint32_t new_path_count) {
+    clear_include_cache();
     for (uint32_t i = 0; i < new_path_count; ++i) {
         da_push(fs->include_paths, new_paths[i]);
     }
 }
 
-char *
-canonicalize_newline(char *p) {
-    char *read  = p;
-    char *write = p;
-    while (*read) {
-        if (read[0] == '\r' && read[1] == '\n') {
-            read += 2;
-            *write++ = '\n';
-        } else if (*read == '\r') {
-            ++read;
-            *write++ = '\n';
-        } else {
-            *write++ = *read++;
+// Returns pointer to the first byte in [p, end) that translation phases 1 and
+// 2 have to look at: '\r', '?', '\\' or zero terminator. If 'match_newline' is
+// set, '\n' is matched too. Returns 'end' if there is no such byte.
+static char *
+find_special_char(char *p, char *end, bool match_newline) {
+#if defined(__AVX2__)
+    {
+        __m256i cr = _mm256_set1_epi8('\r');
+        __m256i qm = _mm256_set1_epi8('?');
+        __m256i bs = _mm256_set1_epi8('\\');
+        __m256i nl = _mm256_set1_epi8(match_newline ? '\n' : '\r');
+        __m256i zr = _mm256_setzero_si256();
+        while (end - p >= 32) {
+            __m256i v = _mm256_loadu_si256((__m256i *)p);
+            __m256i m = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, qm)),
+                _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, bs),
+                                                _mm256_cmpeq_epi8(v, nl)),
+                                _mm256_cmpeq_epi8(v, zr)));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+            if (mask) {
+                return p + __builtin_ctz(mask);
+            }
+            p += 32;
         }
     }
-    *write = 0;
-    return write;
+#endif
+#if defined(__SSE2__)
+    {
+        __m128i cr = _mm_set1_epi8('\r');
+        __m128i qm = _mm_set1_epi8('?');
+        __m128i bs = _mm_set1_epi8('\\');
+        __m128i nl = _mm_set1_epi8(match_newline ? '\n' : '\r');
+        __m128i zr = _mm_setzero_si128();
+        while (end - p >= 16) {
+            __m128i v = _mm_loadu_si128((__m128i *)p);
+            __m128i m =
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, qm)),
+                             _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, bs),
+                                                       _mm_cmpeq_epi8(v, nl)),
+                                          _mm_cmpeq_epi8(v, zr)));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+            if (mask) {
+                return p + __builtin_ctz(mask);
+            }
+            p += 16;
+        }
+    }
+#endif
+    for (; p < end; ++p) {
+        char c = *p;
+        if (c == '\r' || c == '?' || c == '\\' || c == 0 || (c == '\n' && match_newline)) {
+            break;
+        }
+    }
+    return p;
+}
+
+static char
+get_trigraph_replacement(char c) {
+    char result = 0;
+    switch (c) {
+    case '<':
+        result = '{';
+        break;
+    case '>':
+        result = '}';
+        break;
+    case '(':
+        result = '[';
+        break;
+    case ')':
+        result = ']';
+        break;
+    case '=':
+        result = '#';
+        break;
+    case '/':
+        result = '\\';
+        break;
+    case '\'':
+        result = '^';
+        break;
+    case '!':
+        result = '|';
+        break;
+    case '-':
+        result = '~';
+        break;
+    }
+    return result;
+}
+
+// Returns length of newline sequence ('\n', '\r\n' or '\r') at p, or 0 if
+// there is no newline.
+static uint32_t
+get_newline_len(char *p) {
+    uint32_t result = 0;
+    if (p[0] == '\n') {
+        result = 1;
+    } else if (p[0] == '\r') {
+        result = p[1] == '\n' ? 2 : 1;
+    }
+    return result;
 }
 
 char *
-replace_trigraphs(char *p) {
+translate_phases_1_2(char *p, char *end) {
     char *read  = p;
     char *write = p;
-    while (*read) {
-        if (read[0] == '?' && read[1] == '?') {
-            switch (read[2]) {
-            default: {
-                *write++ = *read++;
+    // Number of line splices since last newline. Each of them is replaced with
+    // newline after the logical line ends, so that line numbers are preserved.
+    uint32_t n = 0;
+    for (;;) {
+        char *special = find_special_char(read, end, n != 0);
+        if (special != read) {
+            uint32_t len = special - read;
+            if (write != read) {
+                memmove(write, read, len);
+            }
+            write += len;
+            read = special;
+        }
+        if (read == end || *read == 0) {
+            break;
+        }
+
+        // Backslash is either taken from source directly or produced by trigraph
+        uint32_t backslash_len = 0;
+        if (*read == '\\') {
+            backslash_len = 1;
+        } else if (*read == '?') {
+            if (read[1] == '?') {
+                char replacement = get_trigraph_replacement(read[2]);
+                if (replacement == '\\') {
+                    backslash_len = 3;
+                } else if (replacement) {
+                    *write++ = replacement;
+                    read += 3;
+                } else {
+                    // Both question marks are skipped so that the second one
+                    // does not start a trigraph.
+                    *write++ = *read++;
+                    *write++ = *read++;
+                }
+            } else {
                 *write++ = *read++;
-            } break;
-            case '<': {
-                read += 3;
-                *write++ = '{';
-            } break;
-            case '>': {
-                read += 3;
-                *write++ = '}';
-            } break;
-            case '(': {
-                read += 3;
-                *write++ = '[';
-            } break;
-            case ')': {
-                read += 3;
-                *write++ = ']';
-            } break;
-            case '=': {
-                read += 3;
-                *write++ = '#';
-            } break;
-            case '/': {
-                read += 3;
-                *write++ = '\\';
-            } break;
-            case '\'': {
-                read += 3;
-                *write++ = '^';
-            } break;
-            case '!': {
-                read += 3;
-                *write++ = '|';
-            } break;
-            case '-': {
-                read += 3;
-                *write++ = '~';
-            } break;
             }
         } else {
-            *write++ = *read++;
+            uint32_t newline_len = get_newline_len(read);
+            assert(newline_len);
+            read += newline_len;
+            *write++ = '\n';
+            while (n) {
+                *write++ = '\n';
+                --n;
+            }
         }
-    }
-    *write = 0;
-    return write;
-}
 
-char *
-remove_backslash_newline(char *p) {
-    char *write = p;
-    char *read  = p;
-    uint32_t n  = 0;
-    while (*read) {
-        if (read[0] == '\\' && read[1] == '\n') {
-            read += 2;
-            ++n;
-        } else if (*read == '\n') {
-            *write++ = *read++;
-            while (n--) {
-                *write++ = '\n';
+        if (backslash_len) {
+            uint32_t newline_len = get_newline_len(read + backslash_len);
+            if (newline_len) {
+                read += backslash_len + newline_len;
+                ++n;
+            } else {
+                *write++ = '\\';
+                read += backslash_len;
             }
-            n = 0;
-        } else {
-            *write++ = *read++;
         }
     }
 
-    while (n--) {
+    while (n) {
         *write++ = '\n';
+        --n;
     }
 
     *write = 0;
     return write;
 }
 
+// Returns true if file contents must be rewritten by translation phases 1 and
+// 2, which is when there are carriage returns, possible trigraphs or line
+// splices. Most of files are clean, and can be used as-is.
+static bool
+needs_translation(char *p, char *end) {
+    for (;;) {
+        p = find_special_char(p, end, false);
+        if (p == end) {
+            return false;
+        }
+        if (*p == '\r' || *p == 0 || (p[0] == '?' && p[1] == '?') ||
+            (p[0] == '\\' && (p[1] == '\n' || p[1] == '\r'))) {
+            return true;
+        }
+        ++p;
+    }
+}
+
 static string
 read_file_data(string filename) {
     FILE *f = fopen(filename.data, "r");
@@ -165,6 +289,28 @@ read_file_data(string filename) {
     return (string){data, size};
 }
 
+// Maps file into memory. Result is read-only and zero-terminated, which is
+// guaranteed by the tail of last page being filled with zeroes. If file size
+// is multiple of page size there is no space for terminator, and empty string
+// is returned. In that case file has to be read with read_file_data.
+static string
+map_file_data(string filename) {
+    string result = {0};
+    int fd        = open(filename.data, O_RDONLY);
+    if (fd != -1) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size != 0 &&
+            st.st_size % sysconf(_SC_PAGESIZE) != 0) {
+            void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                result = (string){data, st.st_size};
+            }
+        }
+        close(fd);
+    }
+    return result;
+}
+
 static bool
 file_exists(char *filename) {
     bool result = false;
@@ -177,12 +323,10 @@ file_exists(char *filename) {
 }
 
 static string
-get_filepath_in_same_dir(string name, string current_path) {
-    string result      = {0};
-    string current_dir = path_dirname(current_path);
+get_filepath_in_dir(string name, string dir) {
+    string result = {0};
     char buffer[4096];
-    snprintf(buffer, sizeof(buffer), "%.*s/%.*s", current_dir.len, current_dir.data, name.len,
-             name.data);
+    snprintf(buffer, sizeof(buffer), "%.*s/%.*s", dir.len, dir.data, name.len, name.data);
     if (file_exists(buffer)) {
         result = string_strdup(buffer);
     }
@@ -192,13 +336,8 @@ get_filepath_in_same_dir(string name, string current_path) {
 static string
 get_filepath_from_include_paths(string name) {
     string result = {0};
-    for (uint32_t i = 0; i < da_size(fs->include_paths); ++i) {
-        string dir = fs->include_paths[i];
-        char buffer[4096];
-        snprintf(buffer, sizeof(buffer), "%.*s/%.*s", dir.len, dir.data, name.len, name.data);
-        if (file_exists(buffer)) {
-            result = string_strdup(buffer);
-        }
+    for (uint32_t i = 0; i < da_size(fs->include_paths) && !result.data; ++i) {
+        result = get_filepath_in_dir(name, fs->include_paths[i]);
     }
     return result;
 }
@@ -206,60 +345,268 @@ get_filepath_from_include_paths(string name) {
 static string
 get_filepath_relative(string name) {
     string result = {0};
-    char buffer[4096];
-    get_current_dir(buffer, sizeof(buffer));
-    uint32_t dir_len = strlen(buffer);
-    snprintf(buffer + dir_len, sizeof(buffer) - dir_len, "/%.*s", name.len, name.data);
-    if (file_exists(buffer)) {
-        result = string_strdup(buffer);
+    if (string_startswith(name, (string)WRAPZ("/"))) {
+        result = string_dup(name);
+        if (!file_exists(result.data)) {
+            free(result.data);
+            result = (string){0};
+        }
+    } else {
+        char buffer[4096];
+        get_current_dir(buffer, sizeof(buffer));
+        result = get_filepath_in_dir(name, (string){buffer, strlen(buffer)});
     }
     return result;
 }
 
-file *
-fs_get_file(string name, file *current_file) {
-    file *f = NULL;
-    for (f = fs->files; f; f = f->next) {
-        if (string_eq(f->full_path, name)) {
-            break;
-        }
+static string
+resolve_filepath(string name, string dir) {
+    string result = {0};
+    if (dir.len) {
+        result = get_filepath_in_dir(name, dir);
+    }
+    if (!result.data) {
+        result = get_filepath_from_include_paths(name);
+    }
+    if (!result.data) {
+        result = get_filepath_relative(name);
     }
+    return result;
+}
+
+static file *
+get_file_by_path(string path, uint32_t hash) {
+    file *f = fs->path_hash[hash % FS_FILE_HASH_SIZE];
+    while (f && !(f->full_path_hash == hash && string_eq(f->full_path, path))) {
+        f = f->next_by_path;
+    }
+    return f;
+}
+
+// Must be called with lock held
+static fs_file_hint *
+get_file_hint(string path, uint32_t hash) {
+    fs_file_hint *hint = fs->hint_hash[hash % FS_FILE_HASH_SIZE];
+    while (hint && !(hint->full_path_hash == hash && string_eq(hint->full_path, path))) {
+        hint = hint->next;
+    }
+    return hint;
+}
 
-    if (!f) {
-        string actual_path = {0};
-        if (current_file) {
-            actual_path = get_filepath_in_same_dir(name, current_file->full_path);
+// Reads file and performs translation phases 1 and 2. File is not added to
+// storage yet, so this can be done without holding lock.
+static file *
+load_file(string name, string full_path) {
+    file *f           = calloc(1, sizeof(file));
+    f->name           = string_dup(name);
+    f->full_path      = full_path;
+    f->full_path_hash = hash_string(full_path);
+    string contents   = map_file_data(full_path);
+    if (contents.data) {
+        f->is_mapped = true;
+    } else {
+        contents = read_file_data(full_path);
+    }
+    TR_COUNT(TR_COUNTER_FILES_OPENED, 1);
+    TR_COUNT(TR_COUNTER_BYTES_READ, contents.len);
+
+    char *s    = contents.data;
+    char *send = STRING_END(contents);
+    // BOM
+    if (contents.len >= 3 && memcmp(s, "\xef\xbb\xbf", 3) == 0) {
+        s += 3;
+    }
+
+    if (needs_translation(s, send)) {
+        // Translation phases rewrite buffer in place, so mapped
+        // memory has to be copied first.
+        if (f->is_mapped) {
+            char *copy = malloc(contents.len + 1);
+            memcpy(copy, contents.data, contents.len + 1);
+            s    = copy + (s - contents.data);
+            send = copy + contents.len;
+            munmap(contents.data, contents.len);
+            contents.data = copy;
+            f->is_mapped  = false;
         }
-        if (!actual_path.data) {
-            actual_path = get_filepath_from_include_paths(name);
+        send = translate_phases_1_2(s, send);
+    }
+    f->contents_init = contents;
+    f->contents      = (string){s, send - s};
+    return f;
+}
+
+// Frees file that lost the race to be added to storage
+static void
+free_file(file *f) {
+    if (f->is_mapped) {
+        munmap(f->contents_init.data, f->contents_init.len);
+    } else {
+        free(f->contents_init.data);
+    }
+    free(f->name.data);
+    free(f->full_path.data);
+    free(f);
+}
+
+// Adds loaded file to storage. Must be called with lock held.
+static void
+add_file(file *f) {
+    fs_file_hint *hint = get_file_hint(f->full_path, f->full_path_hash);
+    if (hint) {
+        f->idx             = hint->idx;
+        f->include_guard   = hint->include_guard;
+        f->has_pragma_once = hint->has_pragma_once;
+        hint->f            = f;
+    } else {
+        f->idx = fs->file_count++;
+    }
+    f->loc_base = sm_add_buffer(f->name, f->contents);
+    LLIST_ADD(fs->files, f);
+    file **path_slot = fs->path_hash + f->full_path_hash % FS_FILE_HASH_SIZE;
+    f->next_by_path  = *path_slot;
+    *path_slot       = f;
+}
+
+// Must be called with lock held
+static fs_include_cache_entry *
+find_include_cache_entry(string dir, string name, uint32_t hash) {
+    fs_include_cache_entry *entry = fs->include_cache[hash % FS_INCLUDE_CACHE_HASH_SIZE];
+    while (entry &&
+           !(entry->hash == hash && string_eq(entry->dir, dir) && string_eq(entry->name, name))) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+// Finds file by path or loads it. File IO is done without holding lock, so
+// threads that include different files don't wait for each other. If two
+// threads load the same file, one of copies is thrown away.
+static file *
+get_file_by_path_or_load(string name, string full_path) {
+    uint32_t hash = hash_string(full_path);
+    pthread_mutex_lock(&fs->mutex);
+    file *f = get_file_by_path(full_path, hash);
+    pthread_mutex_unlock(&fs->mutex);
+
+    if (f) {
+        free(full_path.data);
+    } else {
+        file *loaded = load_file(name, full_path);
+        pthread_mutex_lock(&fs->mutex);
+        f = get_file_by_path(full_path, hash);
+        if (!f) {
+            add_file(loaded);
+            f = loaded;
         }
-        if (!actual_path.data) {
-            actual_path = get_filepath_relative(name);
+        pthread_mutex_unlock(&fs->mutex);
+        if (f != loaded) {
+            free_file(loaded);
         }
+    }
+    return f;
+}
 
+static file *
+get_file(string name, file *current_file) {
+    // Files that are not included from other file are searched without
+    // including directory, which is denoted by empty string. They are still
+    // resolved to full path, so name spelled the same way in some #include
+    // doesn't refer to them.
+    string dir = WRAPZ("");
+    if (current_file) {
+        dir = path_dirname(current_file->full_path);
+    }
+
+    uint32_t hash = hash_string_(name, hash_string(dir));
+    pthread_mutex_lock(&fs->mutex);
+    fs_include_cache_entry *entry = find_include_cache_entry(dir, name, hash);
+    pthread_mutex_unlock(&fs->mutex);
+
+    if (!entry) {
+        file *f            = NULL;
+        string actual_path = resolve_filepath(name, dir);
         if (actual_path.data) {
-            assert(file_exists(actual_path.data));
-
-            f                = calloc(1, sizeof(file));
-            f->name          = string_dup(name);
-            f->full_path     = actual_path;
-            string contents  = read_file_data(actual_path);
-            f->contents_init = contents;
-
-            char *s = contents.data;
-            // BOM
-            if (strcmp(s, "\xef\xbb\xbf") == 0) {
-                s += 3;
-            }
-            // Phase 1
-            canonicalize_newline(s);
-            replace_trigraphs(s);
-            // Phase 2
-            char *send  = remove_backslash_newline(s);
-            f->contents = (string){s, send - s};
-
-            LLIST_ADD(fs->files, f);
+            f = get_file_by_path_or_load(name, actual_path);
         }
+
+        pthread_mutex_lock(&fs->mutex);
+        entry = find_include_cache_entry(dir, name, hash);
+        if (!entry) {
+            fs_include_cache_entry **slot =
+                fs->include_cache + hash % FS_INCLUDE_CACHE_HASH_SIZE;
+            entry       = calloc(1, sizeof(fs_include_cache_entry));
+            entry->hash = hash;
+            entry->dir  = string_dup(dir);
+            entry->name = string_dup(name);
+            entry->f    = f;
+            entry->next = *slot;
+            *slot       = entry;
+        }
+        pthread_mutex_unlock(&fs->mutex);
     }
+    return entry->f;
+}
+
+file *
+fs_get_file(string name, file *current_file) {
+    TR_BEGIN(TR_PHASE_FILE_LOADING);
+    file *f = get_file(name, current_file);
+    TR_END(TR_PHASE_FILE_LOADING);
     return f;
 }
+
+uint32_t
+fs_add_file_hint(string full_path, interned_string *include_guard, bool has_pragma_once) {
+    uint32_t result = 0;
+    uint32_t hash   = hash_string(full_path);
+    pthread_mutex_lock(&fs->mutex);
+    file *f = get_file_by_path(full_path, hash);
+    if (f) {
+        if (include_guard) {
+            fs_set_include_guard(f, include_guard);
+        }
+        if (has_pragma_once) {
+            fs_set_pragma_once(f);
+        }
+        result = f->idx;
+    } else {
+        fs_file_hint *hint = get_file_hint(full_path, hash);
+        if (!hint) {
+            fs_file_hint **slot  = fs->hint_hash + hash % FS_FILE_HASH_SIZE;
+            hint                 = calloc(1, sizeof(fs_file_hint));
+            hint->full_path      = string_dup(full_path);
+            hint->full_path_hash = hash;
+            hint->idx            = fs->file_count++;
+            hint->next           = *slot;
+            *slot                = hint;
+        }
+        if (include_guard) {
+            hint->include_guard = include_guard;
+        }
+        hint->has_pragma_once |= has_pragma_once;
+        result = hint->idx;
+    }
+    pthread_mutex_unlock(&fs->mutex);
+    return result;
+}
+
+interned_string *
+fs_get_include_guard(file *f) {
+    return __atomic_load_n(&f->include_guard, __ATOMIC_ACQUIRE);
+}
+
+void
+fs_set_include_guard(file *f, interned_string *include_guard) {
+    __atomic_store_n(&f->include_guard, include_guard, __ATOMIC_RELEASE);
+}
+
+bool
+fs_has_pragma_once(file *f) {
+    return __atomic_load_n(&f->has_pragma_once, __ATOMIC_RELAXED);
+}
+
+void
+fs_set_pragma_once(file *f) {
+    __atomic_store_n(&f->has_pragma_once, true, __ATOMIC_RELAXED);
+}
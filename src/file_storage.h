@@ -3,44 +3,122 @@
 
 #include "general.h"
 
+#include <pthread.h>
+
+struct interned_string;
+struct pp_token_array;
+
+#define FS_FILE_HASH_SIZE 1024
+#define FS_INCLUDE_CACHE_HASH_SIZE 1024
+
 typedef struct file {
     struct file *next;
+    // Chain of file storage hash table
+    struct file *next_by_path;
     // typically, name inside #include
     string name;
     // full system path
     string full_path;
-    // Initial buffer for file contents.
+    uint32_t full_path_hash;
+    // Initial buffer for file contents. If file did not need any rewriting
+    // during translation phases 1 and 2, this is read-only memory mapping.
     string contents_init;
     // Sub buffer of contents_init with file contents.
     string contents;
+    bool is_mapped;
+    // Location of first byte of contents, see source_manager.h
+    source_loc loc_base;
+    // Tokens of file, lexed on first include. Protected by lock of token
+    // cache, see token_cache.h.
+    struct pp_token_array *tokens;
 
+    // Macro that guards file contents against multiple inclusion, if file has
+    // one. File can be skipped if this macro is defined.
+    // These are set by translation units processed in parallel, so they must
+    // be accessed with functions below.
+    struct interned_string *include_guard;
     bool has_pragma_once;
+    // Index of file, unique in run. Files get indices in order they are added,
+    // except files with hint, which have index reserved by hint.
+    uint32_t idx;
 } file;
 
+// State of file known before file is loaded, which comes from precompiled
+// header. It is applied when file with the same full path is first loaded, so
+// files are not read only to have their state recorded.
+typedef struct fs_file_hint {
+    struct fs_file_hint *next;
+    string full_path;
+    uint32_t full_path_hash;
+    struct interned_string *include_guard;
+    bool has_pragma_once;
+    uint32_t idx;
+    // File that hint was applied to, NULL if file has not been loaded
+    file *f;
+} fs_file_hint;
+
+// Result of resolving #include of 'name' from file located in 'dir'. If file
+// could not be found, f is NULL.
+typedef struct fs_include_cache_entry {
+    struct fs_include_cache_entry *next;
+    uint32_t hash;
+
+    string dir;
+    string name;
+    file *f;
+} fs_include_cache_entry;
+
 typedef struct file_storage {
+    // Protects files and include cache. Include paths are not protected, so
+    // they must be set before translation units are processed in parallel.
+    pthread_mutex_t mutex;
     // Linked list of files.
-    // TODO: Should probably be hash table?
     file *files;
+    // Hash table of files, keyed by full path. Files are never looked up by
+    // name alone, as the same name can refer to different files depending on
+    // including directory; that is what include cache is for.
+    file *path_hash[FS_FILE_HASH_SIZE];
+    // Cache of include resolution results. It depends on include paths, so it
+    // is cleared when they change.
+    fs_include_cache_entry *include_cache[FS_INCLUDE_CACHE_HASH_SIZE];
+    // Hash table of file hints, keyed by full path
+    fs_file_hint *hint_hash[FS_FILE_HASH_SIZE];
+    // Number of file indices given out
+    uint32_t file_count;
 
     string *include_paths;  // da
 } file_storage;
 
-// file storage is made global. This, most obviously, disables asynchronous
-// lock-free file reads. But it has been decided to be unimportant.
+// file storage is made global and shared by translation units, so each file is
+// loaded once per run. Lookups are done under lock, but files are read without
+// holding it.
 file_storage *get_file_storage(void);
 void fs_add_default_include_paths(void);
 void fs_add_include_paths(string *paths, uint32_t path_count);
 
+// Returns file 'name' that is included from 'current_file'. If current_file is
+// NULL, name can also be the name of already loaded file (this is used by
+// diagnostics, where source location only contains file name).
 file *fs_get_file(string name, file *current_file);
 
-// These are functions used internally in file_storage but we may want to use
-// them elsewhere
-//
-// Does in-place replacement of \n\r and \r to \n
-char *canonicalize_newline(char *p);
-// Replaces trigraphs with corresponding tokens
-char *replace_trigraphs(char *p);
-// Removes \ followed by \n, while keeping original logical lines
-char *remove_backslash_newline(char *p);
+// Records include guard and #pragma once of file with given full path. If file
+// is already loaded they are set right away, otherwise they are set when it is
+// loaded. Returns index of file, which is reserved if file is not loaded yet.
+uint32_t fs_add_file_hint(string full_path, struct interned_string *include_guard,
+                          bool has_pragma_once);
+
+// Atomic accessors of include guard and #pragma once of file. Include guard is
+// published with release, so its interned string can be read after it is seen.
+struct interned_string *fs_get_include_guard(file *f);
+void fs_set_include_guard(file *f, struct interned_string *include_guard);
+bool fs_has_pragma_once(file *f);
+void fs_set_pragma_once(file *f);
+
+// Performs translation phases 1 and 2 in place in a single pass over
+// zero-terminated buffer [p, end). Returns new end of buffer. \r\n and \r are
+// replaced with \n, trigraphs are replaced with characters they stand for,
+// and backslash-newlines are removed, with removed newlines put after the end
+// of logical line, so that line numbers are kept.
+char *translate_phases_1_2(char *p, char *end);
 
 #endif
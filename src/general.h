@@ -29,11 +29,10 @@ typedef struct string {
     uint32_t len;
 } string;
 
-typedef struct source_loc {
-    string filename;
-    uint32_t line;
-    uint32_t col;
-} source_loc;
+// Location in source. Number is given out by source manager, which can also
+// be used to get file, line and column of location (see source_manager.h).
+// 0 means that there is no location.
+typedef uint32_t source_loc;
 
 #if 1
 // Not implemented macro, useful when need to put assert(false) but
@@ -58,6 +57,12 @@ typedef struct source_loc {
 #define HOLOC_DEBUG 1
 #endif
 
+// Storage class of variables that have separate instance in each thread.
+// Translation units can be processed in parallel (see thread_pool.h), and
+// state that is specific to translation unit, but is accessed deep inside of
+// compiler, like output of diagnostics, is made thread-local.
+#define THREAD_LOCAL __thread
+
 #if HOLOC_DEBUG
 #define DEBUG_BREAKPOINT assert(false && "Debug breakpoint")
 #else
@@ -0,0 +1,151 @@
+#include "intern.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bump_allocator.h"
+#include "hashing.h"
+#include "str.h"
+
+// Table is split in shards by hash, each with its own lock, so that threads
+// lexing different translation units rarely wait for each other.
+#define INTERN_SHARD_COUNT 64
+// Initial number of hash table buckets of shard. Shard is grown when number of
+// its strings exceeds number of buckets, so chains are kept short.
+#define INTERN_SHARD_INITIAL_SIZE 256
+// Strings are indexed by id in chunks, which are never moved, so that
+// intern_get doesn't need locking.
+#define INTERN_ID_CHUNK_SIZE 4096
+#define INTERN_MAX_ID_CHUNKS 65536
+
+typedef struct intern_shard {
+    pthread_mutex_t mutex;
+    // Memory for interned strings and their spellings
+    bump_allocator a;
+    interned_string **buckets;
+    uint32_t bucket_count;
+    uint32_t string_count;
+} intern_shard;
+
+typedef struct intern_table {
+    intern_shard shards[INTERN_SHARD_COUNT];
+    // Protects id assignment
+    pthread_mutex_t id_mutex;
+    uint32_t id_count;
+    interned_string **id_chunks[INTERN_MAX_ID_CHUNKS];
+} intern_table;
+
+static intern_table table;
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void
+grow_shard(intern_shard *shard) {
+    uint32_t new_count            = shard->bucket_count * 2;
+    interned_string **new_buckets = calloc(new_count, sizeof(interned_string *));
+    assert(new_buckets);
+    for (uint32_t i = 0; i < shard->bucket_count; ++i) {
+        interned_string *str = shard->buckets[i];
+        while (str) {
+            interned_string *next  = str->next;
+            interned_string **slot = new_buckets + (str->hash & (new_count - 1));
+            str->next              = *slot;
+            *slot                  = str;
+            str                    = next;
+        }
+    }
+    free(shard->buckets);
+    shard->buckets      = new_buckets;
+    shard->bucket_count = new_count;
+}
+
+static uint32_t
+assign_id(interned_string *str) {
+    pthread_mutex_lock(&table.id_mutex);
+    uint32_t id        = table.id_count++;
+    uint32_t chunk_idx = id / INTERN_ID_CHUNK_SIZE;
+    assert(chunk_idx < INTERN_MAX_ID_CHUNKS);
+    interned_string **chunk = table.id_chunks[chunk_idx];
+    if (!chunk) {
+        chunk = calloc(INTERN_ID_CHUNK_SIZE, sizeof(interned_string *));
+        assert(chunk);
+        table.id_chunks[chunk_idx] = chunk;
+    }
+    chunk[id % INTERN_ID_CHUNK_SIZE] = str;
+    pthread_mutex_unlock(&table.id_mutex);
+    return id;
+}
+
+static interned_string *
+intern_string_internal(string str) {
+    uint32_t hash = hash_string(str);
+    // Low bits of hash select bucket, so shard is selected with high bits
+    intern_shard *shard = table.shards + (hash >> 26) % INTERN_SHARD_COUNT;
+    pthread_mutex_lock(&shard->mutex);
+    interned_string **slot  = shard->buckets + (hash & (shard->bucket_count - 1));
+    interned_string *result = NULL;
+    for (interned_string *test = *slot; test; test = test->next) {
+        if (test->hash == hash && test->str.len == str.len &&
+            memcmp(test->str.data, str.data, str.len) == 0) {
+            result = test;
+            break;
+        }
+    }
+
+    if (!result) {
+        result       = ba_alloc_struct(&shard->a, interned_string);
+        result->str  = ba_string_dup(&shard->a, str);
+        result->hash = hash;
+        result->id   = assign_id(result);
+        result->next = *slot;
+        *slot        = result;
+        if (++shard->string_count > shard->bucket_count) {
+            grow_shard(shard);
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    return result;
+}
+
+static void
+init_table(void) {
+    pthread_mutex_init(&table.id_mutex, NULL);
+    for (uint32_t i = 0; i < INTERN_SHARD_COUNT; ++i) {
+        intern_shard *shard = table.shards + i;
+        pthread_mutex_init(&shard->mutex, NULL);
+        shard->bucket_count = INTERN_SHARD_INITIAL_SIZE;
+        shard->buckets      = calloc(shard->bucket_count, sizeof(interned_string *));
+        assert(shard->buckets);
+    }
+
+    static struct {
+        string str;
+        pp_ident_kind kind;
+    } pp_idents[] = {
+        {WRAPZ("define"), PP_IDENT_DEFINE},   {WRAPZ("undef"), PP_IDENT_UNDEF},
+        {WRAPZ("if"), PP_IDENT_IF},           {WRAPZ("ifdef"), PP_IDENT_IFDEF},
+        {WRAPZ("ifndef"), PP_IDENT_IFNDEF},   {WRAPZ("elif"), PP_IDENT_ELIF},
+        {WRAPZ("else"), PP_IDENT_ELSE},       {WRAPZ("endif"), PP_IDENT_ENDIF},
+        {WRAPZ("line"), PP_IDENT_LINE},       {WRAPZ("pragma"), PP_IDENT_PRAGMA},
+        {WRAPZ("error"), PP_IDENT_ERROR},     {WRAPZ("warning"), PP_IDENT_WARNING},
+        {WRAPZ("include"), PP_IDENT_INCLUDE}, {WRAPZ("defined"), PP_IDENT_DEFINED},
+        {WRAPZ("once"), PP_IDENT_ONCE},       {WRAPZ("__VA_ARGS__"), PP_IDENT_VA_ARGS},
+    };
+    for (uint32_t i = 0; i < ARRAY_SIZE(pp_idents); ++i) {
+        intern_string_internal(pp_idents[i].str)->pp_kind = pp_idents[i].kind;
+    }
+}
+
+interned_string *
+intern_string(string str) {
+    pthread_once(&table_once, init_table);
+    return intern_string_internal(str);
+}
+
+interned_string *
+intern_get(uint32_t id) {
+    // Count is not checked, as it is changed by other threads without lock
+    assert(table.id_chunks[id / INTERN_ID_CHUNK_SIZE]);
+    return table.id_chunks[id / INTERN_ID_CHUNK_SIZE][id % INTERN_ID_CHUNK_SIZE];
+}
@@ -0,0 +1,63 @@
+// Defines global table of interned identifiers. Every identifier spelling is
+// stored exactly once, and all tokens with the same spelling point to the same
+// interned_string. This way identifiers can be compared by pointer, and their
+// hash is computed only once when identifier is first met by lexer.
+//
+// Identifiers that have special meaning to the preprocessor are registered when
+// table is created, and are marked with pp_ident_kind. This allows directive
+// processing to switch on kind instead of comparing strings.
+//
+// Interned strings live until the end of the program and are never freed,
+// so they can be freely shared between translation units. Table can be used
+// from multiple threads.
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "general.h"
+
+// Identifiers known to preprocessor
+typedef enum {
+    PP_IDENT_NONE    = 0x0,
+    PP_IDENT_DEFINE  = 0x1,
+    PP_IDENT_UNDEF   = 0x2,
+    PP_IDENT_IF      = 0x3,
+    PP_IDENT_IFDEF   = 0x4,
+    PP_IDENT_IFNDEF  = 0x5,
+    PP_IDENT_ELIF    = 0x6,
+    PP_IDENT_ELSE    = 0x7,
+    PP_IDENT_ENDIF   = 0x8,
+    PP_IDENT_LINE    = 0x9,
+    PP_IDENT_PRAGMA  = 0xA,
+    PP_IDENT_ERROR   = 0xB,
+    PP_IDENT_WARNING = 0xC,
+    PP_IDENT_INCLUDE = 0xD,
+    PP_IDENT_DEFINED = 0xE,
+    PP_IDENT_ONCE    = 0xF,
+    PP_IDENT_VA_ARGS = 0x10,
+} pp_ident_kind;
+
+typedef struct interned_string {
+    // Used in hash table
+    struct interned_string *next;
+    // Zero-terminated copy of spelling
+    string str;
+    uint32_t hash;
+    // Index of string in table. Can be used to refer to string with 32 bits,
+    // see intern_get.
+    uint32_t id;
+    pp_ident_kind pp_kind;
+    // Value of c_keyword_kind plus one, or zero if it is not yet known. It is
+    // computed when identifier is first converted to C token, so keyword
+    // lookup is done once per spelling. Threads can race to compute it, so it
+    // is loaded and stored atomically, and they all store the same value.
+    uint32_t c_kw_cache;
+} interned_string;
+
+// Returns unique interned string with given spelling, creating it if it
+// doesn't exist.
+interned_string *intern_string(string str);
+#define intern_stringz(_z) intern_string((string){(_z), sizeof(_z) - 1})
+// Returns interned string with given id
+interned_string *intern_get(uint32_t id);
+
+#endif
@@ -1,3 +1,6 @@
+// open_memstream is POSIX
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -11,9 +14,13 @@
 #include "file_storage.h"
 #include "parser.h"
 #include "pp_lexer.h"
+#include "pp_snapshot.h"
 #include "preprocessor.h"
 #include "str.h"
+#include "thread_pool.h"
+#include "time_report.h"
 #include "token_iter.h"
+#include "trace.h"
 
 typedef enum {
     // print preprocessing tokens verbose, its on its own line
@@ -36,6 +43,17 @@ typedef struct {
     string *filenames;      // da
     string *include_paths;  // da
     mode mode;
+    // Print time spent in compiler phases and counters
+    bool time_report;
+    // If set, trace in Chrome trace-event format is written to this file
+    char *trace_filename;
+    // Number of translation units processed in parallel
+    uint32_t job_count;
+    // If set, macros defined by input file are written to this file, see
+    // pp_snapshot.h
+    char *emit_pch_filename;
+    // If set, macros from this file are defined in every translation unit
+    char *include_pch_filename;
 } program_settings;
 
 static program_settings settings;
@@ -59,6 +77,24 @@ parse_clargs(uint32_t argc, char **argv) {
             settings.mode = M_TPF;
         } else if (strcmp(option, "--ast") == 0) {
             settings.mode = M_AST;
+        } else if (strcmp(option, "--time-report") == 0) {
+            settings.time_report = true;
+        } else if (strncmp(option, "--trace=", 8) == 0) {
+            settings.trace_filename = option + 8;
+        } else if (strncmp(option, "--emit-pch=", 11) == 0) {
+            settings.emit_pch_filename = option + 11;
+        } else if (strncmp(option, "--include-pch=", 14) == 0) {
+            settings.include_pch_filename = option + 14;
+        } else if (strncmp(option, "-j", 2) == 0) {
+            char *count = option + 2;
+            if (!*count && arg_idx + 1 < argc) {
+                count = argv[++arg_idx];
+            }
+            settings.job_count = atoi(count);
+            if (!settings.job_count) {
+                fprintf(stderr, "error: invalid number of jobs '%s'\n", count);
+                exit(1);
+            }
         } else if (strncmp(option, "-I", 2) == 0) {
             char *path        = option + 2;
             uint32_t path_len = strlen(path);
@@ -73,72 +109,67 @@ parse_clargs(uint32_t argc, char **argv) {
 }
 
 static void
-mptv(string filename) {
-    fs_add_include_paths(settings.include_paths, da_size(settings.include_paths));
-
+mptv(string filename, FILE *out) {
     file *f = fs_get_file(filename, 0);
 
     char token_buf[4096];
     pp_lexer *lex = calloc(1, sizeof(pp_lexer));
     pp_lexer_init(lex, f->contents.data, STRING_END(f->contents));
+    lex->loc_base = f->loc_base;
     pp_token tok = {0};
     uint32_t _;
     while (pp_lexer_parse(lex, &tok, token_buf, sizeof(token_buf), &_)) {
         char buf[4096];
         fmt_pp_tok_verbose(buf, sizeof(buf), &tok);
-        printf("%s\n", buf);
+        fprintf(out, "%s\n", buf);
         memset(&tok, 0, sizeof(tok));
     }
 }
 
 static void
-mptf(string filename) {
-    fs_add_include_paths(settings.include_paths, da_size(settings.include_paths));
-
+mptf(string filename, FILE *out) {
     file *f = fs_get_file(filename, 0);
 
     char token_buf[4096];
     pp_lexer *lex = calloc(1, sizeof(pp_lexer));
     pp_lexer_init(lex, f->contents.data, STRING_END(f->contents));
+    lex->loc_base = f->loc_base;
     pp_token tok = {0};
     uint32_t _;
     while (pp_lexer_parse(lex, &tok, token_buf, sizeof(token_buf), &_)) {
         char buf[4096];
         fmt_pp_tok(buf, sizeof(buf), &tok);
         if (tok.at_line_start) {
-            printf("\n");
+            fprintf(out, "\n");
         } else if (tok.has_whitespace) {
-            printf(" ");
+            fprintf(out, " ");
         }
-        printf("%s", buf);
+        fprintf(out, "%s", buf);
         memset(&tok, 0, sizeof(tok));
     }
-    printf("\n");
+    fprintf(out, "\n");
 }
 
 static void
-mpt(string filename) {
-    fs_add_include_paths(settings.include_paths, da_size(settings.include_paths));
-
+mpt(string filename, FILE *out) {
     file *f = fs_get_file(filename, 0);
 
     char token_buf[4096];
     pp_lexer *lex = calloc(1, sizeof(pp_lexer));
     pp_lexer_init(lex, f->contents.data, STRING_END(f->contents));
+    lex->loc_base = f->loc_base;
     pp_token tok = {0};
     uint32_t _;
     while (pp_lexer_parse(lex, &tok, token_buf, sizeof(token_buf), &_)) {
         char buf[4096];
         fmt_pp_tok(buf, sizeof(buf), &tok);
-        printf("%s\n", buf);
+        fprintf(out, "%s\n", buf);
         memset(&tok, 0, sizeof(tok));
     }
 }
 
 static void
-mtp(string filename) {
-    fs_add_include_paths(settings.include_paths, da_size(settings.include_paths));
-
+mtp(string filename, FILE *out) {
     token_iter ti = {0};
     ti_init(&ti, filename);
 
@@ -146,15 +177,14 @@ mtp(string filename) {
     while ((tok = ti_peek(&ti))->kind != TOK_EOF) {
         char fmt_buf[4096];
         fmt_token(fmt_buf, sizeof(fmt_buf), tok);
-        printf("%s\n", fmt_buf);
+        fprintf(out, "%s\n", fmt_buf);
         ti_eat(&ti);
     }
+    ti_free(&ti);
 }
 
 static void
-mtpv(string filename) {
-    fs_add_include_paths(settings.include_paths, da_size(settings.include_paths));
-
+mtpv(string filename, FILE *out) {
     token_iter ti = {0};
     ti_init(&ti, filename);
 
@@ -163,14 +193,13 @@ mtpv(string filename) {
         char fmt_buf[4096];
         fmt_token_verbose(fmt_buf, sizeof(fmt_buf), tok);
         ti_eat(&ti);
-        printf("%s\n", fmt_buf);
+        fprintf(out, "%s\n", fmt_buf);
     }
+    ti_free(&ti);
 }
 
 static void
-mtpf(string filename) {
-    fs_add_include_paths(settings.include_paths, da_size(settings.include_paths));
-
+mtpf(string filename, FILE *out) {
     token_iter ti = {0};
     ti_init(&ti, filename);
 
@@ -179,54 +208,125 @@ mtpf(string filename) {
         char fmt_buf[4096];
         fmt_token(fmt_buf, sizeof(fmt_buf), tok);
         if (tok->at_line_start) {
-            printf("\n");
+            fprintf(out, "\n");
         } else if (tok->has_whitespace) {
-            printf(" ");
+            fprintf(out, " ");
         }
-        printf("%s", fmt_buf);
+        fprintf(out, "%s", fmt_buf);
         ti_eat(&ti);
     }
-    printf("\n");
+    fprintf(out, "\n");
+    ti_free(&ti);
 }
 
 static void
-mast(string filename) {
+mast(string filename, FILE *out) {
     token_iter *it = calloc(1, sizeof(token_iter));
     ti_init(it, filename);
 
     parser *p = calloc(1, sizeof(parser));
     p->it     = it;
-    parse(p);
+    p->a      = it->pp->a;
+    parse(p, out);
+    ti_free(it);
 }
 
 static void
-process_file(string filename) {
+process_file(string filename, FILE *out) {
     switch (settings.mode) {
         INVALID_DEFAULT_CASE;
     case M_PTV:
-        mptv(filename);
+        mptv(filename, out);
         break;
     case M_PTF:
-        mptf(filename);
+        mptf(filename, out);
         break;
     case M_PT:
-        mpt(filename);
+        mpt(filename, out);
         break;
     case M_TPV:
-        mtpv(filename);
+        mtpv(filename, out);
         break;
     case M_TPF:
-        mtpf(filename);
+        mtpf(filename, out);
         break;
     case M_TP:
-        mtp(filename);
+        mtp(filename, out);
         break;
     case M_AST:
-        mast(filename);
+        mast(filename, out);
         break;
     }
 }
 
+// Preprocesses file and writes macros defined in it to snapshot file
+static bool
+emit_pch(string filename, char *pch_filename) {
+    token_iter ti = {0};
+    ti_init(&ti, filename);
+    while (ti_peek(&ti)->kind != TOK_EOF) {
+        ti_eat(&ti);
+    }
+    bool result = pps_write(ti.pp, pch_filename);
+    ti_free(&ti);
+    return result;
+}
+
+// Output of translation unit processed in parallel. It is buffered, so that
+// outputs can be written in order of input files.
+typedef struct {
+    char *out_data;
+    size_t out_size;
+    char *err_data;
+    size_t err_size;
+} job_output;
+
+static void
+process_file_job(void *data, uint32_t job_idx, uint32_t worker_idx) {
+    job_output *output = (job_output *)data + job_idx;
+    FILE *out          = open_memstream(&output->out_data, &output->out_size);
+    FILE *err          = open_memstream(&output->err_data, &output->err_size);
+    assert(out && err);
+    time_report report;
+    tr_begin_thread(&report);
+    tc_set_thread(worker_idx);
+    er_set_output(err);
+
+    process_file(settings.filenames[job_idx], out);
+
+    er_set_output(NULL);
+    tc_set_thread(0);
+    tr_end_thread();
+    fclose(out);
+    fclose(err);
+}
+
+static void
+process_files_parallel(void) {
+    uint32_t file_count   = da_size(settings.filenames);
+    uint32_t worker_count = settings.job_count;
+    if (worker_count > file_count) {
+        worker_count = file_count;
+    }
+
+    job_output *outputs = calloc(file_count, sizeof(job_output));
+    tc_name_threads(worker_count);
+    thread_pool pool;
+    tp_start(&pool, worker_count, file_count, process_file_job, outputs);
+    // Outputs are written as soon as all previous files are done
+    for (uint32_t job_idx = 0; job_idx < file_count; ++job_idx) {
+        tp_wait_job(&pool, job_idx);
+        job_output *output = outputs + job_idx;
+        fwrite(output->out_data, 1, output->out_size, stdout);
+        fflush(stdout);
+        fwrite(output->err_data, 1, output->err_size, stderr);
+        free(output->out_data);
+        free(output->err_data);
+    }
+    tp_finish(&pool);
+    free(outputs);
+}
+
 int
 main(int argc, char **argv) {
     fs_add_default_include_paths();
@@ -238,11 +338,48 @@ main(int argc, char **argv) {
         return 1;
     }
 
-    for (uint32_t filename_idx = 0; filename_idx < da_size(settings.filenames);
-         filename_idx++) {
-        string filename = settings.filenames[filename_idx];
-        process_file(filename);
+    if (settings.time_report) {
+        tr_enable();
+    }
+    if (settings.trace_filename && !tc_open(settings.trace_filename)) {
+        fprintf(stderr, "error: failed to open trace file '%s'\n", settings.trace_filename);
+        return 1;
+    }
+
+    // Include paths are shared by all translation units, and must be set
+    // before any of them is processed
+    fs_add_include_paths(settings.include_paths, da_size(settings.include_paths));
+    if (settings.include_pch_filename) {
+        pp_snapshot *snapshot = pps_load(settings.include_pch_filename);
+        if (!snapshot) {
+            fprintf(stderr, "error: failed to load precompiled header '%s'\n",
+                    settings.include_pch_filename);
+            return 1;
+        }
+        pp_set_snapshot(snapshot);
+    }
+
+    if (settings.emit_pch_filename) {
+        if (da_size(settings.filenames) != 1) {
+            fprintf(stderr, "error: --emit-pch requires exactly one input file\n");
+            return 1;
+        }
+        if (!emit_pch(settings.filenames[0], settings.emit_pch_filename)) {
+            fprintf(stderr, "error: failed to write precompiled header '%s'\n",
+                    settings.emit_pch_filename);
+            return 1;
+        }
+    } else if (settings.job_count > 1 && da_size(settings.filenames) > 1) {
+        process_files_parallel();
+    } else {
+        for (uint32_t filename_idx = 0; filename_idx < da_size(settings.filenames);
+             filename_idx++) {
+            string filename = settings.filenames[filename_idx];
+            process_file(filename, stdout);
+        }
     }
     er_print_final_stats();
+    tr_print();
+    tc_close();
     return 0;
 }
@@ -6,20 +6,38 @@
 #include <stdlib.h>
 
 #include "ast.h"
+#include "bump_allocator.h"
 #include "c_lang.h"
 #include "c_types.h"
 #include "error_reporter.h"
-#include "hashing.h"
+#include "intern.h"
 #include "llist.h"
+#include "str.h"
+#include "time_report.h"
 #include "token_iter.h"
+#include "trace.h"
+
+// Returns location of declaration with given name in scope. If there is no
+// such declaration, location is zero and new one can be written to it.
+// Names are interned, so they are compared by pointer.
+static parser_decl **
+get_declp(parser_scope *scope, interned_string *name) {
+    parser_decl **declp = scope->decl_hash + (name->hash & (ARRAY_SIZE(scope->decl_hash) - 1));
+    while (*declp && (*declp)->name != name) {
+        declp = &(*declp)->next;
+    }
+    return declp;
+}
 
-#define GET_DECLP(_scope, _hash)                                                             \
-    hash_table_sc_get_u32((_scope)->decl_hash, ARRAY_SIZE((_scope)->decl_hash), parser_decl, \
-                          next, name_hash, (_hash))
-
-#define GET_TAGP(_scope, _hash)                                               \
-    hash_table_sc_get_u32((_scope)->tag_hash, ARRAY_SIZE((_scope)->tag_hash), \
-                          parser_tag_decl, next, name_hash, (_hash))
+static parser_tag_decl **
+get_tagp(parser_scope *scope, interned_string *name) {
+    parser_tag_decl **declp =
+        scope->tag_hash + (name->hash & (ARRAY_SIZE(scope->tag_hash) - 1));
+    while (*declp && (*declp)->name != name) {
+        declp = &(*declp)->next;
+    }
+    return declp;
+}
 
 typedef enum {
     STORAGE_TYPEDEF_BIT      = 0x1,   // typedef
@@ -32,12 +50,11 @@ typedef enum {
 c_type *parse_declspec(parser *p, uint32_t *storage_class_flags);
 
 static parser_decl *
-get_new_decl_scoped(parser *p, string name) {
-    uint32_t name_hash = hash_string(name);
+get_new_decl_scoped(parser *p, interned_string *name) {
     assert(p->scope);
-    parser_decl **declp = GET_DECLP(p->scope, name_hash);
+    parser_decl **declp = get_declp(p->scope, name);
     if (!*declp) {
-        parser_decl *decl = calloc(1, sizeof(parser_decl));
+        parser_decl *decl = ba_alloc_struct(p->a, parser_decl);
         *declp            = decl;
     } else {
         NOT_IMPL;
@@ -45,19 +62,17 @@ get_new_decl_scoped(parser *p, string name) {
 
     parser_decl *decl = *declp;
     assert(decl);
-    decl->name      = name;
-    decl->name_hash = name_hash;
+    decl->name = name;
     return decl;
 }
 
 static void
-push_tag_scoped(parser *p, string tag, c_type *type) {
-    uint32_t tag_hash = hash_string(tag);
+push_tag_scoped(parser *p, interned_string *tag, c_type *type) {
     assert(p->scope);
 
-    parser_tag_decl **declp = GET_TAGP(p->scope, tag_hash);
+    parser_tag_decl **declp = get_tagp(p->scope, tag);
     if (!*declp) {
-        parser_tag_decl *decl = calloc(1, sizeof(parser_tag_decl));
+        parser_tag_decl *decl = ba_alloc_struct(p->a, parser_tag_decl);
         *declp                = decl;
     } else {
         NOT_IMPL;
@@ -65,17 +80,15 @@ push_tag_scoped(parser *p, string tag, c_type *type) {
 
     parser_tag_decl *decl = *declp;
     assert(decl);
-    decl->name      = tag;
-    decl->name_hash = tag_hash;
-    decl->type      = type;
+    decl->name = tag;
+    decl->type = type;
 }
 
 static c_type *
-find_typedef(parser *p, string name) {
-    c_type *type       = NULL;
-    uint32_t name_hash = hash_string(name);
+find_typedef(parser *p, interned_string *name) {
+    c_type *type = NULL;
     for (parser_scope *scope = p->scope; scope; scope = scope->next) {
-        parser_tag_decl *decl = *GET_TAGP(scope, name_hash);
+        parser_tag_decl *decl = *get_tagp(scope, name);
         if (decl) {
             type = decl->type;
             break;
@@ -101,9 +114,9 @@ parse_enum_decl(parser *p) {
     }
     tok = ti_eat_peek(p->it);
 
-    string tag = {0};
+    interned_string *tag = NULL;
     if (tok->kind == TOK_ID) {
-        tag = tok->str;
+        tag = tok->ident;
         tok = ti_eat_peek(p->it);
     }
 
@@ -119,7 +132,7 @@ parse_enum_decl(parser *p) {
                 continue;
             }
 
-            string value_name = tok->str;
+            interned_string *value_name = tok->ident;
 
             tok            = ti_eat_peek(p->it);
             uint64_t value = auto_value;
@@ -136,7 +149,7 @@ parse_enum_decl(parser *p) {
             // (like missing branches in switch statements)
         }
 
-        if (tag.data) {
+        if (tag) {
             push_tag_scoped(p, tag, type);
         }
     } else {
@@ -157,9 +170,9 @@ parse_struct_decl(parser *p) {
     }
     tok = ti_eat_peek(p->it);
 
-    string tag = {0};
+    interned_string *tag = NULL;
     if (tok->kind == TOK_ID) {
-        tag = tok->str;
+        tag = tok->ident;
         tok = ti_eat_peek(p->it);
     }
 
@@ -178,7 +191,7 @@ parse_struct_decl(parser *p) {
             // Anonymous struct member
             if ((decl_type->kind == C_TYPE_STRUCT || decl_type->kind == C_TYPE_UNION) &&
                 IS_PUNCT(tok, ';')) {
-                c_struct_member *member = calloc(1, sizeof(c_struct_member));
+                c_struct_member *member = ba_alloc_struct(p->a, c_struct_member);
                 member->type            = decl_type;
                 member->idx             = idx++;
                 LLISTC_ADD_LAST(&members, member);
@@ -206,7 +219,7 @@ parse_struct_decl(parser *p) {
 
                 tok = ti_eat_peek(p->it);
 
-                c_struct_member *member = calloc(1, sizeof(c_struct_member));
+                c_struct_member *member = ba_alloc_struct(p->a, c_struct_member);
                 member->type            = decl_type;
                 member->name            = name;
                 member->idx             = idx++;
@@ -214,9 +227,9 @@ parse_struct_decl(parser *p) {
             }
         }
 
-        type = make_c_type_struct(tag, members.first);
+        type = make_c_type_struct(p->a, tag ? tag->str : (string){0}, members.first);
 
-        if (tag.data) {
+        if (tag) {
             push_tag_scoped(p, tag, type);
         }
     } else {
@@ -267,7 +280,7 @@ token_is_typename(parser *p, token *tok) {
     }
 
     if (!result && tok->kind == TOK_ID) {
-        result = find_typedef(p, tok->str) != 0;
+        result = find_typedef(p, tok->ident) != 0;
     }
     return result;
 }
@@ -388,7 +401,7 @@ parse_declspec(parser *p, uint32_t *storage_class_flags) {
                 type_flags |= TYPE_OTHER_BIT;
             }
 
-            c_type *id_type = find_typedef(p, tok->str);
+            c_type *id_type = find_typedef(p, tok->ident);
             if (!id_type) {
                 report_error_token(tok, "Undefined identifier");
             } else {
@@ -578,7 +591,7 @@ parse_expr_primary(parser *p) {
 
         uint64_t sizeof_value = evaluate_sizeof(p);
 
-        node = make_ast_num_int(loc, sizeof_value, get_standard_type(C_TYPE_ULLINT));
+        node = make_ast_num_int(p->a, loc, sizeof_value, get_standard_type(C_TYPE_ULLINT));
     } else if (IS_KW(tok, C_KW_ALIGNOF)) {
         NOT_IMPL;
     } else if (IS_KW(tok, C_KW_GENERIC)) {
@@ -587,9 +600,9 @@ parse_expr_primary(parser *p) {
         NOT_IMPL;
     } else if (tok->kind == TOK_NUM) {
         if (c_type_is_int(tok->type)) {
-            node = make_ast_num_int(tok->loc, tok->uint_value, tok->type);
+            node = make_ast_num_int(p->a, tok->loc, tok->uint_value, tok->type);
         } else {
-            node = make_ast_num_flt(tok->loc, tok->float_value, tok->type);
+            node = make_ast_num_flt(p->a, tok->loc, tok->float_value, tok->type);
         }
         ti_eat(p->it);
     } else if (tok->kind == TOK_STR) {
@@ -612,8 +625,8 @@ parse_expr_postfix(parser *p) {
             // a[b] is alias for *(a + b)
             ti_eat(p->it);
             ast *idx = parse_expr(p);
-            ast *add = make_ast_binary(AST_BIN_ADD, node, idx);
-            node     = make_ast_unary(node->loc, AST_UN_DEREF, add);
+            ast *add = make_ast_binary(p->a, AST_BIN_ADD, node, idx);
+            node     = make_ast_unary(p->a, node->loc, AST_UN_DEREF, add);
 
             tok = ti_peek(p->it);
             if (!IS_PUNCT(tok, ']')) {
@@ -628,13 +641,13 @@ parse_expr_postfix(parser *p) {
         } else if (IS_PUNCT(tok, C_PUNCT_INC)) {
             ti_eat(p->it);
 
-            node = make_ast_unary(node->loc, AST_UN_POSTINC, node);
+            node = make_ast_unary(p->a, node->loc, AST_UN_POSTINC, node);
 
             tok = ti_peek(p->it);
         } else if (IS_PUNCT(tok, C_PUNCT_DEC)) {
             ti_eat(p->it);
 
-            node = make_ast_unary(node->loc, AST_UN_POSTDEC, node);
+            node = make_ast_unary(p->a, node->loc, AST_UN_POSTDEC, node);
 
             tok = ti_peek(p->it);
         } else {
@@ -655,49 +668,49 @@ parse_expr_unary(parser *p) {
         ti_eat(p->it);
 
         ast *expr = parse_expr_cast(p);
-        node      = make_ast_unary(loc, AST_UN_PLUS, expr);
+        node      = make_ast_unary(p->a, loc, AST_UN_PLUS, expr);
     } else if (IS_PUNCT(tok, '-')) {
         source_loc loc = tok->loc;
         ti_eat(p->it);
 
         ast *expr = parse_expr_cast(p);
-        node      = make_ast_unary(loc, AST_UN_MINUS, expr);
+        node      = make_ast_unary(p->a, loc, AST_UN_MINUS, expr);
     } else if (IS_PUNCT(tok, '!')) {
         source_loc loc = tok->loc;
         ti_eat(p->it);
 
         ast *expr = parse_expr_cast(p);
-        node      = make_ast_unary(loc, AST_UN_LNOT, expr);
+        node      = make_ast_unary(p->a, loc, AST_UN_LNOT, expr);
     } else if (IS_PUNCT(tok, '~')) {
         source_loc loc = tok->loc;
         ti_eat(p->it);
 
         ast *expr = parse_expr_cast(p);
-        node      = make_ast_unary(loc, AST_UN_NOT, expr);
+        node      = make_ast_unary(p->a, loc, AST_UN_NOT, expr);
     } else if (IS_PUNCT(tok, '&')) {
         source_loc loc = tok->loc;
         ti_eat(p->it);
 
         ast *expr = parse_expr_cast(p);
-        node      = make_ast_unary(loc, AST_UN_DEREF, expr);
+        node      = make_ast_unary(p->a, loc, AST_UN_DEREF, expr);
     } else if (IS_PUNCT(tok, '*')) {
         source_loc loc = tok->loc;
         ti_eat(p->it);
 
         ast *expr = parse_expr_cast(p);
-        node      = make_ast_unary(loc, AST_UN_ADDR, expr);
+        node      = make_ast_unary(p->a, loc, AST_UN_ADDR, expr);
     } else if (IS_PUNCT(tok, C_PUNCT_INC)) {
         source_loc loc = tok->loc;
         ti_eat(p->it);
 
         ast *expr = parse_expr_cast(p);
-        node      = make_ast_unary(loc, AST_UN_PREINC, expr);
+        node      = make_ast_unary(p->a, loc, AST_UN_PREINC, expr);
     } else if (IS_PUNCT(tok, C_PUNCT_DEC)) {
         source_loc loc = tok->loc;
         ti_eat(p->it);
 
         ast *expr = parse_expr_cast(p);
-        node      = make_ast_unary(loc, AST_UN_PREDEC, expr);
+        node      = make_ast_unary(p->a, loc, AST_UN_PREDEC, expr);
     } else {
         node = parse_expr_postfix(p);
     }
@@ -727,11 +740,11 @@ parse_expr_cast(parser *p) {
             }
 
             ast *expr = parse_expr_cast(p);
-            node      = make_ast_cast(loc, expr, type);
+            node      = make_ast_cast(p->a, loc, expr, type);
         }
     }
 
-    if (node) {
+    if (!node) {
         node = parse_expr_unary(p);
     }
 
@@ -747,15 +760,15 @@ parse_expr_mul(parser *p) {
         if (IS_PUNCT(tok, '*')) {
             ti_eat(p->it);
             ast *right = parse_expr_unary(p);
-            node       = make_ast_binary(AST_BIN_MUL, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_MUL, node, right);
         } else if (IS_PUNCT(tok, '/')) {
             ti_eat(p->it);
             ast *right = parse_expr_unary(p);
-            node       = make_ast_binary(AST_BIN_DIV, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_DIV, node, right);
         } else if (IS_PUNCT(tok, '%')) {
             ti_eat(p->it);
             ast *right = parse_expr_unary(p);
-            node       = make_ast_binary(AST_BIN_MOD, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_MOD, node, right);
         } else {
             break;
         }
@@ -773,11 +786,11 @@ parse_expr_add(parser *p) {
         if (IS_PUNCT(tok, '+')) {
             ti_eat(p->it);
             ast *right = parse_expr_mul(p);
-            node       = make_ast_binary(AST_BIN_ADD, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_ADD, node, right);
         } else if (IS_PUNCT(tok, '-')) {
             ti_eat(p->it);
             ast *right = parse_expr_mul(p);
-            node       = make_ast_binary(AST_BIN_SUB, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_SUB, node, right);
         } else {
             break;
         }
@@ -795,11 +808,11 @@ parse_expr_shift(parser *p) {
         if (IS_PUNCT(tok, C_PUNCT_LSHIFT)) {
             ti_eat(p->it);
             ast *right = parse_expr_add(p);
-            node       = make_ast_binary(AST_BIN_LSHIFT, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_LSHIFT, node, right);
         } else if (IS_PUNCT(tok, C_PUNCT_RSHIFT)) {
             ti_eat(p->it);
             ast *right = parse_expr_add(p);
-            node       = make_ast_binary(AST_BIN_RSHIFT, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_RSHIFT, node, right);
         } else {
             break;
         }
@@ -817,19 +830,19 @@ parse_expr_rel(parser *p) {
         if (IS_PUNCT(tok, '<')) {
             ti_eat(p->it);
             ast *right = parse_expr_shift(p);
-            node       = make_ast_binary(AST_BIN_L, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_L, node, right);
         } else if (IS_PUNCT(tok, '>')) {
             ti_eat(p->it);
             ast *right = parse_expr_shift(p);
-            node       = make_ast_binary(AST_BIN_G, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_G, node, right);
         } else if (IS_PUNCT(tok, C_PUNCT_LEQ)) {
             ti_eat(p->it);
             ast *right = parse_expr_shift(p);
-            node       = make_ast_binary(AST_BIN_LE, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_LE, node, right);
         } else if (IS_PUNCT(tok, C_PUNCT_GEQ)) {
             ti_eat(p->it);
             ast *right = parse_expr_shift(p);
-            node       = make_ast_binary(AST_BIN_GE, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_GE, node, right);
         } else {
             break;
         }
@@ -847,11 +860,11 @@ parse_expr_eq(parser *p) {
         if (IS_PUNCT(tok, C_PUNCT_EQ)) {
             ti_eat(p->it);
             ast *right = parse_expr_rel(p);
-            node       = make_ast_binary(AST_BIN_EQ, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_EQ, node, right);
         } else if (IS_PUNCT(tok, C_PUNCT_NEQ)) {
             ti_eat(p->it);
             ast *right = parse_expr_rel(p);
-            node       = make_ast_binary(AST_BIN_NEQ, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_NEQ, node, right);
         } else {
             break;
         }
@@ -869,10 +882,11 @@ parse_expr_and(parser *p) {
         if (IS_PUNCT(tok, '&')) {
             ti_eat(p->it);
             ast *right = parse_expr_eq(p);
-            node       = make_ast_binary(AST_BIN_AND, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_AND, node, right);
         } else {
             break;
         }
+        tok = ti_peek(p->it);
     }
     return node;
 }
@@ -886,7 +900,7 @@ parse_expr_xor(parser *p) {
         if (IS_PUNCT(tok, '^')) {
             ti_eat(p->it);
             ast *right = parse_expr_and(p);
-            node       = make_ast_binary(AST_BIN_XOR, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_XOR, node, right);
         } else {
             break;
         }
@@ -904,10 +918,11 @@ parse_expr_or(parser *p) {
         if (IS_PUNCT(tok, '|')) {
             ti_eat(p->it);
             ast *right = parse_expr_xor(p);
-            node       = make_ast_binary(AST_BIN_OR, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_OR, node, right);
         } else {
             break;
         }
+        tok = ti_peek(p->it);
     }
     return node;
 }
@@ -921,7 +936,7 @@ parse_expr_land(parser *p) {
         if (IS_PUNCT(tok, C_PUNCT_LAND)) {
             ti_eat(p->it);
             ast *right = parse_expr_or(p);
-            node       = make_ast_binary(AST_BIN_LAND, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_LAND, node, right);
         } else {
             break;
         }
@@ -939,10 +954,11 @@ parse_expr_lor(parser *p) {
         if (IS_PUNCT(tok, C_PUNCT_LOR)) {
             ti_eat(p->it);
             ast *right = parse_expr_land(p);
-            node       = make_ast_binary(AST_BIN_LOR, node, right);
+            node       = make_ast_binary(p->a, AST_BIN_LOR, node, right);
         } else {
             break;
         }
+        tok = ti_peek(p->it);
     }
     return node;
 }
@@ -966,7 +982,7 @@ parse_expr_cond(parser *p) {
 
         ast *cond_false = parse_expr_cond(p);
 
-        node = make_ast_ternary(node, cond_true, cond_false);
+        node = make_ast_ternary(p->a, node, cond_true, cond_false);
     }
     return node;
 }
@@ -981,37 +997,37 @@ parse_expr_assign(parser *p) {
         default:
             break;
         case '=':
-            node = make_ast_binary(AST_BIN_A, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_A, node, parse_expr_assign(p));
             break;
         case C_PUNCT_IRSHIFT:
-            node = make_ast_binary(AST_BIN_RSHIFTA, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_RSHIFTA, node, parse_expr_assign(p));
             break;
         case C_PUNCT_ILSHIFT:
-            node = make_ast_binary(AST_BIN_LSHIFTA, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_LSHIFTA, node, parse_expr_assign(p));
             break;
         case C_PUNCT_IADD:
-            node = make_ast_binary(AST_BIN_ADDA, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_ADDA, node, parse_expr_assign(p));
             break;
         case C_PUNCT_ISUB:
-            node = make_ast_binary(AST_BIN_SUBA, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_SUBA, node, parse_expr_assign(p));
             break;
         case C_PUNCT_IMUL:
-            node = make_ast_binary(AST_BIN_MULA, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_MULA, node, parse_expr_assign(p));
             break;
         case C_PUNCT_IDIV:
-            node = make_ast_binary(AST_BIN_DIVA, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_DIVA, node, parse_expr_assign(p));
             break;
         case C_PUNCT_IMOD:
-            node = make_ast_binary(AST_BIN_MODA, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_MODA, node, parse_expr_assign(p));
             break;
         case C_PUNCT_IAND:
-            node = make_ast_binary(AST_BIN_ANDA, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_ANDA, node, parse_expr_assign(p));
             break;
         case C_PUNCT_IOR:
-            node = make_ast_binary(AST_BIN_ORA, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_ORA, node, parse_expr_assign(p));
             break;
         case C_PUNCT_IXOR:
-            node = make_ast_binary(AST_BIN_XORA, node, parse_expr_assign(p));
+            node = make_ast_binary(p->a, AST_BIN_XORA, node, parse_expr_assign(p));
             break;
         }
     }
@@ -1025,22 +1041,26 @@ parse_expr(parser *p) {
 
     token *tok = ti_peek(p->it);
     if (IS_PUNCT(tok, ',')) {
-        node = make_ast_binary(AST_BIN_COMMA, node, parse_expr(p));
+        node = make_ast_binary(p->a, AST_BIN_COMMA, node, parse_expr(p));
     }
 
     return node;
 }
 
 void
-parse(parser *p) {
+parse(parser *p, FILE *out) {
     for (;;) {
+        tc_begin(TC_TRACK_PARSER, (string)WRAPZ("parse"), (string){0});
+        TR_BEGIN(TR_PHASE_PARSING);
         ast *expr = parse_expr(p);
+        TR_END(TR_PHASE_PARSING);
+        tc_end(TC_TRACK_PARSER);
         if (!expr) {
             break;
         }
 
         char buffer[4096];
         fmt_ast_verbose(expr, buffer, sizeof(buffer));
-        printf("%s\n", buffer);
+        fprintf(out, "%s\n", buffer);
     }
 }
@@ -3,11 +3,15 @@
 
 #include "general.h"
 
+#include <stdio.h>
+
 #define PARSER_SCOPE_VAR_HASH_SIZE 1024
 #define PARSER_SCOPE_TAG_HASH_SIZE 1024
 
 struct token_iter;
 struct ast;
+struct bump_allocator;
+struct interned_string;
 
 typedef enum {
     PARSER_DECL_TYPEDEF  = 0x1,
@@ -19,8 +23,7 @@ typedef enum {
 typedef struct parser_decl {
     struct parser_decl *next;
 
-    string name;
-    uint32_t name_hash;
+    struct interned_string *name;
 
     parser_decl_kind kind;
     struct c_type *type;
@@ -30,8 +33,7 @@ typedef struct parser_decl {
 typedef struct parser_tag_decl {
     struct parser_tag_decl *next;
 
-    string name;
-    uint32_t name_hash;
+    struct interned_string *name;
     struct c_type *type;
 } parser_tag_decl;
 
@@ -44,6 +46,8 @@ typedef struct parser_scope {
 
 typedef struct parser {
     struct token_iter *it;
+    // Allocator used for ast, types and declarations
+    struct bump_allocator *a;
 
     parser_scope *scope;
 } parser;
@@ -121,6 +125,7 @@ struct ast *parse_type_name(parser *p);
 struct ast *parse_func_args(parser *p);
 struct ast *parse_expr_func_call(parser *p);
 
-void parse(parser *p);
+// Parses expressions until end of input, writing them to out
+void parse(parser *p, FILE *out);
 
 #endif
@@ -0,0 +1,190 @@
+#include "pp_hide_set.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bump_allocator.h"
+#include "darray.h"
+#include "hashing.h"
+
+// Initial number of buckets of table. Table is grown when number of sets
+// exceeds number of buckets.
+#define PPHS_INITIAL_SIZE 256
+
+void
+pphs_init(pp_hide_set_table *table, bump_allocator *a) {
+    table->a            = a;
+    table->bucket_count = PPHS_INITIAL_SIZE;
+    table->buckets      = calloc(table->bucket_count, sizeof(pp_hide_set *));
+    assert(table->buckets);
+}
+
+void
+pphs_free(pp_hide_set_table *table) {
+    free(table->buckets);
+    da_free(table->scratch);
+    memset(table, 0, sizeof(pp_hide_set_table));
+}
+
+static void
+grow_table(pp_hide_set_table *table) {
+    uint32_t new_count        = table->bucket_count * 2;
+    pp_hide_set **new_buckets = calloc(new_count, sizeof(pp_hide_set *));
+    assert(new_buckets);
+    for (uint32_t i = 0; i < table->bucket_count; ++i) {
+        pp_hide_set *set = table->buckets[i];
+        while (set) {
+            pp_hide_set *next  = set->next;
+            pp_hide_set **slot = new_buckets + (set->hash & (new_count - 1));
+            set->next          = *slot;
+            *slot              = set;
+            set                = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets      = new_buckets;
+    table->bucket_count = new_count;
+}
+
+// Returns interned set with ids from scratch array, which must be sorted
+static pp_hide_set *
+intern_scratch(pp_hide_set_table *table) {
+    uint32_t count = da_size(table->scratch);
+    if (!count) {
+        return NULL;
+    }
+
+    uint32_t hash       = murmur3_32(table->scratch, count * sizeof(uint32_t), 0);
+    pp_hide_set **slot  = table->buckets + (hash & (table->bucket_count - 1));
+    pp_hide_set *result = NULL;
+    for (pp_hide_set *test = *slot; test; test = test->next) {
+        if (test->hash == hash && test->count == count &&
+            memcmp(test->ids, table->scratch, count * sizeof(uint32_t)) == 0) {
+            result = test;
+            break;
+        }
+    }
+
+    if (!result) {
+        result = ba_alloc(table->a, sizeof(pp_hide_set) + count * sizeof(uint32_t));
+        memcpy(result->ids, table->scratch, count * sizeof(uint32_t));
+        result->count = count;
+        result->hash  = hash;
+        result->next  = *slot;
+        *slot         = result;
+        if (++table->set_count > table->bucket_count) {
+            grow_table(table);
+        }
+    }
+    return result;
+}
+
+bool
+pphs_contains(pp_hide_set *set, uint32_t id) {
+    bool result = false;
+    if (set) {
+        // Binary search
+        uint32_t low  = 0;
+        uint32_t high = set->count;
+        while (low < high) {
+            uint32_t mid = low + (high - low) / 2;
+            if (set->ids[mid] < id) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        result = low < set->count && set->ids[low] == id;
+    }
+    return result;
+}
+
+pp_hide_set *
+pphs_add(pp_hide_set_table *table, pp_hide_set *set, uint32_t id) {
+    pp_hide_set *result = set;
+    if (set && set->added && set->added_id == id) {
+        result = set->added;
+    } else if (!pphs_contains(set, id)) {
+        if (table->scratch) {
+            da_header(table->scratch)->size = 0;
+        }
+        uint32_t count = set ? set->count : 0;
+        uint32_t idx   = 0;
+        for (; idx < count && set->ids[idx] < id; ++idx) {
+            da_push(table->scratch, set->ids[idx]);
+        }
+        da_push(table->scratch, id);
+        for (; idx < count; ++idx) {
+            da_push(table->scratch, set->ids[idx]);
+        }
+        result = intern_scratch(table);
+        if (set) {
+            set->added_id = id;
+            set->added    = result;
+        }
+    }
+    return result;
+}
+
+pp_hide_set *
+pphs_union(pp_hide_set_table *table, pp_hide_set *lhs, pp_hide_set *rhs) {
+    pp_hide_set *result = NULL;
+    if (!lhs || lhs == rhs) {
+        result = rhs;
+    } else if (!rhs) {
+        result = lhs;
+    } else if (lhs->union_rhs == rhs) {
+        result = lhs->union_result;
+    } else {
+        if (table->scratch) {
+            da_header(table->scratch)->size = 0;
+        }
+        uint32_t lhs_idx = 0;
+        uint32_t rhs_idx = 0;
+        while (lhs_idx < lhs->count || rhs_idx < rhs->count) {
+            uint32_t id;
+            if (rhs_idx == rhs->count ||
+                (lhs_idx < lhs->count && lhs->ids[lhs_idx] < rhs->ids[rhs_idx])) {
+                id = lhs->ids[lhs_idx++];
+            } else if (lhs_idx == lhs->count || rhs->ids[rhs_idx] < lhs->ids[lhs_idx]) {
+                id = rhs->ids[rhs_idx++];
+            } else {
+                id = lhs->ids[lhs_idx++];
+                ++rhs_idx;
+            }
+            da_push(table->scratch, id);
+        }
+        result            = intern_scratch(table);
+        lhs->union_rhs    = rhs;
+        lhs->union_result = result;
+    }
+    return result;
+}
+
+pp_hide_set *
+pphs_intersect(pp_hide_set_table *table, pp_hide_set *lhs, pp_hide_set *rhs) {
+    pp_hide_set *result = NULL;
+    if (lhs == rhs) {
+        result = lhs;
+    } else if (lhs && rhs) {
+        if (table->scratch) {
+            da_header(table->scratch)->size = 0;
+        }
+        uint32_t lhs_idx = 0;
+        uint32_t rhs_idx = 0;
+        while (lhs_idx < lhs->count && rhs_idx < rhs->count) {
+            if (lhs->ids[lhs_idx] < rhs->ids[rhs_idx]) {
+                ++lhs_idx;
+            } else if (rhs->ids[rhs_idx] < lhs->ids[lhs_idx]) {
+                ++rhs_idx;
+            } else {
+                da_push(table->scratch, lhs->ids[lhs_idx]);
+                ++lhs_idx;
+                ++rhs_idx;
+            }
+        }
+        result = intern_scratch(table);
+    }
+    return result;
+}
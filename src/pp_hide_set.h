@@ -0,0 +1,53 @@
+// Hide sets of macro expansion (Prosser's algorithm). Every token produced by
+// expansion carries set of names of macros that it came from, and identifier
+// is not expanded if its macro is in its own hide set. Such token is painted
+// blue and is never expanded later, so macros defined in terms of themselves
+// terminate.
+//
+// Sets are stored as sorted arrays of ids of interned names. They are
+// interned too, so equal sets are the same pointer, and empty set is NULL.
+// Results of last operations are cached on sets, as tokens of single
+// expansion mostly have the same hide sets.
+#ifndef PP_HIDE_SET_H
+#define PP_HIDE_SET_H
+
+#include "general.h"
+
+struct bump_allocator;
+
+typedef struct pp_hide_set {
+    // Next set in bucket of hash table
+    struct pp_hide_set *next;
+    uint32_t hash;
+    uint32_t count;
+    // Last pphs_add made with this set
+    uint32_t added_id;
+    struct pp_hide_set *added;
+    // Last pphs_union made with this set as left operand
+    struct pp_hide_set *union_rhs;
+    struct pp_hide_set *union_result;
+    // Sorted ids of interned macro names
+    uint32_t ids[];
+} pp_hide_set;
+
+typedef struct pp_hide_set_table {
+    // Memory for sets, that lives as long as translation unit
+    struct bump_allocator *a;
+    pp_hide_set **buckets;
+    uint32_t bucket_count;
+    uint32_t set_count;
+    // Ids of set being built
+    uint32_t *scratch;  // da
+} pp_hide_set_table;
+
+void pphs_init(pp_hide_set_table *table, struct bump_allocator *a);
+// Frees buckets of table. Sets are left in allocator.
+void pphs_free(pp_hide_set_table *table);
+
+bool pphs_contains(pp_hide_set *set, uint32_t id);
+// Returns set with id added
+pp_hide_set *pphs_add(pp_hide_set_table *table, pp_hide_set *set, uint32_t id);
+pp_hide_set *pphs_union(pp_hide_set_table *table, pp_hide_set *lhs, pp_hide_set *rhs);
+pp_hide_set *pphs_intersect(pp_hide_set_table *table, pp_hide_set *lhs, pp_hide_set *rhs);
+
+#endif
@@ -1,22 +1,75 @@
 #include "pp_lexer.h"
 
 #include <assert.h>
-#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "buffer_writer.h"
+#include "bump_allocator.h"
+#include "darray.h"
+#include "intern.h"
+#include "source_manager.h"
 #include "str.h"
+#include "time_report.h"
 #include "unicode.h"
 
+// Classes of characters used by lexer. Lexer uses table lookup instead of
+// ctype functions, which go through locale tables, can't be inlined and make
+// lexing depend on current locale.
+typedef enum {
+    PP_CHAR_IDENT_START    = 0x1,   // a-z A-Z _
+    PP_CHAR_IDENT_CONTINUE = 0x2,   // a-z A-Z _ 0-9
+    PP_CHAR_DIGIT          = 0x4,   // 0-9
+    PP_CHAR_XDIGIT         = 0x8,   // 0-9 a-f A-F
+    PP_CHAR_SPACE          = 0x10,  // ' ' \t \n \v \f \r
+    PP_CHAR_PUNCT          = 0x20,  // Printable ASCII that is not alphanumeric
+    PP_CHAR_NEWLINE        = 0x40,  // \n
+} pp_char_class;
+
+// Class flags of each byte. Non-ASCII bytes don't belong to any class.
+static const uint8_t CHAR_CLASSES[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 0x00-0x07
+    0x00, 0x10, 0x50, 0x10, 0x10, 0x10, 0x00, 0x00,  // 0x08-0x0F
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 0x10-0x17
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 0x18-0x1F
+    0x10, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,  // 0x20-0x27
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,  // 0x28-0x2F
+    0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E,  // 0x30-0x37
+    0x0E, 0x0E, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,  // 0x38-0x3F
+    0x20, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x03,  // 0x40-0x47
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,  // 0x48-0x4F
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,  // 0x50-0x57
+    0x03, 0x03, 0x03, 0x20, 0x20, 0x20, 0x20, 0x23,  // 0x58-0x5F
+    0x20, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x03,  // 0x60-0x67
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,  // 0x68-0x6F
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,  // 0x70-0x77
+    0x03, 0x03, 0x03, 0x20, 0x20, 0x20, 0x20, 0x00,  // 0x78-0x7F
+};
+
+#define CHAR_IS(_c, _class) ((CHAR_CLASSES[(uint8_t)(_c)] & (_class)) != 0)
+
+// Packing of kinds in pp_token_array. Token kind is stored in the lowest byte,
+// flags in the second one and punctuator or string kind in upper 16 bits.
+#define PP_TOKA_KIND_MASK 0xFF
+#define PP_TOKA_AT_LINE_START 0x100
+#define PP_TOKA_HAS_WHITESPACE 0x200
+// String literal contained escape sequences, and its value is index in
+// pp_token_array.strings
+#define PP_TOKA_ESCAPED 0x400
+#define PP_TOKA_SUBKIND_SHIFT 16
+// Element of array that is group of lines, see pp_token_group. Its value is
+// index in pp_token_array.groups.
+#define PP_TOKA_GROUP 0xFF
+
 #define PP_TOK_STR_ADVANCE 0x10
 #define PP_TOK_PUNCT_ADVANCE 0x100
 
+// Strings of multi symbol punctuators, indexed by kind - PP_TOK_PUNCT_ADVANCE
 static string PUNCT_STRS[] = {
-    WRAPZ(">>="), WRAPZ("<<="), WRAPZ("..."), WRAPZ("+="), WRAPZ("-="), WRAPZ("*="),
-    WRAPZ("/="),  WRAPZ("%="),  WRAPZ("&="),  WRAPZ("|="), WRAPZ("^="), WRAPZ("++"),
-    WRAPZ("--"),  WRAPZ(">>"),  WRAPZ("<<"),  WRAPZ("&&"), WRAPZ("||"), WRAPZ("=="),
-    WRAPZ("!="),  WRAPZ("<="),  WRAPZ(">="),  WRAPZ("##"),
+    WRAPZ("(unknown)"), WRAPZ(">>="), WRAPZ("<<="), WRAPZ("+="), WRAPZ("-="), WRAPZ("*="),
+    WRAPZ("/="),        WRAPZ("%="),  WRAPZ("&="),  WRAPZ("|="), WRAPZ("^="), WRAPZ("++"),
+    WRAPZ("--"),        WRAPZ(">>"),  WRAPZ("<<"),  WRAPZ("&&"), WRAPZ("||"), WRAPZ("=="),
+    WRAPZ("!="),        WRAPZ("<="),  WRAPZ(">="),  WRAPZ("..."), WRAPZ("->"), WRAPZ("##"),
 };
 
 static string
@@ -59,27 +112,15 @@ get_str_opener(pp_string_kind kind) {
     return result;
 }
 
-static bool
-next_eq(pp_lexer *lex, string lit) {
-#if 1
-    return (lex->cursor + lit.len < lex->eof) && (memcmp(lex->cursor, lit.data, lit.len) == 0);
-#else
-    // In theory memcmp does per-byte compares, so in won't touch uninitialized
-    // memory. But it actually may use some form of SIMD so this assumption
-    // would be incorrect.
-    return memcmp(lex->cursor, lit.data, lit.len) == 0;
-#endif
-}
-
 // Handling of whitespace characters
 static bool
 parse_whitespaces(pp_lexer *lex, pp_token *tok) {
     bool result = false;
 
     // Skip ASCII whitespaces
-    while (isspace(*lex->cursor)) {
+    while (CHAR_IS(*lex->cursor, PP_CHAR_SPACE)) {
         result = true;
-        if (*lex->cursor == '\n') {
+        if (CHAR_IS(*lex->cursor, PP_CHAR_NEWLINE)) {
             tok->at_line_start   = true;
             lex->last_line_start = lex->cursor + 1;
             ++lex->line;
@@ -87,8 +128,10 @@ parse_whitespaces(pp_lexer *lex, pp_token *tok) {
         ++lex->cursor;
     }
 
+    // Comments are checked character by character. Source is terminated with
+    // zero, so reading the character after '/' is always valid.
     // Skip single-line comments
-    if (next_eq(lex, (string)WRAPZ("//"))) {
+    if (lex->cursor[0] == '/' && lex->cursor[1] == '/') {
         result = true;
         while (*lex->cursor != '\n' && *lex->cursor) {
             ++lex->cursor;
@@ -103,12 +146,12 @@ parse_whitespaces(pp_lexer *lex, pp_token *tok) {
     }
 
     // Skip multi-line comments
-    string com = WRAPZ("/*");
-    if (next_eq(lex, com)) {
+    if (lex->cursor[0] == '/' && lex->cursor[1] == '*') {
         result = true;
-        while (*lex->cursor && !next_eq(lex, (string)WRAPZ("*/"))) {
+        lex->cursor += 2;
+        while (*lex->cursor && !(lex->cursor[0] == '*' && lex->cursor[1] == '/')) {
             if (*lex->cursor == '\n') {
-                lex->last_line_start = lex->cursor;
+                lex->last_line_start = lex->cursor + 1;
                 ++lex->line;
             }
             ++lex->cursor;
@@ -129,6 +172,107 @@ parse_whitespaces(pp_lexer *lex, pp_token *tok) {
     return result;
 }
 
+bool
+pp_lexer_skip_to_directive(pp_lexer *lex) {
+    // Beginning of file is considered line start, so let caller lex first
+    // line normally.
+    if (lex->cursor == lex->data) {
+        return *lex->cursor != 0;
+    }
+
+    char *cursor          = lex->cursor;
+    uint32_t line         = lex->line;
+    char *last_line_start = lex->last_line_start;
+    bool result           = false;
+    for (;;) {
+        cursor += strcspn(cursor, "\n/\"'");
+        char c = *cursor;
+        if (!c) {
+            break;
+        }
+
+        if (c == '\n') {
+            // Line state before newline, so lexer can process it again
+            char *newline                 = cursor;
+            uint32_t newline_line         = line;
+            char *newline_last_line_start = last_line_start;
+
+            ++line;
+            ++cursor;
+            last_line_start = cursor;
+            // Skip whitespace and comments preceding first token of the line
+            for (;;) {
+                while (*cursor == ' ' || *cursor == '\t' || *cursor == '\v' ||
+                       *cursor == '\f' || *cursor == '\r') {
+                    ++cursor;
+                }
+                if (cursor[0] == '/' && cursor[1] == '*') {
+                    cursor += 2;
+                    while (*cursor && !(cursor[0] == '*' && cursor[1] == '/')) {
+                        if (*cursor == '\n') {
+                            ++line;
+                            last_line_start = cursor + 1;
+                        }
+                        ++cursor;
+                    }
+                    if (*cursor) {
+                        cursor += 2;
+                    }
+                } else {
+                    break;
+                }
+            }
+
+            if (*cursor == '#') {
+                cursor          = newline;
+                line            = newline_line;
+                last_line_start = newline_last_line_start;
+                result          = true;
+                break;
+            }
+        } else if (c == '/') {
+            if (cursor[1] == '/') {
+                while (*cursor && *cursor != '\n') {
+                    ++cursor;
+                }
+            } else if (cursor[1] == '*') {
+                cursor += 2;
+                while (*cursor && !(cursor[0] == '*' && cursor[1] == '/')) {
+                    if (*cursor == '\n') {
+                        ++line;
+                        last_line_start = cursor + 1;
+                    }
+                    ++cursor;
+                }
+                if (*cursor) {
+                    cursor += 2;
+                }
+            } else {
+                ++cursor;
+            }
+        } else {
+            // String or character literal. Unterminated literal ends at the
+            // end of line.
+            char terminator = c;
+            ++cursor;
+            while (*cursor && *cursor != terminator && *cursor != '\n') {
+                if (*cursor == '\\' && cursor[1] && cursor[1] != '\n') {
+                    ++cursor;
+                }
+                ++cursor;
+            }
+            if (*cursor == terminator) {
+                ++cursor;
+            }
+        }
+    }
+
+    lex->cursor          = cursor;
+    lex->line            = line;
+    lex->last_line_start = last_line_start;
+    return result;
+}
+
 // Get digit number from its ASCII representation
 static uint32_t
 from_hex(char cp) {
@@ -150,7 +294,7 @@ read_unicode_value(pp_lexer *lex, uint32_t len, uint32_t *valuep) {
     char *test_cursor = lex->cursor;
     uint32_t value    = 0;
     for (uint32_t idx = 0; idx < len; ++idx) {
-        if (!isxdigit(*test_cursor)) {
+        if (!CHAR_IS(*test_cursor, PP_CHAR_XDIGIT)) {
             result = false;
             break;
         }
@@ -178,14 +322,14 @@ read_escaped_char(pp_lexer *lex) {
         result = octal_value;
     } else if (*lex->cursor == 'x') {
         ++lex->cursor;
-        if (!isxdigit(*lex->cursor)) {
+        if (!CHAR_IS(*lex->cursor, PP_CHAR_XDIGIT)) {
             printf("Invalid hex constant\n");
         }
 
         // CLEANUP: We can use read_unicode_value here (rename it also) if set
         // len to some asurdely large value.
         uint32_t hex_value = 0;
-        while (isxdigit(*lex->cursor)) {
+        while (CHAR_IS(*lex->cursor, PP_CHAR_XDIGIT)) {
             hex_value = (hex_value << 4) | from_hex(*lex->cursor++);
         }
         result = hex_value;
@@ -240,6 +384,8 @@ read_escaped_char(pp_lexer *lex) {
     return result;
 }
 
+// Reads string literal that contains escape sequences. Unescaped contents are
+// written to buf as utf8 and terminated with zero. Literal must be terminated.
 static void
 read_utf8_string_literal(pp_lexer *lex, char terminator, char *buf, uint32_t buf_size,
                          uint32_t *buf_writtenp) {
@@ -248,30 +394,24 @@ read_utf8_string_literal(pp_lexer *lex, char terminator, char *buf, uint32_t buf
     assert(write_cursor != write_eof);
     for (;;) {
         // Make sure buffer is always terminated
-        if (write_cursor + 1 >= write_eof) {
+        if (write_cursor + 4 >= write_eof) {
             NOT_IMPL;
             break;
         }
 
-        uint32_t cp = *lex->cursor++;
-        if (cp == '\n') {
-            printf("Unterminated string constant\n");
+        // Literal is known to be terminated
+        char c = *lex->cursor++;
+        if (c == terminator) {
             break;
-        } else if (cp == (uint32_t)terminator) {
-            break;
-        }
-
-        if (cp == '\\') {
-            cp = read_escaped_char(lex);
         }
 
-        char utf8[5]    = {0};
-        uint32_t cp_len = (char *)utf8_encode(utf8, cp) - utf8;
-        if (write_cursor + cp_len >= write_eof) {
-            break;
+        if (c == '\\') {
+            uint32_t cp = read_escaped_char(lex);
+            write_cursor = utf8_encode(write_cursor, cp);
+        } else {
+            // Source is already utf8, so bytes are copied as is
+            *write_cursor++ = c;
         }
-        memcpy(write_cursor, utf8, cp_len);
-        write_cursor += cp_len;
     }
     *write_cursor = 0;
     *buf_writtenp = write_cursor - buf;
@@ -345,13 +485,34 @@ parse_string_literal(pp_lexer *lex, pp_token *tok, char *buf, uint32_t buf_size,
         str_kind = PP_TOK_STR_SWIDE;
     }
 
-    if (*test_cursor == '\'' || *test_cursor == '\"') {
-        bool is_char    = *test_cursor == '\'';
-        char terminator = *test_cursor++;
-        lex->cursor     = test_cursor;
-        result          = true;
+    // Literal is found first. Most of literals don't have escape sequences,
+    // so their contents can be used right from the source without copying.
+    char terminator = *test_cursor;
+    bool is_quote   = terminator == '\'' || terminator == '\"';
+    char *start     = test_cursor + 1;
+    char *end       = start;
+    bool has_escape = false;
+    if (is_quote) {
+        while (*end != terminator && *end != '\n' && *end) {
+            if (*end == '\\' && end[1] && end[1] != '\n') {
+                has_escape = true;
+                ++end;
+            }
+            ++end;
+        }
+    }
 
-        read_utf8_string_literal(lex, terminator, buf, buf_size, buf_writtenp);
+    if (is_quote && *end == terminator) {
+        bool is_char = terminator == '\'';
+        result       = true;
+        if (has_escape) {
+            lex->cursor = start;
+            read_utf8_string_literal(lex, terminator, buf, buf_size, buf_writtenp);
+            tok->str = (string){buf, *buf_writtenp};
+        } else {
+            lex->cursor = end + 1;
+            tok->str    = (string){start, end - start};
+        }
 #if 0
         switch (str_kind) {
         default:
@@ -374,98 +535,187 @@ parse_string_literal(pp_lexer *lex, pp_token *tok, char *buf, uint32_t buf_size,
         }
         tok->kind     = PP_TOK_STR;
         tok->str_kind = str_kind;
-        tok->str      = (string){buf, *buf_writtenp};
+    } else if (is_quote && test_cursor == lex->cursor) {
+        // Unmatched quote is a token of its own. Source that is not excluded
+        // by conditional directives can't contain it, so it is reported later
+        // as unexpected token.
+        result      = true;
+        lex->cursor = start;
+        tok->kind   = PP_TOK_OTHER;
+        tok->str    = (string){test_cursor, 1};
     }
 
     return result;
 }
 
+// Numbers are stored as spelled in source. Conversion to actual value is done
+// when converting to C token.
 static bool
-parse_number(pp_lexer *lex, pp_token *tok, char *buf, uint32_t buf_size,
-             uint32_t *buf_writtenp) {
-    bool result        = false;
-    char *write_cursor = buf;
-    char *write_eof    = buf + buf_size;
-    assert(write_cursor != write_eof);
-    if (isdigit(*lex->cursor) || (*lex->cursor == '.' && isdigit(lex->cursor[1]))) {
-        result          = true;
-        *write_cursor++ = *lex->cursor++;
+parse_number(pp_lexer *lex, pp_token *tok) {
+    bool result = false;
+    if (CHAR_IS(*lex->cursor, PP_CHAR_DIGIT) ||
+        (*lex->cursor == '.' && CHAR_IS(lex->cursor[1], PP_CHAR_DIGIT))) {
+        result      = true;
+        char *start = lex->cursor++;
         for (;;) {
-            if (write_cursor + 1 >= write_eof) {
-                NOT_IMPL;
-                break;
-            }
-            if (isalnum(*lex->cursor) || *lex->cursor == '_' || *lex->cursor == '\'') {
-                *write_cursor++ = *lex->cursor++;
-            } else if (*lex->cursor && strchr("eEpP", *lex->cursor) &&
-                       strchr("+-", lex->cursor[1])) {
-                *write_cursor++ = *lex->cursor++;
-                *write_cursor++ = *lex->cursor++;
+            // Exponent sign is checked first, otherwise exponent character
+            // would be consumed alone as part of identifier-like suffix.
+            char c = *lex->cursor;
+            if ((c == 'e' || c == 'E' || c == 'p' || c == 'P') &&
+                (lex->cursor[1] == '+' || lex->cursor[1] == '-')) {
+                lex->cursor += 2;
+            } else if (CHAR_IS(c, PP_CHAR_IDENT_CONTINUE) || c == '\'' || c == '.') {
+                ++lex->cursor;
             } else {
                 break;
             }
         }
-        *write_cursor = 0;
-        *buf_writtenp = write_cursor - buf;
-        tok->str      = (string){buf, *buf_writtenp};
-        assert(*buf_writtenp < buf_size);
+        tok->str  = (string){start, lex->cursor - start};
         tok->kind = PP_TOK_NUM;
     }
 
     return result;
 }
 
+// Punctuators are matched by their first character, and then the longest one
+// that matches following characters is chosen. Source is terminated with zero,
+// which does not match any punctuator, so no range checks are needed.
 static bool
 parse_punctuator(pp_lexer *lex, pp_token *tok) {
-    bool result = false;
-    for (uint32_t idx = 0; idx < ARRAY_SIZE(PUNCT_STRS); ++idx) {
-        string punct = PUNCT_STRS[idx];
-        if (next_eq(lex, punct)) {
-            lex->cursor += punct.len;
-
-            tok->kind       = PP_TOK_PUNCT;
-            tok->punct_kind = PP_TOK_PUNCT_ADVANCE + idx;
-
-            result = true;
-            break;
+    char *c       = lex->cursor;
+    uint32_t len  = 1;
+    uint32_t kind = (uint8_t)c[0];
+    switch (c[0]) {
+    default:
+        if (!CHAR_IS(c[0], PP_CHAR_PUNCT)) {
+            len = 0;
+        }
+        break;
+    case '>':
+        if (c[1] == '>') {
+            len  = c[2] == '=' ? 3 : 2;
+            kind = c[2] == '=' ? PP_TOK_PUNCT_IRSHIFT : PP_TOK_PUNCT_RSHIFT;
+        } else if (c[1] == '=') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_GEQ;
+        }
+        break;
+    case '<':
+        if (c[1] == '<') {
+            len  = c[2] == '=' ? 3 : 2;
+            kind = c[2] == '=' ? PP_TOK_PUNCT_ILSHIFT : PP_TOK_PUNCT_LSHIFT;
+        } else if (c[1] == '=') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_LEQ;
+        }
+        break;
+    case '.':
+        if (c[1] == '.' && c[2] == '.') {
+            len  = 3;
+            kind = PP_TOK_PUNCT_VARARGS;
+        }
+        break;
+    case '+':
+        if (c[1] == '+') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_INC;
+        } else if (c[1] == '=') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_IADD;
+        }
+        break;
+    case '-':
+        if (c[1] == '-') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_DEC;
+        } else if (c[1] == '=') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_ISUB;
+        } else if (c[1] == '>') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_ARROW;
         }
+        break;
+    case '&':
+        if (c[1] == '&') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_LAND;
+        } else if (c[1] == '=') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_IAND;
+        }
+        break;
+    case '|':
+        if (c[1] == '|') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_LOR;
+        } else if (c[1] == '=') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_IOR;
+        }
+        break;
+    case '#':
+        if (c[1] == '#') {
+            len  = 2;
+            kind = PP_TOK_PUNCT_DHASH;
+        }
+        break;
+    case '*':
+    case '/':
+    case '%':
+    case '^':
+    case '=':
+    case '!':
+        if (c[1] == '=') {
+            len = 2;
+            switch (c[0]) {
+                INVALID_DEFAULT_CASE;
+            case '*':
+                kind = PP_TOK_PUNCT_IMUL;
+                break;
+            case '/':
+                kind = PP_TOK_PUNCT_IDIV;
+                break;
+            case '%':
+                kind = PP_TOK_PUNCT_IMOD;
+                break;
+            case '^':
+                kind = PP_TOK_PUNCT_IXOR;
+                break;
+            case '=':
+                kind = PP_TOK_PUNCT_EQ;
+                break;
+            case '!':
+                kind = PP_TOK_PUNCT_NEQ;
+                break;
+            }
+        }
+        break;
     }
 
-    if (!result) {
-        if (ispunct(*lex->cursor)) {
-            tok->kind       = PP_TOK_PUNCT;
-            tok->punct_kind = *lex->cursor++;
+    bool result = false;
+    if (len) {
+        lex->cursor += len;
 
-            result = true;
-        }
+        tok->kind       = PP_TOK_PUNCT;
+        tok->punct_kind = kind;
+        result          = true;
     }
-
     return result;
 }
 
 static bool
-parse_ident(pp_lexer *lex, pp_token *tok, char *buf, uint32_t buf_size,
-            uint32_t *buf_writtenp) {
+parse_ident(pp_lexer *lex, pp_token *tok) {
     bool result = false;
-    if (isalpha(*lex->cursor) || *lex->cursor == '_') {
-        char *write_cursor = buf;
-        char *write_eof    = buf + buf_size;
-        assert(write_cursor != write_eof);
-        *write_cursor++ = *lex->cursor++;
-
-        while (isalnum(*lex->cursor) || *lex->cursor == '_') {
-            if (write_cursor + 1 >= write_eof) {
-                NOT_IMPL;
-                break;
-            }
-            *write_cursor++ = *lex->cursor++;
+    if (CHAR_IS(*lex->cursor, PP_CHAR_IDENT_START)) {
+        char *start = lex->cursor++;
+        while (CHAR_IS(*lex->cursor, PP_CHAR_IDENT_CONTINUE)) {
+            ++lex->cursor;
         }
-        *write_cursor = 0;
 
-        *buf_writtenp = write_cursor - buf;
-        assert(*buf_writtenp < buf_size);
-        tok->str  = (string){buf, *buf_writtenp};
-        tok->kind = PP_TOK_ID;
+        tok->ident = intern_string((string){start, lex->cursor - start});
+        tok->str   = tok->ident->str;
+        tok->kind  = PP_TOK_ID;
 
         result = true;
     }
@@ -491,12 +741,9 @@ pp_lexer_parse(pp_lexer *lex, pp_token *tok, char *buf, uint32_t buf_size,
             } else if (cp & 0x80) {
                 lex->tok_start = lex->cursor;
                 uint32_t t;
-                lex->cursor   = utf8_decode(lex->cursor, &t);
-                tok->kind     = PP_TOK_OTHER;
-                buf[0]        = cp;
-                buf[1]        = 0;
-                *buf_writtenp = 1;
-                tok->str      = (string){buf, *buf_writtenp};
+                lex->cursor = utf8_decode(lex->cursor, &t);
+                tok->kind   = PP_TOK_OTHER;
+                tok->str    = (string){lex->tok_start, lex->cursor - lex->tok_start};
                 break;
             }
         }
@@ -510,11 +757,11 @@ pp_lexer_parse(pp_lexer *lex, pp_token *tok, char *buf, uint32_t buf_size,
             break;
         }
 
-        if (parse_number(lex, tok, buf, buf_size, buf_writtenp)) {
+        if (parse_number(lex, tok)) {
             break;
         }
 
-        if (parse_ident(lex, tok, buf, buf_size, buf_writtenp)) {
+        if (parse_ident(lex, tok)) {
             break;
         }
 
@@ -522,11 +769,15 @@ pp_lexer_parse(pp_lexer *lex, pp_token *tok, char *buf, uint32_t buf_size,
             break;
         }
 
-        assert(false);
+        // Control characters don't form any token. Each of them is a token of
+        // its own, and it is reported if it gets to the parser.
+        ++lex->cursor;
+        tok->kind = PP_TOK_OTHER;
+        tok->str  = (string){lex->tok_start, 1};
+        break;
     }
-    tok->loc.line = lex->line;
-    tok->loc.col  = lex->tok_start - lex->last_line_start + 1;
-    bool is_eof   = tok->kind == PP_TOK_EOF;
+    tok->loc    = lex->loc_base + (lex->tok_start - lex->data);
+    bool is_eof = tok->kind == PP_TOK_EOF;
     return !is_eof;
 }
 
@@ -539,6 +790,287 @@ pp_lexer_init(pp_lexer *lex, char *data, char *eof) {
     lex->last_line_start = data;
 }
 
+// Grows array of 32-bit values allocated with bump allocator
+static uint32_t *
+grow_u32_array(bump_allocator *a, uint32_t *array, uint32_t count, uint32_t new_count) {
+    uint32_t *result = ba_alloc_array(a, uint32_t, new_count);
+    memcpy(result, array, sizeof(uint32_t) * count);
+    return result;
+}
+
+// Groups shorter than this are lexed right away, as lexing them later costs
+// more than lexing them in place.
+#define PP_LEXER_MIN_GROUP_SIZE 128
+
+static bool
+is_conditional_directive(pp_token *tok) {
+    return tok->kind == PP_TOK_ID && !tok->at_line_start &&
+           tok->ident->pp_kind >= PP_IDENT_IF && tok->ident->pp_kind <= PP_IDENT_ENDIF;
+}
+
+// Skips source up to the next conditional directive line or end of file,
+// leaving lexer right before the newline preceding the directive.
+static void
+skip_group(pp_lexer *lex) {
+    for (;;) {
+        if (!pp_lexer_skip_to_directive(lex)) {
+            break;
+        }
+
+        pp_lexer saved = *lex;
+        char buf[256];
+        uint32_t buf_len = 0;
+        pp_token hash    = {0};
+        pp_lexer_parse(lex, &hash, buf, sizeof(buf), &buf_len);
+        pp_lexer after_hash = *lex;
+        pp_token name       = {0};
+        pp_lexer_parse(lex, &name, buf, sizeof(buf), &buf_len);
+        if (is_conditional_directive(&name)) {
+            *lex = saved;
+            break;
+        } else if (name.at_line_start) {
+            // Null directive, next line may be directive itself
+            *lex = after_hash;
+        }
+    }
+}
+
+// State of search of groups in lex_tokens
+typedef enum {
+    LEX_GROUP_NONE,
+    // Previous token is '#' at line start
+    LEX_GROUP_HASH,
+    // Inside of conditional directive line, group follows it
+    LEX_GROUP_DIRECTIVE,
+    // Previous token is '#' that starts the line following conditional
+    // directive
+    LEX_GROUP_FIRST_HASH,
+} lex_group_state;
+
+// Lexes source until token that starts at end offset or end of file.
+//
+// Lines between conditional directives are not lexed, and are stored as groups
+// instead. The first token of group is lexed anyway, and if it is '#', the
+// one following it too, so that preprocessor can find the end of directive
+// line and the name of directive without lexing the group.
+static pp_token_array *
+lex_tokens(pp_lexer *lex, bump_allocator *a, uint32_t end) {
+    TR_BEGIN(TR_PHASE_LEXING);
+    pp_token_array *result = ba_alloc_struct(a, pp_token_array);
+    result->data           = lex->data;
+    result->loc_base       = lex->loc_base;
+
+    // Arrays are written right to the memory of allocator. Capacity is guessed
+    // from source size, so that they are rarely regrown. Each token takes at
+    // least one byte, and typical code has more than 4 bytes per token.
+    char *last = lex->eof;
+    if (end < (uint32_t)(last - lex->data)) {
+        last = lex->data + end;
+    }
+    uint32_t capacity      = (last - lex->cursor) / 4 + 16;
+    uint32_t *kinds        = ba_alloc_array(a, uint32_t, capacity);
+    uint32_t *values       = ba_alloc_array(a, uint32_t, capacity);
+    uint32_t *offsets      = ba_alloc_array(a, uint32_t, capacity);
+    string *strings        = NULL;
+    pp_token_group *groups = NULL;
+    uint32_t token_count   = 0;
+    lex_group_state state  = LEX_GROUP_NONE;
+    for (;;) {
+        // Each token may be followed by group, so two elements are reserved
+        if (token_count + 2 > capacity) {
+            kinds   = grow_u32_array(a, kinds, capacity, capacity * 2);
+            values  = grow_u32_array(a, values, capacity, capacity * 2);
+            offsets = grow_u32_array(a, offsets, capacity, capacity * 2);
+            capacity *= 2;
+        }
+
+        char buf[4096];
+        uint32_t buf_len = 0;
+        pp_token tok     = {0};
+        bool not_eof     = pp_lexer_parse(lex, &tok, buf, sizeof(buf), &buf_len);
+        uint32_t offset  = tok.loc - lex->loc_base;
+        if (offset >= end) {
+            tok.kind = PP_TOK_EOF;
+            offset   = end;
+            not_eof  = false;
+        }
+
+        uint32_t kind  = tok.kind;
+        uint32_t value = 0;
+        switch (tok.kind) {
+            INVALID_DEFAULT_CASE;
+        case PP_TOK_EOF:
+            break;
+        case PP_TOK_ID:
+            value = tok.ident->id;
+            break;
+        case PP_TOK_PUNCT:
+            kind |= tok.punct_kind << PP_TOKA_SUBKIND_SHIFT;
+            break;
+        case PP_TOK_STR:
+            kind |= tok.str_kind << PP_TOKA_SUBKIND_SHIFT;
+            if (buf_len) {
+                kind |= PP_TOKA_ESCAPED;
+                value = da_size(strings);
+                da_push(strings, ba_string_dup(a, tok.str));
+            } else {
+                value = tok.str.len;
+            }
+            break;
+        case PP_TOK_NUM:
+        case PP_TOK_OTHER:
+            value = tok.str.len;
+            break;
+        }
+        if (tok.at_line_start) {
+            kind |= PP_TOKA_AT_LINE_START;
+        }
+        if (tok.has_whitespace) {
+            kind |= PP_TOKA_HAS_WHITESPACE;
+        }
+        kinds[token_count]   = kind;
+        values[token_count]  = value;
+        offsets[token_count] = offset;
+        ++token_count;
+
+        if (!not_eof) {
+            break;
+        }
+
+        bool is_hash     = PP_TOK_IS_PUNCT(&tok, '#') && tok.at_line_start;
+        bool is_cond     = is_conditional_directive(&tok);
+        bool makes_group = false;
+        switch (state) {
+        case LEX_GROUP_NONE:
+            state = is_hash ? LEX_GROUP_HASH : LEX_GROUP_NONE;
+            break;
+        case LEX_GROUP_HASH:
+            state = is_cond ? LEX_GROUP_DIRECTIVE : is_hash ? LEX_GROUP_HASH : LEX_GROUP_NONE;
+            break;
+        case LEX_GROUP_DIRECTIVE:
+            if (tok.at_line_start) {
+                state       = is_hash ? LEX_GROUP_FIRST_HASH : LEX_GROUP_NONE;
+                makes_group = !is_hash;
+            }
+            break;
+        case LEX_GROUP_FIRST_HASH:
+            if (is_cond) {
+                state = LEX_GROUP_DIRECTIVE;
+            } else if (!is_hash) {
+                state       = LEX_GROUP_NONE;
+                makes_group = true;
+            }
+            break;
+        }
+
+        if (makes_group) {
+            pp_lexer saved = *lex;
+            skip_group(lex);
+            pp_token_group group = {0};
+            group.start          = saved.cursor - lex->data;
+            group.end            = lex->cursor - lex->data;
+            if (group.end - group.start < PP_LEXER_MIN_GROUP_SIZE || group.end > end) {
+                *lex = saved;
+            } else {
+                kinds[token_count]   = PP_TOKA_GROUP;
+                values[token_count]  = da_size(groups);
+                offsets[token_count] = group.start;
+                ++token_count;
+                da_push(groups, group);
+            }
+        }
+    }
+    result->token_count = token_count;
+    result->kinds       = kinds;
+    result->values      = values;
+    result->offsets     = offsets;
+    if (strings) {
+        result->string_count = da_size(strings);
+        result->strings      = ba_alloc_array(a, string, result->string_count);
+        memcpy(result->strings, strings, da_bytes(strings));
+        da_free(strings);
+    }
+    if (groups) {
+        result->group_count = da_size(groups);
+        result->groups      = ba_alloc_array(a, pp_token_group, result->group_count);
+        memcpy(result->groups, groups, da_bytes(groups));
+        da_free(groups);
+    }
+    // Neither EOF token nor groups are counted
+    TR_COUNT(TR_COUNTER_TOKENS_LEXED, token_count - 1 - result->group_count);
+    TR_END(TR_PHASE_LEXING);
+    return result;
+}
+
+pp_token_array *
+pp_lexer_lex_all(pp_lexer *lex, bump_allocator *a) {
+    return lex_tokens(lex, a, UINT32_MAX);
+}
+
+pp_token_array *
+pp_lexer_lex_group(pp_lexer *lex, pp_token_group *group, bump_allocator *a) {
+    lex->cursor = lex->data + group->start;
+    return lex_tokens(lex, a, group->end);
+}
+
+pp_token_group *
+pp_token_array_get_group(pp_token_array *tokens, uint32_t idx) {
+    pp_token_group *group = NULL;
+    if (tokens->kinds[idx] == PP_TOKA_GROUP) {
+        group = tokens->groups + tokens->values[idx];
+    }
+    return group;
+}
+
+void
+pp_token_array_get(pp_token_array *tokens, uint32_t idx, pp_token *tok) {
+    assert(idx < tokens->token_count);
+    uint32_t kind   = tokens->kinds[idx];
+    uint32_t value  = tokens->values[idx];
+    uint32_t offset = tokens->offsets[idx];
+
+    tok->kind           = kind & PP_TOKA_KIND_MASK;
+    tok->at_line_start  = (kind & PP_TOKA_AT_LINE_START) != 0;
+    tok->has_whitespace = (kind & PP_TOKA_HAS_WHITESPACE) != 0;
+    switch (tok->kind) {
+        INVALID_DEFAULT_CASE;
+    case PP_TOK_EOF:
+        break;
+    case PP_TOK_ID:
+        tok->ident = intern_get(value);
+        tok->str   = tok->ident->str;
+        break;
+    case PP_TOK_PUNCT:
+        tok->punct_kind = kind >> PP_TOKA_SUBKIND_SHIFT;
+        break;
+    case PP_TOK_STR:
+        tok->str_kind = kind >> PP_TOKA_SUBKIND_SHIFT;
+        if (kind & PP_TOKA_ESCAPED) {
+            tok->str = tokens->strings[value];
+        } else {
+            // Contents start after prefix and quote
+            uint32_t opener_len = get_str_opener(tok->str_kind).len;
+            tok->str            = (string){tokens->data + offset + opener_len, value};
+        }
+        break;
+    case PP_TOK_NUM:
+    case PP_TOK_OTHER:
+        tok->str = (string){tokens->data + offset, value};
+        break;
+    }
+    tok->loc = tokens->loc_base + offset;
+}
+
+uint32_t
+pp_token_array_skip_to_directive(pp_token_array *tokens, uint32_t idx) {
+    uint32_t directive = PP_TOK_PUNCT | PP_TOKA_AT_LINE_START | ('#' << PP_TOKA_SUBKIND_SHIFT);
+    while (idx + 1 < tokens->token_count &&
+           (tokens->kinds[idx] & ~PP_TOKA_HAS_WHITESPACE) != directive) {
+        ++idx;
+    }
+    return idx;
+}
+
 void
 fmt_pp_tokw(buffer_writer *w, pp_token *tok) {
     switch (tok->kind) {
@@ -555,7 +1087,7 @@ fmt_pp_tokw(buffer_writer *w, pp_token *tok) {
         if (str_opener.data) {
             char str_closer = str_opener.data[str_opener.len - 1];
             buf_write(w, "%s", str_opener.data);
-            buf_write_raw_utf8(w, tok->str.data);
+            buf_write_raw_utf8(w, tok->str.data, tok->str.len, str_closer);
             buf_write(w, "%c", str_closer);
         }
     } break;
@@ -579,8 +1111,12 @@ fmt_pp_tok(char *buf, uint32_t buf_len, pp_token *tok) {
 
 void
 fmt_pp_tok_verbosew(buffer_writer *w, pp_token *tok) {
-    buf_write(w, "%.*s:%u:%u: ", tok->loc.filename.len, tok->loc.filename.data, tok->loc.line,
-              tok->loc.col);
+    sm_location loc = sm_resolve(tok->loc);
+    string filename = {0};
+    if (loc.buffer) {
+        filename = loc.buffer->name;
+    }
+    buf_write(w, "%.*s:%u:%u: ", filename.len, filename.data, loc.line, loc.col);
     switch (tok->kind) {
         INVALID_DEFAULT_CASE;
     case PP_TOK_EOF:
@@ -611,3 +1147,12 @@ fmt_pp_tok_verbose(char *buf, uint32_t buf_len, pp_token *tok) {
     fmt_pp_tok_verbosew(&w, tok);
     return w.cursor - buf;
 }
+
+#if HOLOC_DEBUG
+char *
+debug_pp_tok(pp_token *tok) {
+    static char buf[4096];
+    fmt_pp_tok_verbose(buf, sizeof(buf), tok);
+    return buf;
+}
+#endif
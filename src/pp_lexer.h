@@ -7,6 +7,9 @@
 #include "general.h"
 
 struct buffer_writer;
+struct bump_allocator;
+struct interned_string;
+struct pp_hide_set;
 
 // Kind of token
 typedef enum {
@@ -47,10 +50,11 @@ typedef enum {
 // one, but they made different to fully differentiate between C and
 // Preprocessor tokens. In reality only two punctuators that are allowed in
 // preprocessor are not allowed in language: # and ##.
+// Values of punctuators that are shared with language are the same as in
+// c_punct_kind, so converting them to C tokens is just a cast.
 typedef enum {
-    PP_TOK_PUNCT_IRSHIFT = 0x100,  // >>=
-    PP_TOK_PUNCT_ILSHIFT = 0x101,  // <<=
-    PP_TOK_PUNCT_VARARGS = 0x102,  // ...
+    PP_TOK_PUNCT_IRSHIFT = 0x101,  // >>=
+    PP_TOK_PUNCT_ILSHIFT = 0x102,  // <<=
     PP_TOK_PUNCT_IADD    = 0x103,  // +=
     PP_TOK_PUNCT_ISUB    = 0x104,  // -=
     PP_TOK_PUNCT_IMUL    = 0x105,  // *=
@@ -69,7 +73,9 @@ typedef enum {
     PP_TOK_PUNCT_NEQ     = 0x112,  // !=
     PP_TOK_PUNCT_LEQ     = 0x113,  // <=
     PP_TOK_PUNCT_GEQ     = 0x114,  // >=
-    PP_TOK_PUNCT_DHASH   = 0x115,  // ##
+    PP_TOK_PUNCT_VARARGS = 0x115,  // ...
+    PP_TOK_PUNCT_ARROW   = 0x116,  // ->
+    PP_TOK_PUNCT_DHASH   = 0x117,  // ##
 } pp_punct_kind;
 
 // Kind of tokens returned by pp_lexer
@@ -79,25 +85,35 @@ typedef struct pp_token {
     pp_token_kind kind;
     pp_string_kind str_kind;
     pp_punct_kind punct_kind;
+    // Spelling of token. Points either to source, to interned string or to
+    // unescaped contents of string literal, which is not zero-terminated in
+    // first two cases.
     string str;
+    // If token is identifier, its interned spelling. str points to memory of
+    // interned string, so identifiers never use lexer's buffer.
+    struct interned_string *ident;
     // This information must be present to parse preprocessor directives.
     // Function-like macros are sensetive to spaces and all preprocessor
     // directives take one full source line.
     // This can also be used to make somewhat-readable printing of tokens.
     bool has_whitespace;
     bool at_line_start;
+    // Identifier was not expanded because its macro is in its hide set, so it
+    // is never expanded again
+    bool is_painted;
+    // Macros this token was produced by, see pp_hide_set.h
+    struct pp_hide_set *hide_set;
 
     source_loc loc;
-#if HOLOC_DEBUG
-    char *_debug_info;
-#endif
 } pp_token;
 
 // Structure holding state needed to process the source file at the first stage
 // Tokens returned by pp_lexer are quite similar, but different from tokens used
 // in actual source tree parsing. pp_lexer is designed to be a simple drop-in
 // solution for generating tokens, not doing any memory allocations and thus
-// being flexible to use in further file processing stage - preprocessing
+// being flexible to use in further file processing stage - preprocessing.
+// The only exception are identifiers, which are interned in global table (see
+// intern.h).
 //
 // Due to the nature of the c language, strings of all tokens produced at
 // preprocessing stage may or may not correspond to actual tokens. This is
@@ -120,14 +136,89 @@ typedef struct pp_lexer {
     char *tok_start;
     // Line number
     uint32_t line;
+    // Location of data start. Location of token is this plus offset of token
+    // in data.
+    source_loc loc_base;
 } pp_lexer;
 
+// Lines between conditional directives, which are lexed only when
+// preprocessor reaches them. pp_lexer_lex_all finds the end of group with
+// pp_lexer_skip_to_directive and stores single element for the whole group, so
+// lines excluded by conditional directives are never lexed and identifiers in
+// them are not interned.
+typedef struct pp_token_group {
+    // Offsets of group start and end in source
+    uint32_t start;
+    uint32_t end;
+    // Tokens of group, set when it is lexed, see ptc_get_group_tokens
+    struct pp_token_array *tokens;
+} pp_token_group;
+
+// Tokens of whole source in compact form. Each token takes 12 bytes, which
+// are stored in separate arrays, and is converted to pp_token only when it is
+// needed by preprocessor. This keeps memory of big translation units, where
+// all included files are lexed, low.
+//
+// Token positions are stored as offsets in source, so arrays don't depend on
+// where source is placed in location space. This allows to share them between
+// files with the same contents, see token_cache.h.
+typedef struct pp_token_array {
+    // Source that tokens were lexed from
+    char *data;
+    uint32_t token_count;
+    // Kind of token, its subkind (string or punctuator kind) and flags.
+    // See pp_lexer.c for the packing.
+    uint32_t *kinds;
+    // Depends on kind of token:
+    //  identifier - id of interned string
+    //  string literal without escape sequences, number, other - length of spelling
+    //  string literal with escape sequences - index in strings
+    uint32_t *values;
+    // Offset of token start in source. Location of token is loc_base plus
+    // offset.
+    uint32_t *offsets;
+    source_loc loc_base;
+    // Contents of string literals that contained escape sequences
+    string *strings;
+    uint32_t string_count;
+    // Groups of lines that are not lexed yet
+    pp_token_group *groups;
+    uint32_t group_count;
+} pp_token_array;
+
 // Initializes all members of lex to parse given data.
 void pp_lexer_init(pp_lexer *lex, char *data, char *eof);
 
-// Generates one new token at writes it in lexer->tok
+// Generates one new token at writes it in lexer->tok. buf is only used for
+// string literals that contain escape sequences, buf_writtenp is set to
+// non-zero value in that case.
 bool pp_lexer_parse(pp_lexer *lexer, pp_token *tok, char *buf, uint32_t buf_size,
                     uint32_t *buf_writtenp);
+// Lexes all remaining source into compact token array allocated with a. The
+// last token of array is EOF. Spellings of tokens point directly to the
+// source, so it must outlive the array. Lines following conditional directives
+// are stored as groups.
+pp_token_array *pp_lexer_lex_all(pp_lexer *lex, struct bump_allocator *a);
+// Lexes lines of group of array, which was lexed from the same source as
+// lexer is initialized with. The last token is EOF.
+pp_token_array *pp_lexer_lex_group(pp_lexer *lex, pp_token_group *group,
+                                   struct bump_allocator *a);
+// Writes full form of token with given index to tok. Element must not be a
+// group.
+void pp_token_array_get(pp_token_array *tokens, uint32_t idx, pp_token *tok);
+// Returns group if element with given index is group, NULL otherwise
+pp_token_group *pp_token_array_get_group(pp_token_array *tokens, uint32_t idx);
+// Returns index of first token starting from idx that is '#' at line start,
+// or index of EOF token if there is none. Used for skipping blocks excluded
+// by conditional directives, groups in them are passed without lexing.
+uint32_t pp_token_array_skip_to_directive(pp_token_array *tokens, uint32_t idx);
+// Skips source bytes until the start of the next line which begins with '#',
+// without producing any tokens. Comments and literals are skipped correctly,
+// so '#' inside of them is not considered. Used to find the end of groups.
+// Lexer is left right before the newline preceding the directive, so next
+// token is '#' at line start.
+// Returns false if end of file was reached.
+bool pp_lexer_skip_to_directive(pp_lexer *lex);
 // Formats token like it is seen in code
 void fmt_pp_tokw(struct buffer_writer *w, pp_token *tok);
 uint32_t fmt_pp_tok(char *buf, uint32_t buf_len, pp_token *tok);
@@ -135,6 +226,13 @@ uint32_t fmt_pp_tok(char *buf, uint32_t buf_len, pp_token *tok);
 // information
 void fmt_pp_tok_verbosew(struct buffer_writer *w, pp_token *tok);
 uint32_t fmt_pp_tok_verbose(char *buf, uint32_t buf_len, pp_token *tok);
+
+#if HOLOC_DEBUG
+// Debugger helper: formats token verbosely into static buffer and returns it.
+// Call it from debugger (p debug_pp_tok(tok)) instead of storing formatted
+// string in each token. Not reentrant.
+char *debug_pp_tok(pp_token *tok);
+#endif
 #define PP_TOK_IS_PUNCT(_tok, _punct) \
     (((_tok)->kind == PP_TOK_PUNCT) && ((_tok)->punct_kind == (_punct)))
 
@@ -0,0 +1,360 @@
+// mmap is POSIX
+#define _POSIX_C_SOURCE 200809L
+
+#include "pp_snapshot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "darray.h"
+#include "file_storage.h"
+#include "intern.h"
+#include "llist.h"
+#include "pp_lexer.h"
+#include "preprocessor.h"
+
+pp_snapshot *
+pps_capture(preprocessor *pp) {
+    pp_snapshot *snapshot = calloc(1, sizeof(pp_snapshot));
+    for (uint32_t i = 0; i < pp->macro_slot_count; ++i) {
+        if (pp->macro_slots[i].macro) {
+            da_push(snapshot->macros, pp->macro_slots[i].macro);
+        }
+    }
+    for (uint32_t i = 0; i < da_size(pp->pragma_once_marks); ++i) {
+        if (pp->pragma_once_marks[i]) {
+            da_push(snapshot->pragma_once_files, i);
+        }
+    }
+    return snapshot;
+}
+
+void
+pps_apply(pp_snapshot *snapshot, preprocessor *pp) {
+    for (uint32_t i = 0; i < da_size(snapshot->macros); ++i) {
+        pp_macro *macro = ba_alloc_struct(pp->a, pp_macro);
+        *macro          = *snapshot->macros[i];
+        pp_add_macro(pp, macro);
+    }
+    for (uint32_t i = 0; i < da_size(snapshot->pragma_once_files); ++i) {
+        pp_mark_pragma_once(pp, snapshot->pragma_once_files[i]);
+    }
+}
+
+// Records of snapshot file before they are written
+typedef struct {
+    pps_file_record *files;    // da
+    pps_macro_record *macros;  // da
+    pps_string *arg_names;     // da
+    pps_token_record *tokens;  // da
+    char *strings;             // da
+} pps_writer;
+
+static pps_string
+write_string(pps_writer *w, string str) {
+    pps_string result = {da_size(w->strings), str.len};
+    for (uint32_t i = 0; i < str.len; ++i) {
+        da_push(w->strings, str.data[i]);
+    }
+    return result;
+}
+
+static void
+write_macro(pps_writer *w, pp_macro *macro) {
+    pps_macro_record record = {0};
+    record.name             = write_string(w, macro->name->str);
+    record.kind             = macro->kind;
+    record.flags            = macro->is_variadic ? PPS_MACRO_VARIADIC : 0;
+    record.arg_count        = macro->arg_count;
+    for (pp_macro_arg *arg = macro->args; arg; arg = arg->next) {
+        da_push(w->arg_names, write_string(w, arg->name->str));
+        ++record.arg_name_count;
+    }
+    for (pp_token *tok = macro->definition; tok->kind != PP_TOK_EOF; tok = tok->next) {
+        pps_token_record tok_record = {0};
+        tok_record.kind             = tok->kind;
+        tok_record.str_kind         = tok->str_kind;
+        tok_record.punct_kind       = tok->punct_kind;
+        if (tok->has_whitespace) {
+            tok_record.flags |= PPS_TOKEN_HAS_WHITESPACE;
+        }
+        if (tok->at_line_start) {
+            tok_record.flags |= PPS_TOKEN_AT_LINE_START;
+        }
+        tok_record.str = write_string(w, tok->str);
+        da_push(w->tokens, tok_record);
+        ++record.token_count;
+    }
+    da_push(w->macros, record);
+}
+
+static void
+write_file(pps_writer *w, preprocessor *pp, string full_path, uint32_t file_idx,
+           interned_string *include_guard) {
+    pps_file_record record = {0};
+    if (include_guard) {
+        record.include_guard = write_string(w, include_guard->str);
+    }
+    if (pp_is_marked_pragma_once(pp, file_idx)) {
+        record.flags |= PPS_FILE_PRAGMA_ONCE;
+    }
+    if (include_guard || record.flags) {
+        record.path = write_string(w, full_path);
+        da_push(w->files, record);
+    }
+}
+
+static void
+write_files(pps_writer *w, preprocessor *pp) {
+    file_storage *fs = get_file_storage();
+    pthread_mutex_lock(&fs->mutex);
+    for (file *f = fs->files; f; f = f->next) {
+        write_file(w, pp, f->full_path, f->idx, fs_get_include_guard(f));
+    }
+    // Files from snapshot applied to preprocessor that were never loaded
+    for (uint32_t i = 0; i < ARRAY_SIZE(fs->hint_hash); ++i) {
+        for (fs_file_hint *hint = fs->hint_hash[i]; hint; hint = hint->next) {
+            if (!hint->f) {
+                write_file(w, pp, hint->full_path, hint->idx, hint->include_guard);
+            }
+        }
+    }
+    pthread_mutex_unlock(&fs->mutex);
+}
+
+static bool
+write_data(FILE *out, void *data, uintptr_t size) {
+    return size == 0 || fwrite(data, size, 1, out) == 1;
+}
+
+bool
+pps_write(preprocessor *pp, char *filename) {
+    pps_writer w = {0};
+    write_files(&w, pp);
+    for (uint32_t i = 0; i < pp->macro_slot_count; ++i) {
+        pp_macro *macro = pp->macro_slots[i].macro;
+        if (macro && !macro->is_builtin) {
+            write_macro(&w, macro);
+        }
+    }
+
+    pps_header header = {0};
+    memcpy(header.magic, PPS_MAGIC, sizeof(header.magic));
+    header.version      = PPS_VERSION;
+    header.file_count   = da_size(w.files);
+    header.macro_count  = da_size(w.macros);
+    header.arg_count    = da_size(w.arg_names);
+    header.token_count  = da_size(w.tokens);
+    header.strings_size = da_size(w.strings);
+
+    bool result = false;
+    FILE *out   = fopen(filename, "wb");
+    if (out) {
+        result = write_data(out, &header, sizeof(header)) &&
+                 write_data(out, w.files, da_bytes(w.files)) &&
+                 write_data(out, w.macros, da_bytes(w.macros)) &&
+                 write_data(out, w.arg_names, da_bytes(w.arg_names)) &&
+                 write_data(out, w.tokens, da_bytes(w.tokens)) &&
+                 write_data(out, w.strings, da_bytes(w.strings));
+        result = fclose(out) == 0 && result;
+    }
+
+    da_free(w.files);
+    da_free(w.macros);
+    da_free(w.arg_names);
+    da_free(w.tokens);
+    da_free(w.strings);
+    return result;
+}
+
+static string
+map_snapshot_file(char *filename) {
+    string result = {0};
+    int fd        = open(filename, O_RDONLY);
+    if (fd != -1) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size != 0) {
+            void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                result = (string){data, st.st_size};
+            }
+        }
+        close(fd);
+    }
+    return result;
+}
+
+// Checks that header is valid and sizes of all parts add up to size of file
+static bool
+is_header_valid(string mapping) {
+    bool result = false;
+    if (mapping.len >= sizeof(pps_header)) {
+        pps_header *header = (pps_header *)mapping.data;
+        uint64_t size      = sizeof(pps_header);
+        size += (uint64_t)header->file_count * sizeof(pps_file_record);
+        size += (uint64_t)header->macro_count * sizeof(pps_macro_record);
+        size += (uint64_t)header->arg_count * sizeof(pps_string);
+        size += (uint64_t)header->token_count * sizeof(pps_token_record);
+        size += header->strings_size;
+        result = memcmp(header->magic, PPS_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->version == PPS_VERSION && size == mapping.len;
+    }
+    return result;
+}
+
+// Parts of mapped snapshot file
+typedef struct {
+    pps_header *header;
+    pps_file_record *files;
+    pps_macro_record *macros;
+    pps_string *arg_names;
+    pps_token_record *tokens;
+    char *strings;
+} pps_reader;
+
+static bool
+read_string(pps_reader *r, pps_string str, string *resultp) {
+    bool result = str.offset <= r->header->strings_size &&
+                  str.len <= r->header->strings_size - str.offset;
+    if (result) {
+        *resultp = (string){r->strings + str.offset, str.len};
+    }
+    return result;
+}
+
+static bool
+read_ident(pps_reader *r, pps_string str, interned_string **resultp) {
+    string ident = {0};
+    bool result  = read_string(r, str, &ident) && ident.len;
+    if (result) {
+        *resultp = intern_string(ident);
+    }
+    return result;
+}
+
+static bool
+read_token(pps_reader *r, pps_token_record *record, pp_token *tok) {
+    bool result = record->kind >= PP_TOK_ID && record->kind <= PP_TOK_OTHER;
+    if (result) {
+        tok->kind           = record->kind;
+        tok->str_kind       = record->str_kind;
+        tok->punct_kind     = record->punct_kind;
+        tok->has_whitespace = (record->flags & PPS_TOKEN_HAS_WHITESPACE) != 0;
+        tok->at_line_start  = (record->flags & PPS_TOKEN_AT_LINE_START) != 0;
+        if (tok->kind == PP_TOK_ID) {
+            result = read_ident(r, record->str, &tok->ident);
+            if (result) {
+                tok->str = tok->ident->str;
+            }
+        } else {
+            result = read_string(r, record->str, &tok->str);
+        }
+    }
+    return result;
+}
+
+static bool
+read_macros(pps_reader *r, pp_snapshot *snapshot) {
+    bool result        = true;
+    uint32_t arg_idx   = 0;
+    uint32_t token_idx = 0;
+    for (uint32_t macro_idx = 0; macro_idx < r->header->macro_count && result; ++macro_idx) {
+        pps_macro_record *record = r->macros + macro_idx;
+        result = record->kind >= PP_MACRO_OBJ && record->kind <= PP_MACRO_INCLUDE_LEVEL &&
+                 record->arg_name_count <= r->header->arg_count - arg_idx &&
+                 record->token_count <= r->header->token_count - token_idx;
+        pp_macro *macro = ba_alloc_struct(&snapshot->a, pp_macro);
+        if (result) {
+            result = read_ident(r, record->name, &macro->name);
+        }
+        if (result) {
+            macro->kind        = record->kind;
+            macro->is_variadic = (record->flags & PPS_MACRO_VARIADIC) != 0;
+            macro->arg_count   = record->arg_count;
+        }
+
+        linked_list_constructor args = {0};
+        for (uint32_t i = 0; i < record->arg_name_count && result; ++i) {
+            pp_macro_arg *arg = ba_alloc_struct(&snapshot->a, pp_macro_arg);
+            result            = read_ident(r, r->arg_names[arg_idx++], &arg->name);
+            LLISTC_ADD_LAST(&args, arg);
+        }
+        macro->args = args.first;
+
+        linked_list_constructor def = {0};
+        for (uint32_t i = 0; i < record->token_count && result; ++i) {
+            pp_token *tok = ba_alloc_struct(&snapshot->a, pp_token);
+            result        = read_token(r, r->tokens + token_idx++, tok);
+            LLISTC_ADD_LAST(&def, tok);
+        }
+        pp_token *eof = ba_alloc_struct(&snapshot->a, pp_token);
+        eof->kind     = PP_TOK_EOF;
+        LLISTC_ADD_LAST(&def, eof);
+        macro->definition = def.first;
+        // Errors were reported when snapshot was written
+        if (result) {
+            pp_compile_macro(macro, &snapshot->a, false);
+        }
+
+        da_push(snapshot->macros, macro);
+    }
+    return result;
+}
+
+// Restores state of files. Files are not loaded here, their state is applied
+// when they are first included.
+static bool
+read_files(pps_reader *r, pp_snapshot *snapshot) {
+    bool result = true;
+    for (uint32_t file_idx = 0; file_idx < r->header->file_count && result; ++file_idx) {
+        pps_file_record *record        = r->files + file_idx;
+        string path                    = {0};
+        interned_string *include_guard = NULL;
+        result                         = read_string(r, record->path, &path) && path.len;
+        if (result && record->include_guard.len) {
+            result = read_ident(r, record->include_guard, &include_guard);
+        }
+        if (result) {
+            bool has_pragma_once = (record->flags & PPS_FILE_PRAGMA_ONCE) != 0;
+            uint32_t idx         = fs_add_file_hint(path, include_guard, has_pragma_once);
+            if (has_pragma_once) {
+                da_push(snapshot->pragma_once_files, idx);
+            }
+        }
+    }
+    return result;
+}
+
+pp_snapshot *
+pps_load(char *filename) {
+    pp_snapshot *snapshot = NULL;
+    string mapping        = map_snapshot_file(filename);
+    if (mapping.data && is_header_valid(mapping)) {
+        pps_reader r = {0};
+        r.header     = (pps_header *)mapping.data;
+        r.files      = (pps_file_record *)(r.header + 1);
+        r.macros     = (pps_macro_record *)(r.files + r.header->file_count);
+        r.arg_names  = (pps_string *)(r.macros + r.header->macro_count);
+        r.tokens     = (pps_token_record *)(r.arg_names + r.header->arg_count);
+        r.strings    = (char *)(r.tokens + r.header->token_count);
+
+        snapshot          = calloc(1, sizeof(pp_snapshot));
+        snapshot->mapping = mapping;
+        if (!read_macros(&r, snapshot) || !read_files(&r, snapshot)) {
+            ba_free(&snapshot->a);
+            da_free(snapshot->macros);
+            da_free(snapshot->pragma_once_files);
+            free(snapshot);
+            snapshot = NULL;
+        }
+    }
+    if (!snapshot && mapping.data) {
+        munmap(mapping.data, mapping.len);
+    }
+    return snapshot;
+}
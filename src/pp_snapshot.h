@@ -0,0 +1,116 @@
+// Snapshots of preprocessor macro state. Snapshot is taken after some prefix
+// of translation unit (like common header included by every source file) is
+// processed, and then applied to new preprocessors, so that each translation
+// unit starts with macros already defined instead of processing the prefix
+// again.
+//
+// Snapshot can be saved to file and loaded in other run, which works like
+// lightweight precompiled header. File is mapped to memory, and strings of
+// tokens point into the mapping, so loading only interns identifiers and
+// builds token lists.
+//
+// Definitions of macros are never modified by preprocessor, so they are shared
+// by all preprocessors the snapshot is applied to. Only macro structures are
+// copied, as they are linked into macro table of preprocessor.
+//
+// File format is specific to this build of compiler: records are written in
+// native byte order, and kinds of tokens are stored as they are.
+#ifndef PP_SNAPSHOT_H
+#define PP_SNAPSHOT_H
+
+#include "general.h"
+
+#include "bump_allocator.h"
+
+#define PPS_MAGIC "HOLOPCH1"
+#define PPS_VERSION 1
+
+struct preprocessor;
+struct pp_macro;
+
+typedef struct pp_snapshot {
+    // Memory for macros and tokens of loaded snapshot
+    bump_allocator a;
+    struct pp_macro **macros;  // da
+    // Indices of files that were marked with #pragma once. Files of loaded
+    // snapshot may be not loaded yet, see fs_add_file_hint.
+    uint32_t *pragma_once_files;  // da
+    // Contents of loaded file. Spellings of tokens point into it.
+    string mapping;
+} pp_snapshot;
+
+// Header of snapshot file. All records are made of 32-bit words, so that
+// they are aligned in mapped file. Strings are stored as offset and length in
+// string block, which goes after all records.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t macro_count;
+    uint32_t arg_count;
+    uint32_t token_count;
+    uint32_t strings_size;
+} pps_header;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} pps_string;
+
+typedef enum {
+    PPS_FILE_PRAGMA_ONCE = 0x1,
+} pps_file_flags;
+
+// File that was included while snapshot was taken. Files are recorded so that
+// they are not processed again: their include guards are already known, and
+// #pragma once files are not included at all.
+typedef struct {
+    pps_string path;
+    // Empty if file has no include guard
+    pps_string include_guard;
+    uint32_t flags;
+} pps_file_record;
+
+typedef enum {
+    PPS_MACRO_VARIADIC = 0x1,
+} pps_macro_flags;
+
+// Macro. Its names of arguments and tokens of definition (without EOF)
+// follow in order of macros in their own arrays.
+typedef struct {
+    pps_string name;
+    uint32_t kind;
+    uint32_t flags;
+    // Value of pp_macro arg_count, which doesn't count __VA_ARGS__
+    uint32_t arg_count;
+    uint32_t arg_name_count;
+    uint32_t token_count;
+} pps_macro_record;
+
+typedef enum {
+    PPS_TOKEN_HAS_WHITESPACE = 0x1,
+    PPS_TOKEN_AT_LINE_START  = 0x2,
+} pps_token_flags;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t str_kind;
+    uint32_t punct_kind;
+    uint32_t flags;
+    pps_string str;
+} pps_token_record;
+
+// Makes snapshot of macros defined in preprocessor. Snapshot shares memory
+// with preprocessor, so it must not be used after preprocessor is freed.
+pp_snapshot *pps_capture(struct preprocessor *pp);
+// Writes macros defined in preprocessor to file. Builtin macros are not
+// written, as they are defined in every translation unit anyway. Returns
+// false on failure.
+bool pps_write(struct preprocessor *pp, char *filename);
+// Loads snapshot from file written by pps_write. Returns NULL if file can't
+// be read or is not valid snapshot.
+pp_snapshot *pps_load(char *filename);
+// Defines macros of snapshot in preprocessor, replacing existing ones
+void pps_apply(pp_snapshot *snapshot, struct preprocessor *pp);
+
+#endif
@@ -5,113 +5,590 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "buffer_writer.h"
+#include "bump_allocator.h"
+#include "error_reporter.h"
 #include "file_storage.h"
+#include "intern.h"
 #include "llist.h"
+#include "pp_hide_set.h"
 #include "pp_lexer.h"
+#include "preprocessor.h"
+#include "source_manager.h"
 #include "str.h"
+#include "token_cache.h"
+#include "trace.h"
 
-void
-ppti_include_file(pp_token_iter *it, string filename) {
-    file *current_file = NULL;
+pp_token *
+ppti_new_tok(pp_token_iter *it) {
+    pp_token *tok = *it->tok_freelist;
+    if (tok) {
+        *it->tok_freelist = tok->next;
+        memset(tok, 0, sizeof(pp_token));
+    } else {
+        tok = ba_alloc_struct(it->a, pp_token);
+    }
+    return tok;
+}
+
+pp_token *
+ppti_copy_tok(pp_token_iter *it, pp_token *tok) {
+    pp_token *new_tok = ppti_new_tok(it);
+    memcpy(new_tok, tok, sizeof(pp_token));
+    new_tok->next = NULL;
+    return new_tok;
+}
+
+file *
+ppti_current_file(pp_token_iter *it) {
+    file *f = NULL;
     for (ppti_entry *e = it->it; e; e = e->next) {
         if (e->f) {
-            current_file = e->f;
+            f = e->f;
             break;
         }
     }
+    return f;
+}
 
-    file *f = fs_get_file(filename, current_file);
-    if (!f) {
-        NOT_IMPL;
+void
+ppti_include_file(pp_token_iter *it, file *f) {
+    tc_begin(TC_TRACK_PREPROCESSOR, f->name, f->full_path);
+    ppti_entry *entry = ba_alloc_struct(it->a, ppti_entry);
+    entry->f          = f;
+    // There is no need to check for include guard if it is already known
+    if (!fs_get_include_guard(f)) {
+        entry->guard_state = PPTI_GUARD_START;
     }
 
-    ppti_entry *entry = calloc(1, sizeof(ppti_entry));
-    entry->f          = f;
-    entry->lexer      = calloc(1, sizeof(pp_lexer));
-    pp_lexer_init(entry->lexer, f->contents.data, STRING_END(f->contents));
+    entry->file_tokens = ptc_get_file_tokens(f);
     LLIST_ADD(it->it, entry);
 }
 
+// Advances include guard detection state with token lexed from file of entry
+static void
+update_include_guard(ppti_entry *e, pp_token *tok) {
+    bool is_hash    = PP_TOK_IS_PUNCT(tok, '#') && tok->at_line_start;
+    bool after_hash = e->guard_after_hash;
+    e->guard_after_hash = false;
+    switch (e->guard_state) {
+    case PPTI_GUARD_NONE:
+        break;
+    case PPTI_GUARD_START:
+        e->guard_state = is_hash ? PPTI_GUARD_HASH : PPTI_GUARD_NONE;
+        break;
+    case PPTI_GUARD_HASH:
+        e->guard_state = PPTI_GUARD_NONE;
+        if (tok->kind == PP_TOK_ID) {
+            if (tok->ident->pp_kind == PP_IDENT_IFNDEF) {
+                e->guard_state = PPTI_GUARD_IFNDEF;
+            } else if (tok->ident->pp_kind == PP_IDENT_IF) {
+                e->guard_state = PPTI_GUARD_IF;
+            }
+        }
+        break;
+    case PPTI_GUARD_IF:
+        e->guard_state = PP_TOK_IS_PUNCT(tok, '!') ? PPTI_GUARD_IF_NOT : PPTI_GUARD_NONE;
+        break;
+    case PPTI_GUARD_IF_NOT:
+        e->guard_state = PPTI_GUARD_NONE;
+        if (tok->kind == PP_TOK_ID && tok->ident->pp_kind == PP_IDENT_DEFINED) {
+            e->guard_state = PPTI_GUARD_DEFINED;
+        }
+        break;
+    case PPTI_GUARD_DEFINED:
+        if (PP_TOK_IS_PUNCT(tok, '(')) {
+            e->guard_state = PPTI_GUARD_DEFINED_PAREN;
+            break;
+        }
+        // fallthrough
+    case PPTI_GUARD_IFNDEF:
+    case PPTI_GUARD_DEFINED_PAREN:
+        if (tok->kind == PP_TOK_ID && !tok->at_line_start) {
+            e->guard_name  = tok->ident;
+            e->guard_state = e->guard_state == PPTI_GUARD_DEFINED_PAREN ? PPTI_GUARD_NAME_PAREN
+                                                                        : PPTI_GUARD_NAME;
+        } else {
+            e->guard_state = PPTI_GUARD_NONE;
+        }
+        break;
+    case PPTI_GUARD_NAME_PAREN:
+        e->guard_state = PP_TOK_IS_PUNCT(tok, ')') ? PPTI_GUARD_NAME : PPTI_GUARD_NONE;
+        break;
+    case PPTI_GUARD_NAME:
+        if (!tok->at_line_start) {
+            e->guard_state = PPTI_GUARD_NONE;
+            break;
+        }
+        e->guard_state = PPTI_GUARD_BODY;
+        e->guard_depth = 1;
+        // fallthrough
+    case PPTI_GUARD_BODY:
+        if (is_hash) {
+            e->guard_after_hash = true;
+        } else if (after_hash && tok->kind == PP_TOK_ID) {
+            switch (tok->ident->pp_kind) {
+            default:
+                break;
+            case PP_IDENT_IF:
+            case PP_IDENT_IFDEF:
+            case PP_IDENT_IFNDEF:
+                ++e->guard_depth;
+                break;
+            case PP_IDENT_ELIF:
+            case PP_IDENT_ELSE:
+                if (e->guard_depth == 1) {
+                    e->guard_state = PPTI_GUARD_NONE;
+                }
+                break;
+            case PP_IDENT_ENDIF:
+                if (!--e->guard_depth) {
+                    e->guard_state = PPTI_GUARD_ENDIF;
+                }
+                break;
+            }
+        }
+        break;
+    case PPTI_GUARD_ENDIF:
+        e->guard_state = PPTI_GUARD_NONE;
+        break;
+    }
+}
+
+// Returns zero-initialized entry that is not a file. Argument arrays, group
+// tokens and view of reused entries are kept.
+static ppti_entry *
+new_entry(pp_token_iter *it) {
+    ppti_entry *e = it->entry_freelist;
+    if (e) {
+        LLIST_POP(it->entry_freelist);
+        pp_token **args              = e->args;
+        pp_token **expanded_args     = e->expanded_args;
+        uint32_t arg_capacity        = e->arg_capacity;
+        pp_token_array *group_tokens = e->group_tokens;
+        pp_token *view               = e->view;
+        memset(e, 0, sizeof(ppti_entry));
+        e->args          = args;
+        e->expanded_args = expanded_args;
+        e->arg_capacity  = arg_capacity;
+        e->group_tokens  = group_tokens;
+        e->view          = view;
+    } else {
+        e = ba_alloc_struct(it->a, ppti_entry);
+    }
+    return e;
+}
+
 void
 ppti_insert_tok_list(pp_token_iter *it, pp_token *first, pp_token *last) {
     assert(first && last);
 
     ppti_entry *e = it->it;
     if (!e) {
-        e = calloc(1, sizeof(ppti_entry));
+        e = new_entry(it);
         LLIST_ADD(it->it, e);
     }
 
+    // View comes before token list, so it has to become its part
+    if (e->has_view) {
+        pp_token *tok = ppti_copy_tok(it, e->view);
+        tok->next     = e->token_list;
+        e->token_list = tok;
+        e->has_view   = false;
+    }
     last->next    = e->token_list;
     e->token_list = first;
 }
 
-pp_token *
-ppti_peek_forward(pp_token_iter *it, uint32_t count) {
-    pp_token *tok = NULL;
+void
+ppti_push_tok_refs(pp_token_iter *it, pp_token *first) {
+    ppti_entry *e = new_entry(it);
+    e->ref_tok    = first;
+    LLIST_ADD(it->it, e);
+}
+
+static void
+free_tok_list(pp_token_iter *it, pp_token *tok) {
+    while (tok) {
+        pp_token *next = tok->next;
+        LLIST_ADD(*it->tok_freelist, tok);
+        tok = next;
+    }
+}
+
+// Removes top entry from the stack. Entry of macro expansion gives tokens of
+// its arguments back to freelist. Entries that are not files are kept for
+// reuse.
+static void
+pop_entry(pp_token_iter *it) {
     ppti_entry *e = it->it;
-    if (e) {
-        uint32_t idx    = 0;
-        pp_token **tokp = &e->token_list;
-        for (;;) {
-            // First, skip tokens that are already in tokens list
-            while (*tokp && (*tokp)->next && idx != count) {
-                tokp = &(*tokp)->next;
-                ++idx;
-            }
+    assert(!e->token_list && !e->has_view);
+    it->it = e->next;
+    for (uint32_t arg_idx = 0; arg_idx < e->arg_count; ++arg_idx) {
+        free_tok_list(it, e->args[arg_idx]);
+        free_tok_list(it, e->expanded_args[arg_idx]);
+    }
+    // Entries of files are left in allocator.
+    if (!e->f) {
+        LLIST_ADD(it->entry_freelist, e);
+    }
+}
 
-            if (*tokp && count == idx) {
-                break;
+void
+ppti_clear(pp_token_iter *it) {
+    while (it->it) {
+        free_tok_list(it, it->it->token_list);
+        it->it->token_list = NULL;
+        it->it->has_view   = false;
+        pop_entry(it);
+    }
+}
+
+// Pops expansions that have no tokens left from the top of the stack
+static void
+pop_finished_expansions(pp_token_iter *it) {
+    ppti_entry *e = it->it;
+    while (e && e->macro && !e->token_list && !e->has_view &&
+           e->op_idx == e->macro->op_count) {
+        pop_entry(it);
+        e = it->it;
+    }
+}
+
+void
+ppti_push_expansion(pp_token_iter *it, pp_macro *macro, pp_token **args,
+                    pp_token **expanded_args, uint32_t arg_count, pp_hide_set *hide_set,
+                    source_loc invocation) {
+    // Number of produced tokens is not known until pastes are done, so
+    // expansion range is given out for its upper bound.
+    uint32_t count = 0;
+    for (uint32_t op_idx = 0; op_idx < macro->op_count; ++op_idx) {
+        pp_macro_op *op = macro->ops + op_idx;
+        if (op->kind == PP_MACRO_OP_PARAM || op->kind == PP_MACRO_OP_UNEXPANDED_PARAM) {
+            pp_token **arg_toks = op->kind == PP_MACRO_OP_PARAM ? expanded_args : args;
+            for (pp_token *tok = arg_toks[op->param_idx]; tok; tok = tok->next) {
+                ++count;
             }
+        } else {
+            ++count;
+        }
+    }
 
-            if (!e || !e->lexer) {
-                break;
+    pop_finished_expansions(it);
+    ppti_entry *e = new_entry(it);
+    if (e->arg_capacity < arg_count) {
+        e->args          = ba_alloc_array(it->a, pp_token *, arg_count);
+        e->expanded_args = ba_alloc_array(it->a, pp_token *, arg_count);
+        e->arg_capacity  = arg_count;
+    }
+    if (arg_count) {
+        memcpy(e->args, args, arg_count * sizeof(*args));
+        memcpy(e->expanded_args, expanded_args, arg_count * sizeof(*expanded_args));
+    }
+    e->arg_count = arg_count;
+    e->macro     = macro;
+    e->hide_set  = hide_set;
+    e->next_loc  = count ? sm_add_expansion(invocation, count) : invocation;
+    LLIST_ADD(it->it, e);
+}
+
+// Writes string literal made from tokens of argument (#) to tok. Whitespace
+// between tokens becomes single space. Value of literal is spelling of
+// tokens, so '"' and '\' of string and character literals are escaped when
+// it is spelled.
+static void
+stringify_tokens(pp_token_iter *it, pp_token *first, pp_token *tok) {
+    char buffer[4096];
+    buffer_writer w = {buffer, buffer + sizeof(buffer)};
+    for (pp_token *arg_tok = first; arg_tok; arg_tok = arg_tok->next) {
+        if (arg_tok != first && (arg_tok->has_whitespace || arg_tok->at_line_start)) {
+            buf_write(&w, " ");
+        }
+        fmt_pp_tokw(&w, arg_tok);
+    }
+
+    memset(tok, 0, sizeof(pp_token));
+    tok->kind     = PP_TOK_STR;
+    tok->str      = ba_string_dup(it->a, (string){buffer, w.cursor - buffer});
+    tok->str_kind = PP_TOK_STR_SCHAR;
+}
+
+// Pastes spelling of rhs to lhs (##). Result is written to lhs, and rhs is
+// left unchanged. Returns false if result is not a single token.
+static bool
+paste_tokens(pp_token_iter *it, pp_token *lhs, pp_token *rhs) {
+    char buffer[4096];
+    buffer_writer w = {buffer, buffer + sizeof(buffer)};
+    fmt_pp_tokw(&w, lhs);
+    fmt_pp_tokw(&w, rhs);
+
+    pp_lexer lex;
+    pp_lexer_init(&lex, buffer, w.cursor);
+    char str_buf[4096];
+    uint32_t str_len = 0;
+    pp_token tok     = {0};
+    pp_lexer_parse(&lex, &tok, str_buf, sizeof(str_buf), &str_len);
+    char end_buf[4096];
+    pp_token end = {0};
+    pp_lexer_parse(&lex, &end, end_buf, sizeof(end_buf), &str_len);
+
+    bool result = tok.kind != PP_TOK_EOF && end.kind == PP_TOK_EOF;
+    if (result) {
+        // Spelling points to local buffers
+        if (tok.kind != PP_TOK_ID) {
+            tok.str = ba_string_dup(it->a, tok.str);
+        }
+        tok.next           = lhs->next;
+        tok.hide_set       = lhs->hide_set;
+        tok.has_whitespace = lhs->has_whitespace;
+        tok.at_line_start  = lhs->at_line_start;
+        tok.loc            = lhs->loc;
+        *lhs               = tok;
+    }
+    return result;
+}
+
+// Moves position of expansion to the next token, skipping ops of empty
+// arguments. Returns false if expansion has ended.
+static bool
+seek_expansion_token(ppti_entry *e) {
+    pp_macro *macro = e->macro;
+    bool result     = false;
+    while (e->op_idx < macro->op_count) {
+        pp_macro_op *op = macro->ops + e->op_idx;
+        if (op->kind == PP_MACRO_OP_PARAM || op->kind == PP_MACRO_OP_UNEXPANDED_PARAM) {
+            if (!e->arg_tok) {
+                pp_token **arg_toks = op->kind == PP_MACRO_OP_PARAM ? e->expanded_args : e->args;
+                e->arg_tok          = arg_toks[op->param_idx];
             }
+            if (!e->arg_tok) {
+                ++e->op_idx;
+                continue;
+            }
+        }
+        result = true;
+        break;
+    }
+    return result;
+}
 
-            char buf[4096];
-            uint32_t buf_len = 0;
-            // Try to use lexer.
-            pp_token local_tok = {0};
-            bool not_eof = pp_lexer_parse(e->lexer, &local_tok, buf, sizeof(buf), &buf_len);
-            // If lexer produces eof, meaning it has reached its end, we must
-            // skip to the next stack entry.
-            if (!not_eof) {
-                e = e->next;
-                if (e) {
-                    tokp = &e->token_list;
-                }
+// Writes token at position of expansion to tok. Token is made from token of
+// definition or argument, with hide set of expansion added.
+static void
+get_expansion_token(pp_token_iter *it, ppti_entry *e, pp_token *tok) {
+    pp_macro_op *op = e->macro->ops + e->op_idx;
+    switch (op->kind) {
+        INVALID_DEFAULT_CASE;
+    case PP_MACRO_OP_TOKEN:
+        *tok          = *op->tok;
+        tok->hide_set = e->hide_set;
+        break;
+    case PP_MACRO_OP_PARAM:
+    case PP_MACRO_OP_UNEXPANDED_PARAM:
+        *tok          = *e->arg_tok;
+        tok->hide_set = pphs_union(it->hide_sets, e->arg_tok->hide_set, e->hide_set);
+        break;
+    case PP_MACRO_OP_STRINGIFY:
+        stringify_tokens(it, e->args[op->param_idx], tok);
+        tok->hide_set = e->hide_set;
+        break;
+    }
+    tok->next = NULL;
+}
+
+// Moves position of expansion past its current token. Returns true if it was
+// the last token of its op.
+static bool
+advance_expansion(ppti_entry *e) {
+    pp_macro_op *op = e->macro->ops + e->op_idx;
+    bool is_last    = true;
+    if (op->kind == PP_MACRO_OP_PARAM || op->kind == PP_MACRO_OP_UNEXPANDED_PARAM) {
+        e->arg_tok = e->arg_tok->next;
+        is_last    = !e->arg_tok;
+    }
+    if (is_last) {
+        ++e->op_idx;
+    }
+    return is_last;
+}
+
+// Writes next token of macro expansion to tok. Tokens of definition and
+// arguments are not copied before they are needed, and position of expansion
+// is op and token of argument. If the last token of op is followed by '##',
+// tokens are pasted here, so pasted token is complete before it is read.
+// Returns false if expansion has ended.
+static bool
+produce_expansion_token(pp_token_iter *it, ppti_entry *e, pp_token *tok) {
+    pp_macro *macro = e->macro;
+    bool result     = seek_expansion_token(e);
+    if (result) {
+        get_expansion_token(it, e, tok);
+        bool is_last = advance_expansion(e);
+        while (is_last && e->op_idx < macro->op_count && macro->ops[e->op_idx].is_pasted) {
+            // Empty argument produces no tokens, so token is pasted to the
+            // next op instead
+            pp_macro_op *op = macro->ops + e->op_idx;
+            if (op->kind == PP_MACRO_OP_UNEXPANDED_PARAM && !e->args[op->param_idx]) {
+                ++e->op_idx;
                 continue;
             }
 
-            pp_token *new_tok = calloc(1, sizeof(pp_token));
-            memcpy(new_tok, &local_tok, sizeof(pp_token));
-            new_tok->loc.filename = e->f->name;
-            if (buf_len) {
-                new_tok->str = string_dup(new_tok->str);
+            seek_expansion_token(e);
+            pp_token rhs = {0};
+            get_expansion_token(it, e, &rhs);
+            if (!paste_tokens(it, tok, &rhs)) {
+                // Right operand is left as the next token
+                report_error(e->next_loc, "Pasting does not give a valid preprocessing token");
+                break;
             }
+            is_last = advance_expansion(e);
+        }
+        tok->loc = e->next_loc++;
+    }
+    return result;
+}
+
+// Writes next token of list that entry reads by reference to tok
+static bool
+produce_ref_token(ppti_entry *e, pp_token *tok) {
+    bool result = e->ref_tok != NULL;
+    if (result) {
+        *tok       = *e->ref_tok;
+        tok->next  = NULL;
+        e->ref_tok = e->ref_tok->next;
+    }
+    return result;
+}
+
+// Makes entry for group of lines of file or group entry. Entry of group must
+// be placed right above it, and tokens that were peeked from it are moved to
+// the group entry, as they come before tokens of group.
+static ppti_entry *
+new_group_entry(pp_token_iter *it, ppti_entry *e, pp_token_group *group) {
+    ppti_entry *g = new_entry(it);
+    if (!g->group_tokens) {
+        g->group_tokens = ba_alloc_struct(it->a, pp_token_array);
+    }
+    ptc_get_group_tokens(e->file_tokens, group, g->group_tokens);
+    g->file_tokens = g->group_tokens;
+    g->token_list  = e->token_list;
+    e->token_list  = NULL;
+    return g;
+}
+
+// Produces next token of file or group
+static pp_token *
+produce_file_token(pp_token_iter *it, ppti_entry *e) {
+    pp_token *tok = NULL;
+    // EOF token is the last one in array, and it is left in place.
+    if (e->file_token_idx + 1 == e->file_tokens->token_count) {
+        if (e->guard_state == PPTI_GUARD_ENDIF) {
+            fs_set_include_guard(e->f, e->guard_name);
+        }
+        e->guard_state = PPTI_GUARD_NONE;
+        if (e->f && !e->is_at_end) {
+            e->is_at_end = true;
+            tc_end(TC_TRACK_PREPROCESSOR);
+        }
+    } else {
+        tok = ppti_new_tok(it);
+        pp_token_array_get(e->file_tokens, e->file_token_idx++, tok);
+        update_include_guard(e, tok);
+    }
+    return tok;
+}
+
+void
+ppti_skip_to_directive(pp_token_iter *it) {
+    pop_finished_expansions(it);
+    ppti_entry *e = it->it;
+    if (e && !e->token_list && e->file_tokens) {
+        e->file_token_idx =
+            pp_token_array_skip_to_directive(e->file_tokens, e->file_token_idx);
+    }
+}
+
+// Returns view of entry, which is allocated when entry yields by reference
+// for the first time
+static pp_token *
+get_view(pp_token_iter *it, ppti_entry *e) {
+    if (!e->view) {
+        e->view = ba_alloc_struct(it->a, pp_token);
+    }
+    return e->view;
+}
 
-#if HOLOC_DEBUG
-            {
-                char buffer[4096];
-                uint32_t len     = fmt_pp_tok_verbose(buffer, sizeof(buffer), new_tok);
-                char *debug_info = malloc(len + 1);
-                memcpy(debug_info, buffer, len + 1);
-                new_tok->_debug_info = debug_info;
+pp_token *
+ppti_peek_forward(pp_token_iter *it, uint32_t count) {
+    pp_token *tok     = NULL;
+    uint32_t idx      = 0;
+    ppti_entry **link = &it->it;
+    for (ppti_entry *e = *link; e && !tok; link = &e->next, e = *link) {
+        // View comes before the token list
+        if (e->has_view) {
+            if (idx == count) {
+                tok = e->view;
+                break;
             }
-#endif
+            ++idx;
+        }
 
-            if (*tokp) {
-                assert(!(*tokp)->next);
-                (*tokp)->next = new_tok;
-                tokp          = &(*tokp)->next;
+        pp_token **tokp = &e->token_list;
+        for (;;) {
+            // First, skip tokens that are already in tokens list
+            while (*tokp && idx != count) {
+                tokp = &(*tokp)->next;
                 ++idx;
-            } else {
-                *tokp = new_tok;
             }
-        }
+            if (*tokp) {
+                tok = *tokp;
+                break;
+            }
 
-        if (idx == count) {
-            tok = *tokp;
+            // When entry has no more tokens, we must skip to the next one
+            pp_token *new_toks = NULL;
+            if (e->macro || e->ref_tok) {
+                // Token is yielded by reference if it is the first one of
+                // entry. Tokens after it are only peeked ahead, and are copied.
+                bool is_view      = !e->has_view && !e->token_list;
+                pp_token *new_tok = is_view ? get_view(it, e) : ppti_new_tok(it);
+                bool is_produced  = e->macro ? produce_expansion_token(it, e, new_tok)
+                                             : produce_ref_token(e, new_tok);
+                if (!is_produced) {
+                    if (!is_view) {
+                        LLIST_ADD(*it->tok_freelist, new_tok);
+                    }
+                } else if (is_view) {
+                    e->has_view = true;
+                    if (idx == count) {
+                        tok = new_tok;
+                        break;
+                    }
+                    ++idx;
+                    continue;
+                } else {
+                    new_toks = new_tok;
+                }
+            } else if (e->file_tokens) {
+                pp_token_group *group =
+                    pp_token_array_get_group(e->file_tokens, e->file_token_idx);
+                if (group) {
+                    ++e->file_token_idx;
+                    ppti_entry *g = new_group_entry(it, e, group);
+                    if (tokp == &e->token_list) {
+                        tokp = &g->token_list;
+                    }
+                    g->next = e;
+                    *link   = g;
+                    e       = g;
+                    continue;
+                }
+                new_toks = produce_file_token(it, e);
+            }
+            if (!new_toks) {
+                break;
+            }
+            *tokp = new_toks;
         }
     }
 
@@ -133,26 +610,46 @@ ppti_eat_multiple(pp_token_iter *it, uint32_t count) {
     }
 }
 
+// Removes next token from stream. Returns true if it was view of entry, which
+// is not owned by user.
+static bool
+unlink_next(pp_token_iter *it, pp_token *tok) {
+    // Entries that have no tokens left were passed by peek, so token is in the
+    // first entry that has any
+    while (!it->it->has_view && !it->it->token_list) {
+        pop_entry(it);
+    }
+    ppti_entry *e = it->it;
+    bool is_view  = e->has_view;
+    if (is_view) {
+        assert(e->view == tok);
+        e->has_view = false;
+    } else {
+        assert(e->token_list == tok);
+        LLIST_POP(e->token_list);
+        tok->next = NULL;
+    }
+    return is_view;
+}
+
 void
 ppti_eat(pp_token_iter *it) {
     // TODO: Do we want to return success status here?
-    ppti_entry *e = it->it;
-    if (e) {
-        pp_token *tok = e->token_list;
-        if (tok) {
-            LLIST_POP(e->token_list);
-            free(tok);
-        } else {
-            if (e->lexer) {
-                free(e->lexer);
-            }
-            it->it = e->next;
-            free(e);
-            ppti_eat(it);
-        }
+    pp_token *tok = ppti_peek(it);
+    if (tok != it->eof_token && !unlink_next(it, tok)) {
+        LLIST_ADD(*it->tok_freelist, tok);
     }
 }
 
+pp_token *
+ppti_take(pp_token_iter *it) {
+    pp_token *tok = ppti_peek(it);
+    if (tok != it->eof_token && unlink_next(it, tok)) {
+        tok = ppti_copy_tok(it, tok);
+    }
+    return tok;
+}
+
 pp_token *
 ppti_eat_peek(pp_token_iter *it) {
     ppti_eat(it);
@@ -18,7 +18,7 @@
 //
 // Issues come when we want to think about memory. Logically, the only resource
 // that token iterarator is responsible for are its stack entries. But it is
-// also a place of allocating and storing pp_lexer's and pp_token's. It has been
+// also a place of allocating and storing pp_token's. It has been
 // decided to use freelists for these types, which can't be placed here because
 // allocation my occure elsewhere in preprocessor. So we use pointers to it
 // here.
@@ -28,8 +28,47 @@
 #include "general.h"
 
 struct pp_token;
-struct pp_lexer;
+struct pp_token_array;
+struct pp_macro;
+struct pp_hide_set;
+struct pp_hide_set_table;
 struct file;
+struct bump_allocator;
+struct interned_string;
+
+// State of include guard detection. While file is lexed, its tokens are
+// matched against the pattern
+//  #ifndef X (or #if !defined X, #if !defined(X))
+//  ...
+//  #endif
+// If file ends right after the #endif, X is recorded as include guard of the
+// file. Later includes of the file can be skipped if X is defined.
+typedef enum {
+    // File does not have include guard
+    PPTI_GUARD_NONE = 0x0,
+    // Expecting '#' as first token of file
+    PPTI_GUARD_START = 0x1,
+    // Expecting 'ifndef' or 'if'
+    PPTI_GUARD_HASH = 0x2,
+    // Expecting guard name after #ifndef
+    PPTI_GUARD_IFNDEF = 0x3,
+    // Expecting '!' after #if
+    PPTI_GUARD_IF = 0x4,
+    // Expecting 'defined' after #if !
+    PPTI_GUARD_IF_NOT = 0x5,
+    // Expecting guard name or '(' after #if !defined
+    PPTI_GUARD_DEFINED = 0x6,
+    // Expecting guard name after #if !defined(
+    PPTI_GUARD_DEFINED_PAREN = 0x7,
+    // Expecting ')' after #if !defined(X
+    PPTI_GUARD_NAME_PAREN = 0x8,
+    // Expecting end of the directive line
+    PPTI_GUARD_NAME = 0x9,
+    // Inside of the guarded block, nested directives are tracked
+    PPTI_GUARD_BODY = 0xA,
+    // Matching #endif was found. Any token other than EOF breaks the pattern.
+    PPTI_GUARD_ENDIF = 0xB,
+} ppti_guard_state;
 
 // Entry of preprocessor parse stack.
 typedef struct ppti_entry {
@@ -37,10 +76,62 @@ typedef struct ppti_entry {
     // Linked list of tokens. Peeked tokens are stored here, and put to freelist
     // after eating.
     struct pp_token *token_list;
-    // If this ppti_entry is a file, lexer for that file.
-    struct pp_lexer *lexer;
-    // Must be present if lexer is present.
+    // Next token of entry that yields tokens by reference, which comes before
+    // token_list if has_view is set. It is made from token of macro definition
+    // or argument list when it is peeked, and is not allocated or linked
+    // anywhere, so tokens that are only eaten are never copied. Kept when
+    // entry is reused.
+    struct pp_token *view;
+    bool has_view;
+    // If this ppti_entry is a file, its tokens. All tokens of file are lexed
+    // at once when it is first included, see pp_lexer_lex_all, and are shared
+    // with other includes of file, see token_cache.h. Groups of lines in them
+    // are lexed when they are reached, and get entries of their own above
+    // entry of file.
+    struct pp_token_array *file_tokens;
+    // Index of next token in file_tokens
+    uint32_t file_token_idx;
+    // Present if file_tokens are tokens of file and not of group
     struct file *f;
+    // Tokens of group, pointed to by file_tokens of group entry. Kept when
+    // entry is reused.
+    struct pp_token_array *group_tokens;
+
+    ppti_guard_state guard_state;
+    // Candidate for include guard macro
+    struct interned_string *guard_name;
+    // Depth of conditional directives inside guarded block
+    uint32_t guard_depth;
+    // Previous lexed token was '#' starting a directive
+    bool guard_after_hash;
+    // All tokens of file were taken from file_tokens
+    bool is_at_end;
+
+    // If this entry is macro expansion, its macro. Tokens of expansion are
+    // produced one by one from compiled definition of macro when they are
+    // peeked, so expansion that is not yet read doesn't take any tokens.
+    struct pp_macro *macro;
+    // Position of expansion: index of op of definition to produce tokens from
+    // and, if op is argument, its next token (NULL if op is not started)
+    uint32_t op_idx;
+    struct pp_token *arg_tok;
+    // Tokens of arguments of function-like macro, indexed by parameter. Each
+    // is a linked list, NULL if argument is empty. Tokens are taken from
+    // stream without copying, are read by reference while expansion is
+    // produced, and are put to freelist when expansion ends.
+    struct pp_token **args;
+    // Fully macro-expanded arguments, used by PP_MACRO_OP_PARAM
+    struct pp_token **expanded_args;
+    uint32_t arg_count;
+    // Size of argument arrays, which are kept when entry is reused
+    uint32_t arg_capacity;
+    // Hide set that is added to hide sets of produced tokens
+    struct pp_hide_set *hide_set;
+    // Location of next produced token, from expansion range of invocation
+    source_loc next_loc;
+
+    // If this entry reads token list without taking it, next token of list
+    struct pp_token *ref_tok;
 } ppti_entry;
 
 // Structure holding state information about token parsing.
@@ -48,16 +139,54 @@ typedef struct pp_token_iter {
     ppti_entry *it;
 
     struct pp_token *eof_token;
+    // Allocator used for tokens and stack entries.
+    struct bump_allocator *a;
+    // Freelist of tokens, owned by user of iterator. Eaten tokens are put here
+    // and reused by ppti_new_tok.
+    struct pp_token **tok_freelist;
+    // Entries that are not files, reused after they are popped
+    ppti_entry *entry_freelist;
+    // Table that hide sets of produced tokens are made with
+    struct pp_hide_set_table *hide_sets;
 } pp_token_iter;
 
-void ppti_include_file(pp_token_iter *it, string filename);
+// Returns new zero-initialized token allocated with iterator's allocator
+struct pp_token *ppti_new_tok(pp_token_iter *it);
+// Returns new token with contents of given one
+struct pp_token *ppti_copy_tok(pp_token_iter *it, struct pp_token *tok);
+
+// Pushes file to the top of the stack
+void ppti_include_file(pp_token_iter *it, struct file *f);
+// Returns file which is currently processed
+struct file *ppti_current_file(pp_token_iter *it);
 void ppti_insert_tok_list(pp_token_iter *it, struct pp_token *first, struct pp_token *last);
+// Pushes entry that yields tokens of list by reference, leaving list unchanged.
+// List must outlive the entry.
+void ppti_push_tok_refs(pp_token_iter *it, struct pp_token *first);
+// Pushes expansion of macro invoked at given location to the top of the stack.
+// args and expanded_args are tokens of arguments of function-like macro (see
+// ppti_entry), which are owned by iterator after the call. hide_set is the
+// hide set of invocation with macro added.
+void ppti_push_expansion(pp_token_iter *it, struct pp_macro *macro, struct pp_token **args,
+                         struct pp_token **expanded_args, uint32_t arg_count,
+                         struct pp_hide_set *hide_set, source_loc invocation);
+// Pops all entries of the stack, putting their tokens to freelist. Used for
+// iterators over temporary token lists.
+void ppti_clear(pp_token_iter *it);
+
+// If there are no peeked tokens, skips source of the current file up to the
+// next preprocessor directive. Used for skipping excluded conditional blocks.
+void ppti_skip_to_directive(pp_token_iter *it);
 
 struct pp_token *ppti_peek_forward(pp_token_iter *it, uint32_t count);
 struct pp_token *ppti_peek(pp_token_iter *it);
 
 void ppti_eat_multiple(pp_token_iter *it, uint32_t count);
 void ppti_eat(pp_token_iter *it);
+// Eats next token and returns it instead of putting it to freelist. Token is
+// unlinked from stream, so it can be moved to other list. Token that was
+// yielded by reference is copied.
+struct pp_token *ppti_take(pp_token_iter *it);
 
 struct pp_token *ppti_eat_peek(pp_token_iter *it);
 
@@ -1,6 +1,10 @@
+// localtime_r is POSIX
+#define _POSIX_C_SOURCE 200809L
+
 #include "preprocessor.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,191 +12,321 @@
 
 #include "ast.h"
 #include "buffer_writer.h"
+#include "bump_allocator.h"
 #include "c_lang.h"
 #include "c_types.h"
 #include "cond_incl_ast.h"
+#include "darray.h"
 #include "error_reporter.h"
 #include "file_storage.h"
 #include "filepath.h"
 #include "hashing.h"
+#include "intern.h"
 #include "llist.h"
+#include "pp_hide_set.h"
 #include "pp_lexer.h"
+#include "pp_snapshot.h"
 #include "pp_token_iter.h"
+#include "source_manager.h"
 #include "str.h"
+#include "time_report.h"
+#include "trace.h"
 
-// NOTE: These can be separate functions, but since they are really wrappers for
-// another function let's not make them that way and keep as macros.
-#define GET_MACROP(_pp, _hash)                                                           \
-    (pp_macro **)hash_table_sc_get_u32((_pp)->macro_hash, ARRAY_SIZE((_pp)->macro_hash), \
-                                       pp_macro, next, name_hash, (_hash))
-#define GET_MACRO(_pp, _hash) (*GET_MACROP(_pp, _hash))
+// Builtin macros that don't depend on translation unit. They are lexed once
+// and then copied to every preprocessor.
+static pp_snapshot *pp_builtin_snapshot;
+static pthread_once_t pp_builtin_once = PTHREAD_ONCE_INIT;
+// Snapshot given by user, see pp_set_snapshot
+static pp_snapshot *pp_user_snapshot;
 
-// Frees macro arguments and adds them to freelist.
-// TODO: Free tokens too.
 static void
-free_macro_data(preprocessor *pp, pp_macro *macro) {
-    (void)pp;
-    while (macro->args) {
-        pp_macro_arg *arg = macro->args;
-        macro->args       = arg->next;
-        free(arg);
+init_macro_table(preprocessor *pp) {
+    pp->macro_slot_count = PREPROCESSOR_MACRO_TABLE_INITIAL_SIZE;
+    pp->macro_slots      = calloc(pp->macro_slot_count, sizeof(pp_macro_slot));
+    assert(pp->macro_slots);
+}
+
+// Returns slot of macro with given name in macro table. If macro is not
+// defined, slot is empty and new macro can be written to it. Names are
+// interned, so they are compared by pointer.
+static pp_macro_slot *
+get_macro_slot(preprocessor *pp, interned_string *name) {
+    uint32_t mask       = pp->macro_slot_count - 1;
+    uint32_t idx        = name->hash & mask;
+    pp_macro_slot *slot = pp->macro_slots + idx;
+    while (slot->macro && (slot->hash != name->hash || slot->macro->name != name)) {
+        idx  = (idx + 1) & mask;
+        slot = pp->macro_slots + idx;
     }
+    return slot;
 }
 
-// Returns new token and writes memory contained in given to it, effectively
-// making a copy.
-static pp_token *
-copy_pp_token(preprocessor *pp, pp_token *tok) {
-    (void)pp;
-    pp_token *new = malloc(sizeof(pp_token));
-    memcpy(new, tok, sizeof(pp_token));
-    new->next = 0;
-    return new;
+static pp_macro *
+get_macro(preprocessor *pp, interned_string *name) {
+    return get_macro_slot(pp, name)->macro;
+}
+
+static void
+grow_macro_table(preprocessor *pp) {
+    pp_macro_slot *old_slots = pp->macro_slots;
+    uint32_t old_count       = pp->macro_slot_count;
+    pp->macro_slot_count     = old_count * 2;
+    pp->macro_slots          = calloc(pp->macro_slot_count, sizeof(pp_macro_slot));
+    assert(pp->macro_slots);
+    for (uint32_t i = 0; i < old_count; ++i) {
+        if (old_slots[i].macro) {
+            *get_macro_slot(pp, old_slots[i].macro->name) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+// Removes macro from table (#undef). Macros that follow it in the same probe
+// sequence are shifted back into the freed slot, so there are no tombstones
+// and lookups stay as short as if macro was never defined.
+static void
+remove_macro(preprocessor *pp, pp_macro_slot *slot) {
+    uint32_t mask = pp->macro_slot_count - 1;
+    uint32_t hole = slot - pp->macro_slots;
+    uint32_t idx  = hole;
+    for (;;) {
+        idx                 = (idx + 1) & mask;
+        pp_macro_slot *next = pp->macro_slots + idx;
+        if (!next->macro) {
+            break;
+        }
+        // Macro can be moved to the hole if the hole is between its home slot
+        // and its current slot
+        uint32_t home = next->hash & mask;
+        if (((idx - home) & mask) >= ((idx - hole) & mask)) {
+            pp->macro_slots[hole] = *next;
+            hole                  = idx;
+        }
+    }
+    memset(pp->macro_slots + hole, 0, sizeof(pp_macro_slot));
+    --pp->macro_count;
+}
+
+static uint32_t
+get_param_count(pp_macro *macro) {
+    return macro->arg_count + (macro->is_variadic ? 1 : 0);
 }
 
-// Function used when #define'ing a function-like macro. Parses given token list
-// and forms arguments, that are written to the given macro.
-// Doesn't eat closing paren.
+// Parses arguments of function-like macro invocation from given iterator.
+// Tokens of arguments are taken from iterator and pushed to pp->macro_args as
+// lists indexed by parameter, followed by the same number of slots for their
+// expansions. Arguments that are not given are left empty (NULL). Doesn't eat
+// closing paren.
 static void
 get_function_like_macro_arguments(preprocessor *pp, pp_token_iter *it, pp_macro *macro) {
+    uint32_t param_count = get_param_count(macro);
+    uint32_t args_base   = da_size(pp->macro_args);
+    for (uint32_t i = 0; i < param_count * 2; ++i) {
+        da_push(pp->macro_args, NULL);
+    }
+
     pp_token *tok = ppti_peek(it);
     // If next token is closing parens, don't collect arguments.
-    if (macro->arg_count == 0 && !macro->is_variadic && !PP_TOK_IS_PUNCT(tok, ')')) {
-        report_error_pp_token(tok, "Unexpected macro arguments");
-    } else {
-        // Collect arguments.
-        // arg_idx needed for variadic argument checking and validating number
-        // of arguments.
-        uint32_t arg_idx  = 0;
-        pp_macro_arg *arg = macro->args;
+    if (param_count == 0) {
+        if (!PP_TOK_IS_PUNCT(tok, ')')) {
+            report_error_pp_token(tok, "Unexpected macro arguments");
+        }
+        return;
+    }
 
+    uint32_t arg_idx = 0;
+    for (;;) {
+        // Commas enclosed in parens are not treated as argument separators.
+        // Variadic argument takes all remaining arguments with commas.
+        uint32_t parens_depth = 0;
+        bool is_variadic      = macro->is_variadic && arg_idx == macro->arg_count;
+        bool is_stored        = arg_idx < param_count;
+        // Construct list of tokens that form argument.
+        linked_list_constructor arg_tokens = {0};
         while (tok->kind != PP_TOK_EOF) {
-            // Commands enclosed in parens are not treated as argument
-            // separators.
-            uint32_t parens_depth = 0;
-            // Construct list of copied tokens that form tokens of argument.
-            // Variadic arguments are formed in a hacky way - they all are
-            // treated as single argument
-            linked_list_constructor macro_tokens = {0};
-            while (tok->kind != PP_TOK_EOF) {
-                if (PP_TOK_IS_PUNCT(tok, ')') && parens_depth == 0) {
-                    break;
-                } else if (PP_TOK_IS_PUNCT(tok, ',') && parens_depth == 0) {
-                    tok = ppti_eat_peek(it);
-                    if (!macro->is_variadic) {
-                        break;
-                    }
-                } else if (PP_TOK_IS_PUNCT(tok, '(')) {
-                    ++parens_depth;
-                } else if (PP_TOK_IS_PUNCT(tok, ')')) {
-                    assert(parens_depth);
-                    --parens_depth;
-                }
-                pp_token *new_token = copy_pp_token(pp, tok);
-                LLISTC_ADD_LAST(&macro_tokens, new_token);
-                tok = ppti_eat_peek(it);
-            }
-            // Add eof to the end
-            pp_token *eof = calloc(1, sizeof(pp_token));
-            eof->kind     = PP_TOK_EOF;
-            LLISTC_ADD_LAST(&macro_tokens, eof);
-
-            arg->toks = macro_tokens.first;
-
-            ++arg_idx;
-            arg = arg->next;
-            // Check if we are finished
-            if (PP_TOK_IS_PUNCT(tok, ')')) {
-                if (arg_idx != macro->arg_count && !macro->is_variadic) {
-                    report_error_pp_token(tok,
-                                          "Incorrect number of arguments in macro invocation "
-                                          "(expected %u, got %u)",
-                                          macro->arg_count, arg_idx + 1);
-                }
+            if (parens_depth == 0 &&
+                (PP_TOK_IS_PUNCT(tok, ')') || (PP_TOK_IS_PUNCT(tok, ',') && !is_variadic))) {
                 break;
+            } else if (PP_TOK_IS_PUNCT(tok, '(')) {
+                ++parens_depth;
+            } else if (PP_TOK_IS_PUNCT(tok, ')')) {
+                --parens_depth;
+            }
+            if (is_stored) {
+                pp_token *arg_tok = ppti_take(it);
+                LLISTC_ADD_LAST(&arg_tokens, arg_tok);
+            } else {
+                ppti_eat(it);
             }
+            tok = ppti_peek(it);
         }
-    }
-}
+        if (is_stored) {
+            pp->macro_args[args_base + arg_idx] = arg_tokens.first;
+        }
+        ++arg_idx;
 
-// Used internally in expand_function_like_macro.
-// Finds argument by name in macro argument list.
-static pp_macro_arg *
-get_argument(pp_macro *macro, string name) {
-    pp_macro_arg *arg = NULL;
-    for (pp_macro_arg *test = macro->args; test; test = test->next) {
-        if (string_eq(test->name, name)) {
-            arg = test;
+        if (!PP_TOK_IS_PUNCT(tok, ',')) {
             break;
         }
+        tok = ppti_eat_peek(it);
+    }
+
+    // Variadic argument can be omitted
+    if (PP_TOK_IS_PUNCT(tok, ')') && arg_idx != param_count &&
+        !(macro->is_variadic && arg_idx == macro->arg_count)) {
+        report_error_pp_token(tok,
+                              "Incorrect number of arguments in macro invocation "
+                              "(expected %u, got %u)",
+                              macro->arg_count, arg_idx);
     }
-    return arg;
 }
 
-// Parses given function-like macro invocation. Arguments are stored in
-// macro->args, with their values of invocation. This is possible because
-// recursive macro invocation is not supported, and tokens of given macro
-// invocation won't be changed doing it.
-// Sets locations of new tokens to be the same as 'initial' param.
-static void
-expand_function_like_macro(preprocessor *pp, pp_token_iter *it, pp_macro *macro,
-                           source_loc initial_loc) {
-    // Collect macro arguments.
-    get_function_like_macro_arguments(pp, it, macro);
-    pp_token *tok = ppti_peek(it);
-    if (!PP_TOK_IS_PUNCT(tok, ')')) {
-        report_error_pp_token(tok, "Missing closing paren in function-like macro invocation");
-    } else {
-        ppti_eat(it);
+// Returns index of parameter of function-like macro with name of given token,
+// or -1 if token is not a parameter.
+static int32_t
+get_param_idx(pp_macro *macro, pp_token *tok) {
+    int32_t result = -1;
+    if (macro->kind == PP_MACRO_FUNC && tok->kind == PP_TOK_ID) {
+        int32_t idx = 0;
+        for (pp_macro_arg *arg = macro->args; arg; arg = arg->next, ++idx) {
+            if (arg->name == tok->ident) {
+                result = idx;
+                break;
+            }
+        }
     }
+    return result;
+}
 
-    linked_list_constructor def = {0};
-    for (pp_token *temp = macro->definition; temp->kind != PP_TOK_EOF; temp = temp->next) {
-        // Check if given token is a macro argument
-        if (temp->kind == PP_TOK_ID) {
-            pp_macro_arg *arg = get_argument(macro, temp->str);
-            if (arg) {
-                for (pp_token *arg_tok = arg->toks; arg_tok->kind != PP_TOK_EOF;
-                     arg_tok           = arg_tok->next) {
-                    pp_token *new_token = copy_pp_token(pp, arg_tok);
-                    new_token->loc      = initial_loc;
-                    LLISTC_ADD_LAST(&def, new_token);
-                }
+void
+pp_compile_macro(pp_macro *macro, bump_allocator *a, bool should_report_errors) {
+    uint32_t token_count = 0;
+    for (pp_token *tok = macro->definition; tok->kind != PP_TOK_EOF; tok = tok->next) {
+        ++token_count;
+    }
+    macro->ops      = ba_alloc_array(a, pp_macro_op, token_count + 1);
+    macro->op_count = 0;
+
+    bool is_pasted = false;
+    for (pp_token *tok = macro->definition; tok->kind != PP_TOK_EOF; tok = tok->next) {
+        pp_macro_op *op = macro->ops + macro->op_count;
+        op->kind        = PP_MACRO_OP_TOKEN;
+        op->tok         = tok;
+        if (PP_TOK_IS_PUNCT(tok, PP_TOK_PUNCT_DHASH)) {
+            if (macro->op_count && tok->next->kind != PP_TOK_EOF) {
+                is_pasted = true;
                 continue;
             }
-        } else if (PP_TOK_IS_PUNCT(temp, '#')) {
-            temp              = temp->next;
-            pp_macro_arg *arg = get_argument(macro, temp->str);
-            if (!arg) {
-                report_error_pp_token(tok,
-                                      "Expected macro argument after "
-                                      "stringification operator '#'");
-                continue;
+            if (should_report_errors) {
+                report_error_pp_token(tok, "'##' cannot appear at either end of macro "
+                                           "expansion");
             }
-
-            char buffer[4096];
-            buffer_writer w = {buffer, buffer + sizeof(buffer)};
-            for (pp_token *arg_tok = arg->toks; arg_tok->kind != PP_TOK_EOF;
-                 arg_tok           = arg_tok->next) {
-                fmt_pp_tokw(&w, arg_tok);
+        } else if (macro->kind == PP_MACRO_FUNC && PP_TOK_IS_PUNCT(tok, '#')) {
+            int32_t param_idx = get_param_idx(macro, tok->next);
+            if (param_idx >= 0) {
+                op->kind      = PP_MACRO_OP_STRINGIFY;
+                op->param_idx = param_idx;
+                tok           = tok->next;
+            } else if (should_report_errors) {
+                report_error_pp_token(tok, "Expected macro argument after "
+                                           "stringification operator '#'");
+            }
+        } else {
+            int32_t param_idx = get_param_idx(macro, tok);
+            if (param_idx >= 0) {
+                op->kind      = PP_MACRO_OP_PARAM;
+                op->param_idx = param_idx;
             }
+        }
+        // Operands of ## are not macro-expanded
+        if (is_pasted) {
+            if (op->kind == PP_MACRO_OP_PARAM) {
+                op->kind = PP_MACRO_OP_UNEXPANDED_PARAM;
+            }
+            if (op[-1].kind == PP_MACRO_OP_PARAM) {
+                op[-1].kind = PP_MACRO_OP_UNEXPANDED_PARAM;
+            }
+        }
+        op->is_pasted = is_pasted;
+        is_pasted     = false;
+        ++macro->op_count;
+    }
 
-            pp_token *new_token = calloc(1, sizeof(pp_token));
-            new_token->kind     = PP_TOK_STR;
-            new_token->str      = string_strdup(buffer);
-            new_token->str_kind = PP_TOK_STR_SCHAR;
-            LLISTC_ADD_LAST(&def, new_token);
-            continue;
+    uint32_t param_count = get_param_count(macro);
+    macro->param_flags   = ba_alloc_array(a, uint8_t, param_count);
+    for (uint32_t op_idx = 0; op_idx < macro->op_count; ++op_idx) {
+        pp_macro_op *op = macro->ops + op_idx;
+        if (op->kind == PP_MACRO_OP_PARAM) {
+            macro->param_flags[op->param_idx] |= PP_MACRO_PARAM_EXPANDED;
+        } else if (op->kind != PP_MACRO_OP_TOKEN) {
+            macro->param_flags[op->param_idx] |= PP_MACRO_PARAM_UNEXPANDED;
         }
+    }
+}
 
-        // If given token is not arg, continue as usual
-        pp_token *new_token = copy_pp_token(pp, temp);
-        new_token->loc      = initial_loc;
-        LLISTC_ADD_LAST(&def, new_token);
+static bool expand_macro(preprocessor *pp, pp_token_iter *it);
+
+// Fully macro-expands tokens of argument. Argument is expanded in isolation, so
+// function-like macro at its end doesn't take tokens that follow it. If is_ref
+// is set, tokens are read by reference and left unchanged, otherwise they are
+// consumed.
+static pp_token *
+expand_argument(preprocessor *pp, pp_token_iter *it, pp_token *first, bool is_ref) {
+    linked_list_constructor expanded = {0};
+    if (first) {
+        pp_token *last = first;
+        while (last->next) {
+            last = last->next;
+        }
+        pp_token eof = {0};
+        eof.kind     = PP_TOK_EOF;
+        eof.loc      = last->loc;
+
+        pp_token_iter arg_it  = {0};
+        arg_it.a              = it->a;
+        arg_it.tok_freelist   = it->tok_freelist;
+        arg_it.entry_freelist = it->entry_freelist;
+        arg_it.hide_sets      = it->hide_sets;
+        arg_it.eof_token      = &eof;
+        if (is_ref) {
+            ppti_push_tok_refs(&arg_it, first);
+        } else {
+            ppti_insert_tok_list(&arg_it, first, last);
+        }
+        for (pp_token *tok = ppti_peek(&arg_it); tok->kind != PP_TOK_EOF;
+             tok           = ppti_peek(&arg_it)) {
+            if (!expand_macro(pp, &arg_it)) {
+                tok = ppti_take(&arg_it);
+                LLISTC_ADD_LAST(&expanded, tok);
+            }
+        }
+        ppti_clear(&arg_it);
+        it->entry_freelist = arg_it.entry_freelist;
     }
+    return expanded.first;
+}
 
-    if (def.first) {
-        ppti_insert_tok_list(it, def.first, def.last);
+// Fully macro-expands arguments of function-like macro invocation, pushed to
+// pp->macro_args from args_base. Each argument is expanded once, no matter
+// how many times it is used.
+static void
+expand_macro_arguments(preprocessor *pp, pp_token_iter *it, pp_macro *macro,
+                       uint32_t args_base) {
+    uint32_t param_count = get_param_count(macro);
+    for (uint32_t param_idx = 0; param_idx < param_count; ++param_idx) {
+        uint8_t flags = macro->param_flags[param_idx];
+        if (flags & PP_MACRO_PARAM_EXPANDED) {
+            pp_token *arg = pp->macro_args[args_base + param_idx];
+            // If argument is needed as written too, it is read by reference,
+            // otherwise its tokens are moved
+            bool is_ref = (flags & PP_MACRO_PARAM_UNEXPANDED) != 0;
+            if (!is_ref) {
+                pp->macro_args[args_base + param_idx] = NULL;
+            }
+            // Expansion can grow array of arguments
+            pp_token *expanded = expand_argument(pp, it, arg, is_ref);
+            pp->macro_args[args_base + param_count + param_idx] = expanded;
+        }
     }
 }
 
@@ -201,41 +335,62 @@ expand_macro(preprocessor *pp, pp_token_iter *it) {
     bool result     = false;
     pp_macro *macro = NULL;
     pp_token *tok   = ppti_peek(it);
-    if (tok->kind == PP_TOK_ID) {
-        uint32_t name_hash = hash_string(tok->str);
-        macro              = GET_MACRO(pp, name_hash);
+    if (tok->kind == PP_TOK_ID && !tok->is_painted) {
+        macro = get_macro(pp, tok->ident);
+        // Macro is not expanded inside its own expansion
+        if (macro && pphs_contains(tok->hide_set, tok->ident->id)) {
+            tok->is_painted = true;
+            macro           = NULL;
+        }
     }
 
     if (macro) {
+        TR_BEGIN(TR_PHASE_MACRO_EXPANSION);
         switch (macro->kind) {
             INVALID_DEFAULT_CASE;
         case PP_MACRO_OBJ: {
             source_loc initial_loc = tok->loc;
-
-            linked_list_constructor def = {0};
-            for (pp_token *temp = macro->definition; temp->kind != PP_TOK_EOF;
-                 temp           = temp->next) {
-                pp_token *new_token = copy_pp_token(pp, temp);
-                new_token->loc      = initial_loc;
-                LLISTC_ADD_LAST(&def, new_token);
-            }
-            // Eat the identifier. We do it here because we need it for copying
-            // source information, like location to new tokens.
+            pp_hide_set *hide_set  = pphs_add(&pp->hide_sets, tok->hide_set, tok->ident->id);
+            // Eat the identifier. Location is saved before, as it is used for
+            // locations of new tokens.
             ppti_eat(it);
-            if (def.first) {
-                ppti_insert_tok_list(it, def.first, def.last);
-            }
-
+            ppti_push_expansion(it, macro, NULL, NULL, 0, hide_set, initial_loc);
             result = true;
         } break;
         case PP_MACRO_FUNC: {
-            source_loc initial_loc = tok->loc;
+            source_loc initial_loc     = tok->loc;
+            interned_string *name      = tok->ident;
+            pp_hide_set *name_hide_set = tok->hide_set;
 
+            // Name is invocation if it is followed by '(', which can be
+            // separated from it by whitespace and newlines
             pp_token *next = ppti_peek_forward(it, 1);
-            if (next && !next->has_whitespace && PP_TOK_IS_PUNCT(next, '(')) {
+            if (next && PP_TOK_IS_PUNCT(next, '(')) {
                 ppti_eat_multiple(it, 2);
-                expand_function_like_macro(pp, it, macro, initial_loc);
-                result = true;
+                // Arguments are pushed above arguments of invocations that
+                // are being expanded
+                uint32_t args_base = da_size(pp->macro_args);
+                get_function_like_macro_arguments(pp, it, macro);
+                tok = ppti_peek(it);
+                // Hide set of expansion is the intersection of hide sets of
+                // name and closing paren, with macro added
+                pp_hide_set *hide_set = NULL;
+                if (!PP_TOK_IS_PUNCT(tok, ')')) {
+                    report_error_pp_token(
+                        tok, "Missing closing paren in function-like macro invocation");
+                } else {
+                    hide_set = pphs_intersect(&pp->hide_sets, name_hide_set, tok->hide_set);
+                    ppti_eat(it);
+                }
+                hide_set = pphs_add(&pp->hide_sets, hide_set, name->id);
+
+                expand_macro_arguments(pp, it, macro, args_base);
+                uint32_t param_count = get_param_count(macro);
+                ppti_push_expansion(it, macro, pp->macro_args + args_base,
+                                    pp->macro_args + args_base + param_count, param_count,
+                                    hide_set, initial_loc);
+                da_header(pp->macro_args)->size = args_base;
+                result                          = true;
             }
         } break;
         case PP_MACRO_FILE:
@@ -251,6 +406,10 @@ expand_macro(preprocessor *pp, pp_token_iter *it) {
             NOT_IMPL;
             break;
         }
+        if (result) {
+            TR_COUNT(TR_COUNTER_MACROS_EXPANDED, 1);
+        }
+        TR_END(TR_PHASE_MACRO_EXPANSION);
     }
     return result;
 }
@@ -272,8 +431,8 @@ define_macro_function_like_args(preprocessor *pp, pp_macro *macro) {
             }
 
             macro->is_variadic = true;
-            pp_macro_arg *arg  = calloc(1, sizeof(pp_macro_arg));
-            arg->name          = (string)WRAPZ("__VA_ARGS__");
+            pp_macro_arg *arg  = ba_alloc_struct(pp->a, pp_macro_arg);
+            arg->name          = intern_stringz("__VA_ARGS__");
             LLISTC_ADD_LAST(&args, arg);
 
             tok = ppti_eat_peek(pp->it);
@@ -285,8 +444,8 @@ define_macro_function_like_args(preprocessor *pp, pp_macro *macro) {
                 report_error_pp_token(tok, "Argument after varargs");
             }
 
-            pp_macro_arg *arg = calloc(1, sizeof(pp_macro_arg));
-            arg->name         = tok->str;
+            pp_macro_arg *arg = ba_alloc_struct(pp->a, pp_macro_arg);
+            arg->name         = tok->ident;
             LLISTC_ADD_LAST(&args, arg);
             ++macro->arg_count;
 
@@ -314,25 +473,26 @@ define_macro(preprocessor *pp) {
 
     if (tok->kind != PP_TOK_ID) {
         report_error_pp_token(tok, "Expected identifier after #define");
+        // Skip the rest of directive
+        while (tok->kind != PP_TOK_EOF && !tok->at_line_start) {
+            tok = ppti_eat_peek(pp->it);
+        }
+        return;
     }
 
     // Get macro
-    string macro_name        = tok->str;
-    uint32_t macro_name_hash = hash_string(macro_name);
-    pp_macro **macrop        = GET_MACROP(pp, macro_name_hash);
-    if (*macrop) {
+    pp_macro *macro = get_macro(pp, tok->ident);
+    if (macro) {
         report_error_pp_token(tok, "#define on already defined macro");
+        // Macro is redefined in place
+        memset(macro, 0, sizeof(pp_macro));
+        macro->name = tok->ident;
     } else {
-        pp_macro *macro = calloc(1, sizeof(pp_macro));
-        LLIST_ADD(*macrop, macro);
+        macro       = ba_alloc_struct(pp->a, pp_macro);
+        macro->name = tok->ident;
+        pp_add_macro(pp, macro);
     }
 
-    pp_macro *macro = *macrop;
-    assert(macro);
-
-    macro->name      = macro_name;
-    macro->name_hash = macro_name_hash;
-
     tok = ppti_eat_peek(pp->it);
     // Function-like macro
     if (PP_TOK_IS_PUNCT(tok, '(') && !tok->has_whitespace) {
@@ -352,18 +512,20 @@ define_macro(preprocessor *pp) {
         macro->kind = PP_MACRO_OBJ;
     }
 
-    // Store definition
+    // Store definition. Definition can be the last line of main file, which
+    // ends with EOF instead of next line.
     linked_list_constructor def = {0};
-    while (!tok->at_line_start) {
-        pp_token *new_token = copy_pp_token(pp, tok);
+    while (tok->kind != PP_TOK_EOF && !tok->at_line_start) {
+        pp_token *new_token = ppti_copy_tok(pp->it, tok);
         LLISTC_ADD_LAST(&def, new_token);
         tok = ppti_eat_peek(pp->it);
     }
 
-    pp_token *eof = calloc(1, sizeof(pp_token));
+    pp_token *eof = ppti_new_tok(pp->it);
     eof->kind     = PP_TOK_EOF;
     LLISTC_ADD_LAST(&def, eof);
     macro->definition = def.first;
+    pp_compile_macro(macro, pp->a, true);
 }
 
 static void
@@ -371,33 +533,44 @@ undef_macro(preprocessor *pp) {
     pp_token *tok = ppti_peek(pp->it);
     if (tok->kind != PP_TOK_ID) {
         report_error_pp_token(tok, "Expected identifier after #undef");
+    } else {
+        pp_macro_slot *slot = get_macro_slot(pp, tok->ident);
+        if (slot->macro) {
+            // Memory of macro is left in allocator
+            remove_macro(pp, slot);
+        }
     }
-
-    string macro_name        = tok->str;
-    uint32_t macro_name_hash = hash_string(macro_name);
-    pp_macro **macrop        = GET_MACROP(pp, macro_name_hash);
-    if (*macrop) {
-        pp_macro *macro = *macrop;
-        free_macro_data(pp, macro);
-        *macrop = macro->next;
-        free(macro);
-    }
+    ppti_eat(pp->it);
 }
 
 static void
 push_cond_incl(preprocessor *pp, bool is_included) {
-    pp_conditional_include *incl = calloc(1, sizeof(pp_conditional_include));
-    incl->is_included            = is_included;
+    pp_conditional_include *incl = pp->cond_incl_freelist;
+    if (incl) {
+        pp->cond_incl_freelist = incl->next;
+        memset(incl, 0, sizeof(pp_conditional_include));
+    } else {
+        incl = ba_alloc_struct(pp->a, pp_conditional_include);
+    }
+    incl->is_included = is_included;
     LLIST_ADD(pp->cond_incl_stack, incl);
 }
 
 static void
 skip_cond_incl(preprocessor *pp) {
-    pp_token *tok  = ppti_peek(pp->it);
     uint32_t depth = 0;
-    while (tok->kind != PP_TOK_EOF) {
+    for (;;) {
+        // Tokens that were already peeked are skipped one by one. When there
+        // are none left, source is skipped up to the next directive without
+        // lexing it.
+        ppti_skip_to_directive(pp->it);
+        pp_token *tok = ppti_peek(pp->it);
+        if (tok->kind == PP_TOK_EOF) {
+            break;
+        }
+
         if (!PP_TOK_IS_PUNCT(tok, '#') || !tok->at_line_start) {
-            tok = ppti_eat_peek(pp->it);
+            ppti_eat(pp->it);
             continue;
         }
         // now the token is hash
@@ -408,22 +581,20 @@ skip_cond_incl(preprocessor *pp) {
             continue;
         }
 
-        if (string_eq(next->str, (string)WRAPZ("if")) ||
-            string_eq(next->str, (string)WRAPZ("ifdef")) ||
-            string_eq(next->str, (string)WRAPZ("ifndef"))) {
+        pp_ident_kind directive = next->ident->pp_kind;
+        if (directive == PP_IDENT_IF || directive == PP_IDENT_IFDEF ||
+            directive == PP_IDENT_IFNDEF) {
             ++depth;
-        } else if (string_eq(next->str, (string)WRAPZ("elif")) ||
-                   string_eq(next->str, (string)WRAPZ("else")) ||
-                   string_eq(next->str, (string)WRAPZ("endif"))) {
+        } else if (directive == PP_IDENT_ELIF || directive == PP_IDENT_ELSE ||
+                   directive == PP_IDENT_ENDIF) {
             if (!depth) {
                 break;
             }
-            if (string_eq(next->str, (string)WRAPZ("endif"))) {
+            if (directive == PP_IDENT_ENDIF) {
                 --depth;
             }
         }
         ppti_eat_multiple(pp->it, 2);
-        tok = ppti_peek(pp->it);
     }
 
     if (depth) {
@@ -433,16 +604,26 @@ skip_cond_incl(preprocessor *pp) {
 
 static int64_t
 eval_pp_expr(preprocessor *pp) {
+    // All memory used in evaluation is temporary and is taken from separate
+    // allocator, which is cleared in the end.
+    bump_allocator *a      = pp->expr_a;
+    pp_token *tok_freelist = NULL;
+    pp_token_iter iter     = {0};
+    iter.a                 = a;
+    iter.tok_freelist      = &tok_freelist;
+    iter.hide_sets         = &pp->hide_sets;
+
     // Copy all tokens from current line, so we can process them
     // independently
-    pp_token *tok                  = ppti_peek(pp->it);
+    pp_token *tok = ppti_peek(pp->it);
+    tc_begin_loc(TC_TRACK_PREPROCESSOR, (string)WRAPZ("#if"), tok->loc);
     linked_list_constructor copied = {0};
     while (!tok->at_line_start) {
-        pp_token *new_tok = copy_pp_token(pp, tok);
+        pp_token *new_tok = ppti_copy_tok(&iter, tok);
         LLISTC_ADD_LAST(&copied, new_tok);
         tok = ppti_eat_peek(pp->it);
     }
-    pp_token *eof = calloc(1, sizeof(pp_token));
+    pp_token *eof = ppti_new_tok(&iter);
     eof->kind     = PP_TOK_EOF;
     LLISTC_ADD_LAST(&copied, eof);
 
@@ -450,7 +631,7 @@ eval_pp_expr(preprocessor *pp) {
     tok                              = copied.first;
     linked_list_constructor modified = {0};
     while (tok) {
-        if (tok->kind == PP_TOK_ID && string_eq(tok->str, (string)WRAPZ("defined"))) {
+        if (tok->kind == PP_TOK_ID && tok->ident->pp_kind == PP_IDENT_DEFINED) {
             bool has_paren = false;
             tok            = tok->next;
             if (PP_TOK_IS_PUNCT(tok, '(')) {
@@ -463,10 +644,9 @@ eval_pp_expr(preprocessor *pp) {
                 break;
             }
 
-            uint32_t macro_name_hash = hash_string(tok->str);
-            pp_macro *macro          = GET_MACRO(pp, macro_name_hash);
+            pp_macro *macro = get_macro(pp, tok->ident);
 
-            pp_token *new_token = calloc(1, sizeof(pp_token));
+            pp_token *new_token = ppti_new_tok(&iter);
             new_token->kind     = PP_TOK_NUM;
             new_token->str      = (macro != 0) ? (string)WRAPZ("1") : (string)WRAPZ("0");
 
@@ -489,7 +669,6 @@ eval_pp_expr(preprocessor *pp) {
     // Convert these tokens to C ones.
     linked_list_constructor converted = {0};
 
-    pp_token_iter iter = {0};
     ppti_insert_tok_list(&iter, modified.first, modified.last);
     tok = ppti_peek(&iter);
     while (tok) {
@@ -499,29 +678,30 @@ eval_pp_expr(preprocessor *pp) {
         }
 
         if (tok->kind == PP_TOK_ID) {
-            pp_macro *macro = GET_MACRO(pp, hash_string(tok->str));
+            pp_macro *macro = get_macro(pp, tok->ident);
             // Identifier can be present here if it is part of function-like
             // macro. In this case we can't do anything with it, so leave it be
             // and error will be reported when evaluating expression.
-            if (macro) {
+            if (macro && !tok->is_painted) {
                 report_error_pp_token(tok, "Unexpected identifier");
                 break;
             } else {
-                tok->kind = PP_TOK_NUM;
-                tok->str  = (string)WRAPZ("0");
+                tok->kind  = PP_TOK_NUM;
+                tok->str   = (string)WRAPZ("0");
+                tok->ident = NULL;
             }
         }
 
-        token *c_tok = calloc(1, sizeof(token));
+        token *c_tok = ba_alloc_struct(a, token);
         char buf[4096];
         uint32_t buf_len = 0;
-        if (!convert_pp_token(tok, c_tok, buf, sizeof(buf), &buf_len)) {
+        if (!convert_pp_token(a, tok, c_tok, buf, sizeof(buf), &buf_len)) {
             report_error_pp_token(tok, "Unexpected token");
             break;
         }
 
         if (buf_len) {
-            c_tok->str = string_dup(c_tok->str);
+            c_tok->str = ba_string_dup(a, c_tok->str);
         }
         LLISTC_ADD_LAST(&converted, c_tok);
         tok = ppti_eat_peek(&iter);
@@ -536,33 +716,62 @@ eval_pp_expr(preprocessor *pp) {
     }
     printf("\n");
 #endif
-    ast *expr_ast  = ast_cond_incl_expr_ternary(&expr_tokens);
+    ast *expr_ast  = ast_cond_incl_expr_ternary(a, &expr_tokens);
     int64_t result = ast_cond_incl_eval(expr_ast);
 
+    ba_clear(a);
+    tc_end(TC_TRACK_PREPROCESSOR);
     return result;
 }
 
+// Returns true if file can be skipped because it either has #pragma once and
+// was already included, or its include guard is defined.
+static bool
+is_file_include_skipped(preprocessor *pp, file *f) {
+    bool result = false;
+    interned_string *include_guard = fs_get_include_guard(f);
+    if (include_guard) {
+        result = get_macro(pp, include_guard) != 0;
+    }
+    if (!result && fs_has_pragma_once(f)) {
+        result = pp_is_marked_pragma_once(pp, f->idx);
+    }
+    return result;
+}
+
+static void
+include_file(preprocessor *pp, string filename) {
+    file *f = fs_get_file(filename, ppti_current_file(pp->it));
+    if (!f) {
+        NOT_IMPL;
+    } else if (!is_file_include_skipped(pp, f)) {
+        ppti_include_file(pp->it, f);
+    }
+}
+
 static bool
 process_pp_directive(preprocessor *pp) {
     pp_token *tok = ppti_peek(pp->it);
     bool result   = false;
     if (PP_TOK_IS_PUNCT(tok, '#') && tok->at_line_start) {
+        TR_BEGIN(TR_PHASE_DIRECTIVES);
         tok = ppti_eat_peek(pp->it);
         if (tok->kind == PP_TOK_ID) {
-            if (string_eq(tok->str, (string)WRAPZ("define"))) {
+            pp_ident_kind directive = tok->ident->pp_kind;
+            if (directive == PP_IDENT_DEFINE) {
                 ppti_eat(pp->it);
                 define_macro(pp);
-            } else if (string_eq(tok->str, (string)WRAPZ("undef"))) {
+            } else if (directive == PP_IDENT_UNDEF) {
                 ppti_eat(pp->it);
                 undef_macro(pp);
-            } else if (string_eq(tok->str, (string)WRAPZ("if"))) {
+            } else if (directive == PP_IDENT_IF) {
                 ppti_eat(pp->it);
                 int64_t expr_result = eval_pp_expr(pp);
                 push_cond_incl(pp, expr_result != 0);
                 if (!expr_result) {
                     skip_cond_incl(pp);
                 }
-            } else if (string_eq(tok->str, (string)WRAPZ("elif"))) {
+            } else if (directive == PP_IDENT_ELIF) {
                 pp_conditional_include *incl = pp->cond_incl_stack;
                 if (!incl) {
                     report_error_pp_token(tok, "Stray #elif");
@@ -584,7 +793,7 @@ process_pp_directive(preprocessor *pp) {
                         skip_cond_incl(pp);
                     }
                 }
-            } else if (string_eq(tok->str, (string)WRAPZ("else"))) {
+            } else if (directive == PP_IDENT_ELSE) {
                 pp_conditional_include *incl = pp->cond_incl_stack;
                 if (!incl) {
                     report_error_pp_token(tok, "Stray #else");
@@ -600,7 +809,7 @@ process_pp_directive(preprocessor *pp) {
                         skip_cond_incl(pp);
                     }
                 }
-            } else if (string_eq(tok->str, (string)WRAPZ("endif"))) {
+            } else if (directive == PP_IDENT_ENDIF) {
                 pp_conditional_include *incl = pp->cond_incl_stack;
                 if (!incl) {
                     report_error_pp_token(tok, "Stray #endif");
@@ -609,40 +818,50 @@ process_pp_directive(preprocessor *pp) {
                     /* report_error_pp_token(pp, tok, "DBG: ENDIF"); */
                     ppti_eat(pp->it);
                     LLIST_POP(pp->cond_incl_stack);
-                    free(incl);
+                    LLIST_ADD(pp->cond_incl_freelist, incl);
                 }
-            } else if (string_eq(tok->str, (string)WRAPZ("ifdef"))) {
+            } else if (directive == PP_IDENT_IFDEF) {
                 tok = ppti_eat_peek(pp->it);
                 if (tok->kind != PP_TOK_ID) {
                     report_error_pp_token(tok, "Expected identifier");
                 }
 
-                uint32_t macro_name_hash = hash_string(tok->str);
-                bool is_defined          = GET_MACRO(pp, macro_name_hash) != 0;
+                bool is_defined = tok->kind == PP_TOK_ID && get_macro(pp, tok->ident) != 0;
                 push_cond_incl(pp, is_defined);
                 ppti_eat(pp->it);
                 if (!is_defined) {
                     skip_cond_incl(pp);
                 }
-            } else if (string_eq(tok->str, (string)WRAPZ("ifndef"))) {
+            } else if (directive == PP_IDENT_IFNDEF) {
                 tok = ppti_eat_peek(pp->it);
 
                 if (tok->kind != PP_TOK_ID) {
                     report_error_pp_token(tok, "Expected identifier");
                 }
 
-                uint32_t macro_name_hash = hash_string(tok->str);
-                bool is_defined          = GET_MACRO(pp, macro_name_hash) != 0;
+                bool is_defined = tok->kind == PP_TOK_ID && get_macro(pp, tok->ident) != 0;
                 push_cond_incl(pp, !is_defined);
                 ppti_eat(pp->it);
                 if (is_defined) {
                     skip_cond_incl(pp);
                 }
-            } else if (string_eq(tok->str, (string)WRAPZ("line"))) {
+            } else if (directive == PP_IDENT_LINE) {
                 // TODO:
-            } else if (string_eq(tok->str, (string)WRAPZ("pragma"))) {
-                NOT_IMPL;
-            } else if (string_eq(tok->str, (string)WRAPZ("error"))) {
+            } else if (directive == PP_IDENT_PRAGMA) {
+                tok = ppti_eat_peek(pp->it);
+                if (!tok->at_line_start && tok->kind == PP_TOK_ID &&
+                    tok->ident->pp_kind == PP_IDENT_ONCE) {
+                    file *f = ppti_current_file(pp->it);
+                    fs_set_pragma_once(f);
+                    pp_mark_pragma_once(pp, f->idx);
+                    ppti_eat(pp->it);
+                } else {
+                    // Other pragmas are not supported and ignored
+                    while (tok->kind != PP_TOK_EOF && !tok->at_line_start) {
+                        tok = ppti_eat_peek(pp->it);
+                    }
+                }
+            } else if (directive == PP_IDENT_ERROR) {
                 source_loc error_loc = tok->loc;
 
                 tok = ppti_eat_peek(pp->it);
@@ -654,7 +873,7 @@ process_pp_directive(preprocessor *pp) {
                     tok = ppti_eat_peek(pp->it);
                 }
                 report_error(error_loc, "%s", buffer);
-            } else if (string_eq(tok->str, (string)WRAPZ("warning"))) {
+            } else if (directive == PP_IDENT_WARNING) {
                 source_loc error_loc = tok->loc;
 
                 tok = ppti_eat_peek(pp->it);
@@ -666,7 +885,7 @@ process_pp_directive(preprocessor *pp) {
                     tok = ppti_eat_peek(pp->it);
                 }
                 report_warning(error_loc, "%s", buffer);
-            } else if (string_eq(tok->str, (string)WRAPZ("include"))) {
+            } else if (directive == PP_IDENT_INCLUDE) {
                 tok = ppti_eat_peek(pp->it);
 
                 if (tok->at_line_start) {
@@ -690,12 +909,12 @@ process_pp_directive(preprocessor *pp) {
                     }
 
                     string filename = (string){filename_buffer, cursor - filename_buffer};
-                    ppti_include_file(pp->it, filename);
+                    include_file(pp, filename);
                 } else if (tok->kind == PP_TOK_STR) {
                     string filename = tok->str;
 
                     ppti_eat(pp->it);
-                    ppti_include_file(pp->it, filename);
+                    include_file(pp, filename);
                 } else {
                     report_error_pp_token(tok, "Unexpected token (expected filename)");
                 }
@@ -714,6 +933,7 @@ process_pp_directive(preprocessor *pp) {
             }
         }
         result = true;
+        TR_END(TR_PHASE_DIRECTIVES);
     }
     return result;
 }
@@ -722,17 +942,17 @@ static void
 predefined_macro(preprocessor *pp, string name, string value) {
     pp_lexer lex = {0};
     pp_lexer_init(&lex, value.data, STRING_END(value));
+    lex.loc_base = sm_add_buffer((string)WRAPZ("BUILTIN"), value);
 
     linked_list_constructor tokens = {0};
     for (;;) {
         char buf[4096];
         uint32_t buf_len = 0;
 
-        pp_token *tok        = calloc(1, sizeof(pp_token));
+        pp_token *tok        = ba_alloc_struct(pp->a, pp_token);
         bool should_continue = pp_lexer_parse(&lex, tok, buf, sizeof(buf), &buf_len);
-        tok->loc.filename    = (string)WRAPZ("BUILTIN");
-        if (tok->str.data) {
-            tok->str = string_dup(tok->str);
+        if (buf_len) {
+            tok->str = ba_string_dup(pp->a, tok->str);
         }
         LLISTC_ADD_LAST(&tokens, tok);
         if (!should_continue) {
@@ -740,29 +960,34 @@ predefined_macro(preprocessor *pp, string name, string value) {
         }
     }
 
-    uint32_t name_hash = hash_string(name);
-    pp_macro **macrop  = GET_MACROP(pp, name_hash);
-    assert(!*macrop);
-    pp_macro *macro = calloc(1, sizeof(pp_token));
-    *macrop         = macro;
+    pp_macro *macro = ba_alloc_struct(pp->a, pp_macro);
+    macro->name     = intern_string(name);
+    assert(!get_macro(pp, macro->name));
+    pp_add_macro(pp, macro);
 
-    macro->name       = name;
-    macro->name_hash  = name_hash;
     macro->kind       = PP_MACRO_OBJ;
     macro->definition = tokens.first;
+    macro->is_builtin = true;
+    pp_compile_macro(macro, pp->a, false);
 }
 
 static void
-define_common_predefined_macros(preprocessor *pp, string filename) {
+define_file_predefined_macros(preprocessor *pp, string filename) {
     string file_onlyname = path_filename(filename);
     string file_name     = string_memprintf("\"%.*s\"", file_onlyname.len, file_onlyname.data);
     predefined_macro(pp, (string)WRAPZ("__FILE_NAME__"), file_name);
 
     string base_file = string_memprintf("\"%.*s\"", filename.len, filename.data);
     predefined_macro(pp, (string)WRAPZ("__BASE_FILE__"), base_file);
+}
 
-    time_t now    = time(0);
-    struct tm *tm = localtime(&now);
+static void
+define_common_predefined_macros(preprocessor *pp) {
+    // Reentrant version is used, as translation units can be processed in
+    // parallel
+    time_t now = time(0);
+    struct tm tm_storage;
+    struct tm *tm = localtime_r(&now, &tm_storage);
 
     static char *months[] = {
         "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
@@ -938,19 +1163,90 @@ __INTMAX_WIDTH__
     predefined_macro(pp, (string)WRAPZ("__alignof__"), (string)WRAPZ("_Alignof"));
 }
 
+// Defines common predefined macros in preprocessor that is never freed and
+// captures them
+static void
+init_builtin_snapshot(void) {
+    preprocessor *pp = calloc(1, sizeof(preprocessor));
+    pp->a            = calloc(1, sizeof(bump_allocator));
+    init_macro_table(pp);
+    define_common_predefined_macros(pp);
+    pp_builtin_snapshot = pps_capture(pp);
+}
+
+void
+pp_set_snapshot(pp_snapshot *snapshot) {
+    pp_user_snapshot = snapshot;
+}
+
 void
 pp_init(preprocessor *pp, string filename) {
-    define_common_predefined_macros(pp, filename);
+    pp->a      = calloc(1, sizeof(bump_allocator));
+    pp->expr_a = calloc(1, sizeof(bump_allocator));
+    pphs_init(&pp->hide_sets, pp->a);
+    init_macro_table(pp);
+
+    pthread_once(&pp_builtin_once, init_builtin_snapshot);
+    pps_apply(pp_builtin_snapshot, pp);
+    define_file_predefined_macros(pp, filename);
+    if (pp_user_snapshot) {
+        pps_apply(pp_user_snapshot, pp);
+    }
 
-    pp->it                  = calloc(1, sizeof(pp_token_iter));
-    pp->it->eof_token       = calloc(1, sizeof(pp_token));
+    pp->it                  = ba_alloc_struct(pp->a, pp_token_iter);
+    pp->it->a               = pp->a;
+    pp->it->tok_freelist    = &pp->tok_freelist;
+    pp->it->hide_sets       = &pp->hide_sets;
+    pp->it->eof_token       = ba_alloc_struct(pp->a, pp_token);
     pp->it->eof_token->kind = PP_TOK_EOF;
-    ppti_include_file(pp->it, filename);
+    include_file(pp, filename);
+}
+
+void
+pp_mark_pragma_once(preprocessor *pp, uint32_t file_idx) {
+    while (da_size(pp->pragma_once_marks) <= file_idx) {
+        da_push(pp->pragma_once_marks, false);
+    }
+    pp->pragma_once_marks[file_idx] = true;
+}
+
+bool
+pp_is_marked_pragma_once(preprocessor *pp, uint32_t file_idx) {
+    return file_idx < da_size(pp->pragma_once_marks) && pp->pragma_once_marks[file_idx];
+}
+
+void
+pp_add_macro(preprocessor *pp, pp_macro *macro) {
+    pp_macro_slot *slot = get_macro_slot(pp, macro->name);
+    if (!slot->macro) {
+        if ((uint64_t)(pp->macro_count + 1) * 100 >
+            (uint64_t)pp->macro_slot_count * PREPROCESSOR_MACRO_TABLE_MAX_LOAD) {
+            grow_macro_table(pp);
+            slot = get_macro_slot(pp, macro->name);
+        }
+        ++pp->macro_count;
+    }
+    slot->hash  = macro->name->hash;
+    slot->macro = macro;
+}
+
+void
+pp_free(preprocessor *pp) {
+    ba_free(pp->a);
+    ba_free(pp->expr_a);
+    da_free(pp->pragma_once_marks);
+    da_free(pp->macro_args);
+    pphs_free(&pp->hide_sets);
+    free(pp->macro_slots);
+    free(pp->a);
+    free(pp->expr_a);
+    memset(pp, 0, sizeof(preprocessor));
 }
 
 bool
 pp_parse(preprocessor *pp, struct token *tok, char *buf, uint32_t buf_size,
          uint32_t *buf_writtenp) {
+    TR_BEGIN(TR_PHASE_PREPROCESSING);
     for (;;) {
         if (expand_macro(pp, pp->it)) {
             continue;
@@ -965,24 +1261,19 @@ pp_parse(preprocessor *pp, struct token *tok, char *buf, uint32_t buf_size,
             break;
         }
 
-        if (!convert_pp_token(pp_tok, tok, buf, buf_size, buf_writtenp)) {
+        TR_BEGIN(TR_PHASE_TOKEN_CONVERSION);
+        bool is_converted = convert_pp_token(pp->a, pp_tok, tok, buf, buf_size, buf_writtenp);
+        TR_END(TR_PHASE_TOKEN_CONVERSION);
+        if (!is_converted) {
             report_error_pp_token(pp_tok, "Unexpected token");
             ppti_eat(pp->it);
             continue;
         }
 
-#if HOLOC_DEBUG
-        {
-            char buffer[4096];
-            uint32_t len     = fmt_token_verbose(buffer, sizeof(buffer), tok);
-            char *debug_info = malloc(len + 1);
-            memcpy(debug_info, buffer, len + 1);
-            tok->_debug_info = debug_info;
-        }
-#endif
         ppti_eat(pp->it);
         break;
     }
 
+    TR_END(TR_PHASE_PREPROCESSING);
     return tok->kind != TOK_EOF;
 }
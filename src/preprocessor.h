@@ -3,23 +3,63 @@
 
 #include "general.h"
 
+#include "pp_hide_set.h"
+
 struct pp_lexer;
 struct bump_allocator;
 struct pp_token;
 struct c_type;
 struct token;
 struct pp_token_iter;
+struct file;
+struct interned_string;
+struct pp_snapshot;
 
-#define PREPROCESSOR_MACRO_HASH_SIZE 2048
+// Initial number of slots of macro table. Table is grown when it is more than
+// PREPROCESSOR_MACRO_TABLE_MAX_LOAD percent full, so probe sequences stay
+// short.
+#define PREPROCESSOR_MACRO_TABLE_INITIAL_SIZE 1024
+#define PREPROCESSOR_MACRO_TABLE_MAX_LOAD 70
 
 typedef struct pp_macro_arg {
     struct pp_macro_arg *next;
     // Name of the argument (__VA_ARGS__ for variadic arguments)
-    string name;
-    // Linked list of expansion. Terminated with EOF
-    struct pp_token *toks;
+    struct interned_string *name;
 } pp_macro_arg;
 
+typedef enum {
+    // Token of definition is copied
+    PP_MACRO_OP_TOKEN = 0x1,
+    // Tokens of fully macro-expanded argument are copied
+    PP_MACRO_OP_PARAM = 0x2,
+    // Argument is converted to string literal (#)
+    PP_MACRO_OP_STRINGIFY = 0x3,
+    // Tokens of argument are copied without expansion, as they are operand
+    // of ##
+    PP_MACRO_OP_UNEXPANDED_PARAM = 0x4,
+} pp_macro_op_kind;
+
+typedef enum {
+    // Argument is used fully macro-expanded
+    PP_MACRO_PARAM_EXPANDED = 0x1,
+    // Argument is used as written, by # or ##
+    PP_MACRO_PARAM_UNEXPANDED = 0x2,
+} pp_macro_param_flags;
+
+// Element of compiled definition of macro. Parameters and operators are
+// resolved when macro is defined, so expansion is a single pass that doesn't
+// look up arguments by name.
+typedef struct pp_macro_op {
+    pp_macro_op_kind kind;
+    // If op uses argument, index of parameter in args of macro
+    uint32_t param_idx;
+    // First token produced by op is pasted to the last token of previous op
+    // (##)
+    bool is_pasted;
+    // Token of definition
+    struct pp_token *tok;
+} pp_macro_op;
+
 typedef enum {
     // Object-like macro
     PP_MACRO_OBJ = 0x1,
@@ -40,11 +80,8 @@ typedef enum {
 
 // Container for macros
 typedef struct pp_macro {
-    struct pp_macro *next;
-    // Name (like _NDBEBUG)
-    string name;
-    // Used in hash table
-    uint32_t name_hash;
+    // Name (like _NDBEBUG). Hash of interned string is used in hash table.
+    struct interned_string *name;
 
     pp_macro_kind kind;
     // If function-like
@@ -53,8 +90,25 @@ typedef struct pp_macro {
     pp_macro_arg *args;
     // Linked list of definition. Terminated with EOF
     struct pp_token *definition;
+    // Definition compiled with pp_compile_macro
+    pp_macro_op *ops;
+    uint32_t op_count;
+    // How parameters are used in definition (pp_macro_param_flags), indexed
+    // by parameter
+    uint8_t *param_flags;
+    // Defined by compiler. Such macros are not saved to snapshots, as they
+    // are defined in every translation unit anyway.
+    bool is_builtin;
 } pp_macro;
 
+// Slot of macro table
+typedef struct pp_macro_slot {
+    // Hash of name, copied so that probing doesn't touch macros
+    uint32_t hash;
+    // NULL if slot is empty
+    pp_macro *macro;
+} pp_macro_slot;
+
 // Stores inofromation about conditional include stack (#if's)
 typedef struct pp_conditional_include {
     struct pp_conditional_include *next;
@@ -66,7 +120,14 @@ typedef struct pp_conditional_include {
 } pp_conditional_include;
 
 typedef struct preprocessor {
-    struct allocator *a;
+    // Allocator for memory that lives as long as translation unit
+    struct bump_allocator *a;
+    // Allocator for memory used during evaluation of single #if expression.
+    // Cleared after each evaluation.
+    struct bump_allocator *expr_a;
+    // Freelists
+    struct pp_token *tok_freelist;
+    pp_conditional_include *cond_incl_freelist;
 
     struct pp_token_iter *it;
     // Value for __COUNTER__
@@ -74,11 +135,41 @@ typedef struct preprocessor {
     // Stack of conditional includes. Pointer because default level is not an
     // include.
     pp_conditional_include *cond_incl_stack;
-    // Macro hash table
-    pp_macro *macro_hash[PREPROCESSOR_MACRO_HASH_SIZE];
+    // Macro hash table with open addressing and linear probing. Size is power
+    // of two.
+    pp_macro_slot *macro_slots;
+    uint32_t macro_slot_count;
+    uint32_t macro_count;
+    // Marks of files that were marked with #pragma once in this translation
+    // unit, indexed by index of file (see file_storage.h). Array is grown when
+    // file past its end is marked.
+    bool *pragma_once_marks;  // da
+    // Tokens of arguments of function-like macro invocations that are being
+    // expanded. Used as stack, as arguments are expanded recursively: each
+    // invocation pushes its arguments and then their expansions, indexed by
+    // parameter.
+    struct pp_token **macro_args;  // da
+    // Hide sets of tokens produced by macro expansion
+    pp_hide_set_table hide_sets;
 } preprocessor;
 
 void pp_init(preprocessor *pp, string filename);
+// Sets snapshot of macros that is applied to every preprocessor after
+// builtin macros are defined, see pp_snapshot.h. Must be set before
+// translation units are processed.
+void pp_set_snapshot(struct pp_snapshot *snapshot);
+// Compiles definition of macro to ops allocated with a. Errors in use of
+// operators are reported if should_report_errors is set, otherwise such
+// operators are treated as regular tokens.
+void pp_compile_macro(pp_macro *macro, struct bump_allocator *a, bool should_report_errors);
+// Adds macro to macro table of preprocessor, replacing macro with the same
+// name if it is defined
+void pp_add_macro(preprocessor *pp, pp_macro *macro);
+// Marks file with given index as having #pragma once in this translation unit
+void pp_mark_pragma_once(preprocessor *pp, uint32_t file_idx);
+bool pp_is_marked_pragma_once(preprocessor *pp, uint32_t file_idx);
+// Releases all memory used by preprocessor in one go
+void pp_free(preprocessor *pp);
 bool pp_parse(preprocessor *pp, struct token *tok, char *buf, uint32_t buf_size,
               uint32_t *buf_writtenp);
 
@@ -0,0 +1,207 @@
+#include "source_manager.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "darray.h"
+#include "error_reporter.h"
+#include "str.h"
+
+// Location 0 is reserved for tokens that don't have location
+static source_manager sm_ = {.mutex = PTHREAD_MUTEX_INITIALIZER, .next_loc = 1};
+static source_manager *sm = &sm_;
+// Chunk that expansions of this thread are given out from
+static THREAD_LOCAL sm_chunk *sm_thread_chunk;
+
+source_manager *
+get_source_manager(void) {
+    return sm;
+}
+
+// Reserves given number of locations and returns the first of them. Returns
+// 0 and reports error once if they don't fit in source_loc.
+static source_loc
+reserve_locations(uint32_t size) {
+    source_loc result = 0;
+    uint64_t base     = __atomic_fetch_add(&sm->next_loc, size, __ATOMIC_RELAXED);
+    if (base + size <= (uint64_t)UINT32_MAX + 1) {
+        result = base;
+    } else if (!__atomic_exchange_n(&sm->is_exhausted, true, __ATOMIC_RELAXED)) {
+        report_error(0, "Too much source in translation: all %u source locations are used",
+                     UINT32_MAX);
+    }
+    return result;
+}
+
+// Inserts range so that ranges stay sorted. Ranges are reserved before lock
+// is taken, so they can come out of order. Must be called with lock held.
+static void
+insert_range(sm_range_kind kind, uint32_t value, source_loc base) {
+    sm_range range = {0};
+    range.base     = base;
+    range.kind     = kind;
+    range.value    = value;
+    da_push(sm->ranges, range);
+    uint32_t idx = da_size(sm->ranges) - 1;
+    for (; idx && sm->ranges[idx - 1].base > base; --idx) {
+        sm->ranges[idx] = sm->ranges[idx - 1];
+    }
+    sm->ranges[idx] = range;
+}
+
+source_loc
+sm_add_buffer(string name, string contents) {
+    // One more location for the end of buffer
+    source_loc base = reserve_locations(contents.len + 1);
+    if (base) {
+        sm_buffer *buffer = calloc(1, sizeof(sm_buffer));
+        buffer->name      = name;
+        buffer->contents  = contents;
+        buffer->base      = base;
+        pthread_mutex_lock(&sm->mutex);
+        insert_range(SM_RANGE_BUFFER, da_size(sm->buffers), base);
+        da_push(sm->buffers, buffer);
+        pthread_mutex_unlock(&sm->mutex);
+    }
+    return base;
+}
+
+// Takes new chunk of at least given number of locations for this thread.
+// Returns NULL if locations are exhausted.
+static sm_chunk *
+add_chunk(uint32_t min_size) {
+    uint32_t size   = min_size > SM_CHUNK_SIZE ? min_size : SM_CHUNK_SIZE;
+    source_loc base = reserve_locations(size);
+    sm_chunk *chunk = NULL;
+    if (base) {
+        chunk       = calloc(1, sizeof(sm_chunk));
+        chunk->base = base;
+        chunk->size = size;
+        pthread_mutex_lock(&sm->mutex);
+        insert_range(SM_RANGE_CHUNK, da_size(sm->chunks), base);
+        da_push(sm->chunks, chunk);
+        pthread_mutex_unlock(&sm->mutex);
+    }
+    return chunk;
+}
+
+source_loc
+sm_add_expansion(source_loc invocation, uint32_t count) {
+    sm_chunk *chunk = sm_thread_chunk;
+    if (!chunk || chunk->range_count == SM_CHUNK_RANGE_COUNT ||
+        chunk->size - chunk->used < count) {
+        chunk           = add_chunk(count);
+        sm_thread_chunk = chunk;
+    }
+
+    source_loc result = 0;
+    if (chunk) {
+        sm_range *range = chunk->ranges + chunk->range_count;
+        range->base     = chunk->base + chunk->used;
+        range->kind     = SM_RANGE_EXPANSION;
+        range->value    = invocation;
+        chunk->used += count;
+        // Publish range to threads that resolve locations
+        __atomic_store_n(&chunk->range_count, chunk->range_count + 1, __ATOMIC_RELEASE);
+        result = range->base;
+    }
+    return result;
+}
+
+// Binary search for the last of sorted ranges that starts before loc. Returns
+// NULL if there is none.
+static sm_range *
+find_range(sm_range *ranges, uint32_t count, source_loc loc) {
+    sm_range *result = NULL;
+    if (count && ranges[0].base <= loc) {
+        uint32_t low  = 0;
+        uint32_t high = count;
+        while (low + 1 < high) {
+            uint32_t mid = (low + high) / 2;
+            if (ranges[mid].base <= loc) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        result = ranges + low;
+    }
+    return result;
+}
+
+// Returns buffer or expansion range containing given location. Must be called
+// with lock held.
+static sm_range *
+get_range(source_loc loc) {
+    sm_range *result = NULL;
+    if (loc && loc < __atomic_load_n(&sm->next_loc, __ATOMIC_RELAXED)) {
+        result = find_range(sm->ranges, da_size(sm->ranges), loc);
+        if (result && result->kind == SM_RANGE_CHUNK) {
+            sm_chunk *chunk = sm->chunks[result->value];
+            uint32_t count  = __atomic_load_n(&chunk->range_count, __ATOMIC_ACQUIRE);
+            result          = find_range(chunk->ranges, count, loc);
+        }
+    }
+    return result;
+}
+
+static void
+compute_line_starts(sm_buffer *buffer) {
+    char *data = buffer->contents.data;
+    char *eof  = STRING_END(buffer->contents);
+    da_push(buffer->line_starts, 0);
+    for (char *cursor = data; cursor < eof; ++cursor) {
+        cursor = memchr(cursor, '\n', eof - cursor);
+        if (!cursor) {
+            break;
+        }
+        da_push(buffer->line_starts, cursor + 1 - data);
+    }
+}
+
+// Binary search for the last of sorted values that is not greater than value
+static uint32_t
+find_last_not_greater(uint32_t *values, uint32_t count, uint32_t value) {
+    uint32_t low  = 0;
+    uint32_t high = count;
+    while (low + 1 < high) {
+        uint32_t mid = (low + high) / 2;
+        if (values[mid] <= value) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+sm_location
+sm_resolve(source_loc loc) {
+    sm_location result = {0};
+    pthread_mutex_lock(&sm->mutex);
+    sm_range *range = get_range(loc);
+    // Expansions are resolved to location of invocation, which may also be
+    // part of expansion.
+    while (range && range->kind == SM_RANGE_EXPANSION) {
+        loc   = range->value;
+        range = get_range(loc);
+    }
+
+    if (range) {
+        sm_buffer *buffer = sm->buffers[range->value];
+        if (!buffer->line_starts) {
+            compute_line_starts(buffer);
+        }
+
+        uint32_t offset = loc - buffer->base;
+        uint32_t line =
+            find_last_not_greater(buffer->line_starts, da_size(buffer->line_starts), offset);
+        result.buffer = buffer;
+        result.offset = offset;
+        result.line   = line + 1;
+        result.col    = offset - buffer->line_starts[line] + 1;
+    }
+    pthread_mutex_unlock(&sm->mutex);
+    return result;
+}
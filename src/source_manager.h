@@ -0,0 +1,108 @@
+// Defines source manager, which gives every location in translation a single
+// 32-bit number (source_loc). Each loaded file or buffer of builtin source gets
+// its own contiguous range of locations, one per byte of contents and one for
+// the end of file. Each macro expansion gets a range with one location per
+// produced token, which maps back to the location of macro invocation.
+//
+// This way tokens and ast nodes store 4 bytes instead of file name, line and
+// column, and copying location on macro expansion is just a number assignment.
+// Line and column are only needed when location is shown to the user, so they
+// are computed lazily using line table of buffer, which is built on first
+// request.
+//
+// Locations are never freed, and ranges are kept sorted by location, so they
+// are found with binary search.
+//
+// Source manager is shared by translation units that are processed in
+// parallel. Locations are reserved with atomic increment, and buffers are
+// registered under lock. Expansions are much more frequent, so each thread
+// takes a chunk of locations at once and gives out expansion ranges from it
+// without locking. If 32-bit locations are exhausted, error is reported and
+// location 0 is given out.
+#ifndef SOURCE_MANAGER_H
+#define SOURCE_MANAGER_H
+
+#include "general.h"
+
+#include <pthread.h>
+
+// Number of locations and expansion ranges of single chunk
+#define SM_CHUNK_SIZE 16384
+#define SM_CHUNK_RANGE_COUNT 1024
+
+typedef enum {
+    SM_RANGE_BUFFER    = 0x1,
+    SM_RANGE_EXPANSION = 0x2,
+    SM_RANGE_CHUNK     = 0x3,
+} sm_range_kind;
+
+// Buffer of source, typically contents of file.
+typedef struct sm_buffer {
+    string name;
+    string contents;
+    source_loc base;
+    // Byte offsets of starts of lines (da). Computed on first request.
+    uint32_t *line_starts;
+} sm_buffer;
+
+// Contiguous range of locations
+typedef struct sm_range {
+    source_loc base;
+    sm_range_kind kind;
+    // Index of buffer if range is buffer, location of macro invocation if
+    // range is expansion, index of chunk if range is chunk.
+    uint32_t value;
+} sm_range;
+
+// Chunk of locations that belongs to one thread, which gives out expansion
+// ranges from it. Ranges are written only by the owning thread, and
+// range_count is stored with release after range is written, so other
+// threads can read ranges below it.
+typedef struct sm_chunk {
+    source_loc base;
+    uint32_t size;
+    // Number of locations given out
+    uint32_t used;
+    uint32_t range_count;
+    sm_range ranges[SM_CHUNK_RANGE_COUNT];
+} sm_chunk;
+
+// Location resolved to a human-readable form
+typedef struct sm_location {
+    // Buffer that location belongs to. NULL if location is invalid.
+    sm_buffer *buffer;
+    // Byte offset in buffer
+    uint32_t offset;
+    // Line and column starting from 1. Column is counted in bytes.
+    uint32_t line;
+    uint32_t col;
+} sm_location;
+
+typedef struct source_manager {
+    // Protects buffers, chunks and ranges
+    pthread_mutex_t mutex;
+    sm_buffer **buffers;  // da
+    sm_chunk **chunks;    // da
+    // Ranges of buffers and chunks
+    sm_range *ranges;  // da
+    // First location that is not reserved yet. It is wider than source_loc,
+    // so that exhausting locations doesn't wrap it.
+    uint64_t next_loc;
+    bool is_exhausted;
+} source_manager;
+
+source_manager *get_source_manager(void);
+
+// Registers buffer with given name and contents and returns location of its
+// first byte. Location of byte at offset i is base + i, location of end of
+// buffer is base + contents.len. Returns 0 if locations are exhausted.
+source_loc sm_add_buffer(string name, string contents);
+// Gives out range of 'count' locations for tokens produced by macro expansion
+// at location 'invocation'. Returns first location of range, or 0 if
+// locations are exhausted.
+source_loc sm_add_expansion(source_loc invocation, uint32_t count);
+// Computes file, line and column of location. Locations from macro expansions
+// are resolved to location of macro invocation.
+sm_location sm_resolve(source_loc loc);
+
+#endif
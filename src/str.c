@@ -100,6 +100,7 @@ string_rfind(string str, char symb) {
             if (str.data[idx1 - 1] == symb) {
                 result.is_found = true;
                 result.idx      = idx1 - 1;
+                break;
             }
         }
     }
@@ -0,0 +1,123 @@
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Takes job from the front of queue. Returns false if queue is empty.
+static bool
+pop_front(tp_queue *queue, uint32_t *job_idxp) {
+    bool result = false;
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->first != queue->last) {
+        *job_idxp = queue->jobs[queue->first++];
+        result    = true;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return result;
+}
+
+// Takes job from the back of queue. Returns false if queue is empty.
+static bool
+pop_back(tp_queue *queue, uint32_t *job_idxp) {
+    bool result = false;
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->first != queue->last) {
+        *job_idxp = queue->jobs[--queue->last];
+        result    = true;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return result;
+}
+
+static bool
+get_job(thread_pool *pool, uint32_t worker_idx, uint32_t *job_idxp) {
+    bool result = pop_front(pool->queues + worker_idx, job_idxp);
+    // Steal from other workers, starting from the next one, so that thieves
+    // don't all go to the same queue
+    for (uint32_t i = 1; i < pool->worker_count && !result; ++i) {
+        uint32_t victim = (worker_idx + i) % pool->worker_count;
+        result          = pop_back(pool->queues + victim, job_idxp);
+    }
+    return result;
+}
+
+static void *
+worker_proc(void *arg) {
+    tp_worker *worker = arg;
+    thread_pool *pool = worker->pool;
+    uint32_t job_idx;
+    // Jobs are never added after start, so worker can exit when all queues
+    // are empty
+    while (get_job(pool, worker->idx, &job_idx)) {
+        pool->func(pool->data, job_idx, worker->idx);
+
+        pthread_mutex_lock(&pool->done_mutex);
+        pool->is_job_done[job_idx] = true;
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->done_mutex);
+    }
+    return NULL;
+}
+
+void
+tp_start(thread_pool *pool, uint32_t worker_count, uint32_t job_count, tp_job_func *func,
+         void *data) {
+    assert(worker_count);
+    memset(pool, 0, sizeof(*pool));
+    pool->worker_count = worker_count;
+    pool->job_count    = job_count;
+    pool->func         = func;
+    pool->data         = data;
+    pool->is_job_done  = calloc(job_count, sizeof(bool));
+    pthread_mutex_init(&pool->done_mutex, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    pool->queues = calloc(worker_count, sizeof(tp_queue));
+    for (uint32_t i = 0; i < worker_count; ++i) {
+        tp_queue *queue = pool->queues + i;
+        pthread_mutex_init(&queue->mutex, NULL);
+        queue->jobs = calloc(job_count / worker_count + 1, sizeof(uint32_t));
+    }
+    for (uint32_t job_idx = 0; job_idx < job_count; ++job_idx) {
+        tp_queue *queue            = pool->queues + job_idx % worker_count;
+        queue->jobs[queue->last++] = job_idx;
+    }
+
+    pool->workers = calloc(worker_count, sizeof(tp_worker));
+    for (uint32_t i = 0; i < worker_count; ++i) {
+        tp_worker *worker = pool->workers + i;
+        worker->pool      = pool;
+        worker->idx       = i;
+        int error         = pthread_create(&worker->thread, NULL, worker_proc, worker);
+        assert(!error);
+        (void)error;
+    }
+}
+
+void
+tp_wait_job(thread_pool *pool, uint32_t job_idx) {
+    assert(job_idx < pool->job_count);
+    pthread_mutex_lock(&pool->done_mutex);
+    while (!pool->is_job_done[job_idx]) {
+        pthread_cond_wait(&pool->done_cond, &pool->done_mutex);
+    }
+    pthread_mutex_unlock(&pool->done_mutex);
+}
+
+void
+tp_finish(thread_pool *pool) {
+    for (uint32_t i = 0; i < pool->worker_count; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (uint32_t i = 0; i < pool->worker_count; ++i) {
+        pthread_mutex_destroy(&pool->queues[i].mutex);
+        free(pool->queues[i].jobs);
+    }
+    pthread_mutex_destroy(&pool->done_mutex);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->queues);
+    free(pool->workers);
+    free(pool->is_job_done);
+    memset(pool, 0, sizeof(*pool));
+}
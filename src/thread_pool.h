@@ -0,0 +1,56 @@
+// Thread pool for running independent jobs, like translation units, in
+// parallel. Jobs are identified by index. Each worker has its own queue of
+// jobs, which are initially distributed round-robin, so that jobs with lower
+// indices are started first. Worker takes jobs from the front of its own
+// queue, and when it is empty, steals from the back of other queues. Jobs
+// are coarse (whole translation unit), so queues are protected with mutexes.
+//
+// Caller can wait for completion of specific job, which allows to consume
+// results in order of jobs while later jobs are still running.
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "general.h"
+
+#include <pthread.h>
+
+typedef void tp_job_func(void *data, uint32_t job_idx, uint32_t worker_idx);
+
+typedef struct tp_queue {
+    pthread_mutex_t mutex;
+    // Job indices. Jobs in [first, last) are not yet taken.
+    uint32_t *jobs;
+    uint32_t first;
+    uint32_t last;
+} tp_queue;
+
+typedef struct tp_worker {
+    struct thread_pool *pool;
+    uint32_t idx;
+    pthread_t thread;
+} tp_worker;
+
+typedef struct thread_pool {
+    uint32_t worker_count;
+    tp_worker *workers;
+    tp_queue *queues;
+
+    tp_job_func *func;
+    void *data;
+
+    // Completion of jobs
+    pthread_mutex_t done_mutex;
+    pthread_cond_t done_cond;
+    bool *is_job_done;
+    uint32_t job_count;
+} thread_pool;
+
+// Starts worker_count threads that run func for each job in [0, job_count)
+void tp_start(thread_pool *pool, uint32_t worker_count, uint32_t job_count, tp_job_func *func,
+              void *data);
+// Blocks until given job is finished
+void tp_wait_job(thread_pool *pool, uint32_t job_idx);
+// Waits for all jobs and releases resources of pool
+void tp_finish(thread_pool *pool);
+
+#endif
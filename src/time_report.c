@@ -0,0 +1,132 @@
+// clock_gettime is POSIX
+#define _POSIX_C_SOURCE 199309L
+
+#include "time_report.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static time_report tr_instance;
+THREAD_LOCAL time_report *tr_ = &tr_instance;
+// Protects main report when reports of worker threads are merged into it
+static pthread_mutex_t tr_merge_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static char *phase_names[] = {
+    [TR_PHASE_FILE_LOADING]     = "file loading",
+    [TR_PHASE_LEXING]           = "lexing",
+    [TR_PHASE_PREPROCESSING]    = "preprocessing",
+    [TR_PHASE_MACRO_EXPANSION]  = "macro expansion",
+    [TR_PHASE_DIRECTIVES]       = "directive processing",
+    [TR_PHASE_TOKEN_CONVERSION] = "token conversion",
+    [TR_PHASE_PARSING]          = "parsing",
+};
+
+static char *counter_names[] = {
+    [TR_COUNTER_TOKENS_LEXED]       = "tokens lexed",
+    [TR_COUNTER_MACROS_EXPANDED]    = "macros expanded",
+    [TR_COUNTER_FILES_OPENED]       = "files opened",
+    [TR_COUNTER_BYTES_READ]         = "bytes read",
+    [TR_COUNTER_LEXED_FILES_REUSED] = "lexed files reused",
+    [TR_COUNTER_ALLOCATIONS]        = "allocations",
+};
+
+double
+tr_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+time_report *
+get_time_report(void) {
+    return tr_;
+}
+
+void
+tr_begin_thread(time_report *report) {
+    memset(report, 0, sizeof(*report));
+    report->is_enabled = tr_instance.is_enabled;
+    report->start_time = tr_instance.start_time;
+    tr_                = report;
+}
+
+void
+tr_end_thread(void) {
+    assert(tr_ != &tr_instance && !tr_->phase_depth);
+    pthread_mutex_lock(&tr_merge_mutex);
+    for (uint32_t phase = 0; phase < TR_PHASE_COUNT; ++phase) {
+        tr_instance.phase_time[phase] += tr_->phase_time[phase];
+        tr_instance.phase_calls[phase] += tr_->phase_calls[phase];
+    }
+    for (uint32_t counter = 0; counter < TR_COUNTER_COUNT; ++counter) {
+        tr_instance.counters[counter] += tr_->counters[counter];
+    }
+    pthread_mutex_unlock(&tr_merge_mutex);
+    tr_ = &tr_instance;
+}
+
+void
+tr_enable(void) {
+    tr_->is_enabled = true;
+    tr_->start_time = tr_get_time();
+}
+
+void
+tr_begin(tr_phase phase) {
+    double now = tr_get_time();
+    if (tr_->phase_depth) {
+        tr_phase top = tr_->phase_stack[tr_->phase_depth - 1];
+        tr_->phase_time[top] += now - tr_->top_start_time;
+    }
+    assert(tr_->phase_depth < TR_MAX_PHASE_DEPTH);
+    tr_->phase_stack[tr_->phase_depth++] = phase;
+    ++tr_->phase_calls[phase];
+    tr_->top_start_time = now;
+}
+
+void
+tr_end(tr_phase phase) {
+    double now = tr_get_time();
+    assert(tr_->phase_depth && tr_->phase_stack[tr_->phase_depth - 1] == phase);
+    tr_->phase_time[phase] += now - tr_->top_start_time;
+    --tr_->phase_depth;
+    tr_->top_start_time = now;
+}
+
+void
+tr_print(void) {
+    if (!tr_->is_enabled) {
+        return;
+    }
+
+    double total       = tr_get_time() - tr_->start_time;
+    double phase_total = 0;
+    for (uint32_t phase = 0; phase < TR_PHASE_COUNT; ++phase) {
+        phase_total += tr_->phase_time[phase];
+    }
+    // With multiple threads phases can take longer than total time, then
+    // percentages are taken of time summed over threads.
+    double other = total > phase_total ? total - phase_total : 0;
+    double base  = total > phase_total ? total : phase_total;
+
+    fflush(stdout);
+    fprintf(stderr, "===== Time report =====\n");
+    fprintf(stderr, "%-24s %12s %8s %12s\n", "phase", "time (ms)", "%", "calls");
+    for (uint32_t phase = 0; phase < TR_PHASE_COUNT; ++phase) {
+        double time = tr_->phase_time[phase];
+        fprintf(stderr, "%-24s %12.3f %7.1f%% %12llu\n", phase_names[phase], time * 1e3,
+                base > 0 ? time / base * 100 : 0,
+                (unsigned long long)tr_->phase_calls[phase]);
+    }
+    fprintf(stderr, "%-24s %12.3f %7.1f%%\n", "other", other * 1e3,
+            base > 0 ? other / base * 100 : 0);
+    fprintf(stderr, "%-24s %12.3f\n", "total", total * 1e3);
+    fprintf(stderr, "\n%-24s %12s\n", "counter", "value");
+    for (uint32_t counter = 0; counter < TR_COUNTER_COUNT; ++counter) {
+        fprintf(stderr, "%-24s %12llu\n", counter_names[counter],
+                (unsigned long long)tr_->counters[counter]);
+    }
+}
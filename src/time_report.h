@@ -0,0 +1,95 @@
+// Instrumentation of compiler stages. Time spent in each phase and a number of
+// counters are collected during compilation and printed as a table at exit,
+// when enabled with --time-report.
+//
+// Phases nest: when one phase begins inside another, time of the outer one is
+// paused. So time of each phase is exclusive, and sum over all phases is the
+// total time spent in instrumented code. For example, file loading that
+// happens while processing #include is not counted as directive processing.
+//
+// When translation units are processed in parallel, each worker thread
+// collects its own report, which is merged into the main one when worker is
+// done. Then phase times are summed over threads and can exceed total time.
+#ifndef TIME_REPORT_H
+#define TIME_REPORT_H
+
+#include "general.h"
+
+#define TR_MAX_PHASE_DEPTH 64
+
+typedef enum {
+    // Loading files from disk, including translation phases 1 and 2
+    TR_PHASE_FILE_LOADING,
+    // Producing preprocessing tokens from files
+    TR_PHASE_LEXING,
+    // Bookkeeping of preprocessor that is not covered by other phases
+    TR_PHASE_PREPROCESSING,
+    TR_PHASE_MACRO_EXPANSION,
+    TR_PHASE_DIRECTIVES,
+    // Converting preprocessing tokens to c tokens
+    TR_PHASE_TOKEN_CONVERSION,
+    TR_PHASE_PARSING,
+    TR_PHASE_COUNT
+} tr_phase;
+
+typedef enum {
+    TR_COUNTER_TOKENS_LEXED,
+    TR_COUNTER_MACROS_EXPANDED,
+    TR_COUNTER_FILES_OPENED,
+    TR_COUNTER_BYTES_READ,
+    // Includes that used tokens from token cache instead of lexing
+    TR_COUNTER_LEXED_FILES_REUSED,
+    // Allocations made with bump allocator
+    TR_COUNTER_ALLOCATIONS,
+    TR_COUNTER_COUNT
+} tr_counter;
+
+typedef struct time_report {
+    bool is_enabled;
+    // Time when report was enabled. Time outside of all phases is counted
+    // from it.
+    double start_time;
+    // Stack of active phases. Only the top one accumulates time, which is
+    // counted from top_start_time.
+    tr_phase phase_stack[TR_MAX_PHASE_DEPTH];
+    uint32_t phase_depth;
+    double top_start_time;
+
+    double phase_time[TR_PHASE_COUNT];
+    uint64_t phase_calls[TR_PHASE_COUNT];
+    uint64_t counters[TR_COUNTER_COUNT];
+} time_report;
+
+// Report is accessed directly in instrumentation macros, so that disabled
+// timers and counters only cost a branch or an add in hot paths. It points to
+// the main report, or to report of worker thread.
+extern THREAD_LOCAL time_report *tr_;
+
+time_report *get_time_report(void);
+// Returns monotonic time in seconds
+double tr_get_time(void);
+void tr_enable(void);
+void tr_begin(tr_phase phase);
+void tr_end(tr_phase phase);
+void tr_print(void);
+// Makes current thread collect into given report, which is reset.
+void tr_begin_thread(time_report *report);
+// Adds report of current thread to the main one
+void tr_end_thread(void);
+
+#define TR_BEGIN(_phase)        \
+    do {                        \
+        if (tr_->is_enabled) {  \
+            tr_begin(_phase);   \
+        }                       \
+    } while (0)
+#define TR_END(_phase)          \
+    do {                        \
+        if (tr_->is_enabled) {  \
+            tr_end(_phase);     \
+        }                       \
+    } while (0)
+// Counters are incremented unconditionally, as it is cheaper than checking
+#define TR_COUNT(_counter, _value) (tr_->counters[_counter] += (_value))
+
+#endif
@@ -0,0 +1,148 @@
+#include "token_cache.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "file_storage.h"
+#include "hashing.h"
+#include "pp_lexer.h"
+#include "str.h"
+#include "time_report.h"
+
+static pp_token_cache ptc_ = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+static pp_token_cache *ptc = &ptc_;
+
+// Memory used for lexing before tokens are copied to the cache. It is kept
+// between files, so that lexing doesn't request memory from system each time.
+static THREAD_LOCAL bump_allocator ptc_scratch;
+
+pp_token_cache *
+get_token_cache(void) {
+    return ptc;
+}
+
+// Makes header of token array for given file. Must be called with lock held.
+static pp_token_array *
+make_file_tokens(pp_token_array *tokens, file *f) {
+    pp_token_array *result = ba_alloc_struct(&ptc->a, pp_token_array);
+    *result                = *tokens;
+    result->data           = f->contents.data;
+    result->loc_base       = f->loc_base;
+    return result;
+}
+
+// Returns tokens of file if it or file with the same contents is already
+// lexed. Must be called with lock held.
+static pp_token_array *
+find_file_tokens(file *f, uint32_t hash) {
+    if (!f->tokens) {
+        ptc_entry *entry = ptc->hash[hash % PTC_HASH_SIZE];
+        while (entry && !(entry->hash == hash && string_eq(entry->contents, f->contents))) {
+            entry = entry->next;
+        }
+        if (entry) {
+            f->tokens = make_file_tokens(entry->tokens, f);
+        }
+    }
+    return f->tokens;
+}
+
+// Copies arrays of tokens to memory of cache. Must be called with lock held.
+static pp_token_array *
+copy_tokens(pp_token_array *tokens) {
+    bump_allocator *a      = &ptc->a;
+    uint32_t count         = tokens->token_count;
+    pp_token_array *result = ba_alloc_struct(a, pp_token_array);
+    *result                = *tokens;
+    result->kinds          = ba_alloc_array(a, uint32_t, count);
+    result->values         = ba_alloc_array(a, uint32_t, count);
+    result->offsets        = ba_alloc_array(a, uint32_t, count);
+    memcpy(result->kinds, tokens->kinds, count * sizeof(uint32_t));
+    memcpy(result->values, tokens->values, count * sizeof(uint32_t));
+    memcpy(result->offsets, tokens->offsets, count * sizeof(uint32_t));
+    // Empty arrays are NULL, and are not passed to memcpy
+    result->strings = NULL;
+    if (tokens->string_count) {
+        result->strings = ba_alloc_array(a, string, tokens->string_count);
+        for (uint32_t i = 0; i < tokens->string_count; ++i) {
+            result->strings[i] = ba_string_dup(a, tokens->strings[i]);
+        }
+    }
+    result->groups = NULL;
+    if (tokens->group_count) {
+        result->groups = ba_alloc_array(a, pp_token_group, tokens->group_count);
+        memcpy(result->groups, tokens->groups,
+               tokens->group_count * sizeof(pp_token_group));
+    }
+    return result;
+}
+
+pp_token_array *
+ptc_get_file_tokens(file *f) {
+    pthread_mutex_lock(&ptc->mutex);
+    pp_token_array *tokens = f->tokens;
+    pthread_mutex_unlock(&ptc->mutex);
+
+    uint32_t hash = 0;
+    if (!tokens) {
+        hash = hash_string(f->contents);
+        pthread_mutex_lock(&ptc->mutex);
+        tokens = find_file_tokens(f, hash);
+        pthread_mutex_unlock(&ptc->mutex);
+    }
+
+    if (tokens) {
+        TR_COUNT(TR_COUNTER_LEXED_FILES_REUSED, 1);
+    } else {
+        // Lexing is done without holding lock. If other thread lexes the same
+        // contents at the same time, one of results is thrown away.
+        pp_lexer lex = {0};
+        pp_lexer_init(&lex, f->contents.data, STRING_END(f->contents));
+        lex.loc_base          = f->loc_base;
+        pp_token_array *lexed = pp_lexer_lex_all(&lex, &ptc_scratch);
+
+        pthread_mutex_lock(&ptc->mutex);
+        tokens = find_file_tokens(f, hash);
+        if (!tokens) {
+            ptc_entry *entry = ba_alloc_struct(&ptc->a, ptc_entry);
+            entry->hash      = hash;
+            entry->contents  = f->contents;
+            entry->tokens    = copy_tokens(lexed);
+            ptc_entry **slot = ptc->hash + hash % PTC_HASH_SIZE;
+            entry->next      = *slot;
+            *slot            = entry;
+            f->tokens        = entry->tokens;
+            tokens           = f->tokens;
+        }
+        pthread_mutex_unlock(&ptc->mutex);
+        ba_clear(&ptc_scratch);
+    }
+    return tokens;
+}
+
+void
+ptc_get_group_tokens(pp_token_array *tokens, pp_token_group *group, pp_token_array *result) {
+    pthread_mutex_lock(&ptc->mutex);
+    pp_token_array *group_tokens = group->tokens;
+    pthread_mutex_unlock(&ptc->mutex);
+
+    if (!group_tokens) {
+        // Group is lexed without holding lock too
+        pp_lexer lex = {0};
+        pp_lexer_init(&lex, tokens->data, tokens->data + group->end);
+        lex.loc_base          = tokens->loc_base;
+        pp_token_array *lexed = pp_lexer_lex_group(&lex, group, &ptc_scratch);
+
+        pthread_mutex_lock(&ptc->mutex);
+        if (!group->tokens) {
+            group->tokens = copy_tokens(lexed);
+        }
+        group_tokens = group->tokens;
+        pthread_mutex_unlock(&ptc->mutex);
+        ba_clear(&ptc_scratch);
+    }
+
+    *result          = *group_tokens;
+    result->data     = tokens->data;
+    result->loc_base = tokens->loc_base;
+}
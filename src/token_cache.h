@@ -0,0 +1,54 @@
+// Cache of lexed files shared by all translation units of the run. Headers
+// are typically included by many translation units, and without the cache
+// each of them would lex the header again. Token arrays don't change after
+// lexing, so they can be shared by translation units processed in parallel.
+// The only exception are groups of lines, see pp_token_group, which are lexed
+// when the first translation unit reaches them.
+//
+// Cache is keyed by contents of file, so files with the same contents (like
+// copies of the same header) are lexed once too. Token arrays store offsets
+// in source, and each file gets its own small header with its location base,
+// which points to shared arrays.
+#ifndef TOKEN_CACHE_H
+#define TOKEN_CACHE_H
+
+#include "general.h"
+
+#include <pthread.h>
+
+#include "bump_allocator.h"
+
+#define PTC_HASH_SIZE 1024
+
+struct file;
+struct pp_token_array;
+struct pp_token_group;
+
+typedef struct ptc_entry {
+    struct ptc_entry *next;
+    uint32_t hash;
+    // Contents that tokens were lexed from
+    string contents;
+    struct pp_token_array *tokens;
+} ptc_entry;
+
+typedef struct pp_token_cache {
+    // Protects all members, tokens of files and tokens of groups
+    pthread_mutex_t mutex;
+    // Memory for cached tokens. It is never freed, as files live until the end
+    // of the program.
+    bump_allocator a;
+    ptc_entry *hash[PTC_HASH_SIZE];
+} pp_token_cache;
+
+pp_token_cache *get_token_cache(void);
+// Returns tokens of file, lexing it if neither it nor file with the same
+// contents were lexed before. Returned array must not be modified.
+struct pp_token_array *ptc_get_file_tokens(struct file *f);
+// Writes tokens of group of file tokens to result, lexing group if it was not
+// lexed before. Result has locations of the file and shares arrays with the
+// cache.
+void ptc_get_group_tokens(struct pp_token_array *tokens, struct pp_token_group *group,
+                          struct pp_token_array *result);
+
+#endif
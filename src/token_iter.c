@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bump_allocator.h"
 #include "c_lang.h"
 #include "preprocessor.h"
 #include "str.h"
@@ -14,6 +15,25 @@ ti_init(token_iter *it, string filename) {
     pp_init(it->pp, filename);
 }
 
+void
+ti_free(token_iter *it) {
+    pp_free(it->pp);
+    free(it->pp);
+    memset(it, 0, sizeof(*it));
+}
+
+static token *
+new_tok(token_iter *it) {
+    token *tok = it->tok_freelist;
+    if (tok) {
+        it->tok_freelist = tok->next;
+        memset(tok, 0, sizeof(*tok));
+    } else {
+        tok = ba_alloc_struct(it->pp->a, token);
+    }
+    return tok;
+}
+
 token *
 ti_peek_forward(token_iter *it, uint32_t count) {
     token **tokp = &it->token_list;
@@ -33,7 +53,7 @@ ti_peek_forward(token_iter *it, uint32_t count) {
             continue;
         }
 
-        token *tok = calloc(1, sizeof(token));
+        token *tok = new_tok(it);
         pp_parse(it->pp, tok, buf, sizeof(buf), &buf_size);
         if (*tokp) {
             (*tokp)->next = tok;
@@ -51,7 +71,7 @@ ti_peek_forward(token_iter *it, uint32_t count) {
                 buf_size += new_buf_size;
 
                 if (temp.kind != TOK_STR) {
-                    token *sentinel = malloc(sizeof(token));
+                    token *sentinel = new_tok(it);
                     memcpy(sentinel, &temp, sizeof(token));
 
                     (*tokp)->next = sentinel;
@@ -63,7 +83,7 @@ ti_peek_forward(token_iter *it, uint32_t count) {
         }
 
         if (buf_size) {
-            tok->str = string_dup((string){buf, buf_size});
+            tok->str = ba_string_dup(it->pp->a, (string){buf, buf_size});
         }
     }
 
@@ -87,8 +107,9 @@ void
 ti_eat(token_iter *it) {
     token *tok = it->token_list;
     if (tok) {
-        it->token_list = tok->next;
-        free(tok);
+        it->token_list  = tok->next;
+        tok->next        = it->tok_freelist;
+        it->tok_freelist = tok;
     }
 }
 
@@ -14,12 +14,17 @@ struct preprocessor;
 typedef struct token_iter {
     struct token *token_list;
     struct preprocessor *pp;
+    // Eaten tokens that can be reused. Tokens themselves are allocated from
+    // translation unit arena of preprocessor.
+    struct token *tok_freelist;
 
     string filename;
 } token_iter;
 
 // Initializes iterator to process the 'filename' file.
 void ti_init(token_iter *it, string filename);
+// Releases memory of preprocessor and all tokens.
+void ti_free(token_iter *it);
 // Peeks 'nth' token.
 struct token *ti_peek_forward(token_iter *it, uint32_t nth);
 // Peeks next token
@@ -0,0 +1,159 @@
+#include "trace.h"
+
+#include <assert.h>
+
+#include "source_manager.h"
+#include "time_report.h"
+
+static trace tc_ = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+static trace *tc = &tc_;
+// Index of worker thread, which selects set of tracks
+static THREAD_LOCAL uint32_t tc_thread_idx;
+// Number of unfinished events on each track of current thread
+static THREAD_LOCAL uint32_t tc_depth[TC_TRACK_COUNT];
+
+trace *
+get_trace(void) {
+    return tc;
+}
+
+// Writes string as JSON string literal
+static void
+write_json_string(string str) {
+    fputc('"', tc->out);
+    for (uint32_t i = 0; i < str.len; ++i) {
+        uint8_t c = str.data[i];
+        if (c == '"' || c == '\\') {
+            fprintf(tc->out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(tc->out, "\\u%04x", c);
+        } else {
+            fputc(c, tc->out);
+        }
+    }
+    fputc('"', tc->out);
+}
+
+static char *track_names[] = {
+    [TC_TRACK_PREPROCESSOR] = "preprocessor",
+    [TC_TRACK_PARSER]       = "parser",
+};
+
+// Must be called with lock held
+static void
+write_event_start(uint32_t thread_idx, tc_track track, char phase) {
+    double ts    = (tr_get_time() - tc->start_time) * 1e6;
+    uint32_t tid = thread_idx * TC_TRACK_COUNT + track;
+    fprintf(tc->out, "%s\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+            tc->is_first_event ? "" : ",", phase, tid, ts);
+    tc->is_first_event = false;
+}
+
+bool
+tc_open(char *filename) {
+    assert(!tc->out);
+    tc->out = fopen(filename, "w");
+    if (tc->out) {
+        tc->start_time     = tr_get_time();
+        tc->is_first_event = true;
+        fprintf(tc->out, "{\"traceEvents\":[");
+        // Metadata events give names to tracks
+        for (uint32_t track = TC_TRACK_PREPROCESSOR; track < TC_TRACK_COUNT; ++track) {
+            write_event_start(0, track, 'M');
+            fprintf(tc->out, ",\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+                    track_names[track]);
+        }
+    }
+    return tc->out != NULL;
+}
+
+void
+tc_close(void) {
+    if (tc->out) {
+        for (uint32_t track = 0; track < TC_TRACK_COUNT; ++track) {
+            while (tc_depth[track]) {
+                tc_end(track);
+            }
+        }
+        fprintf(tc->out, "\n]}\n");
+        fclose(tc->out);
+        tc->out = NULL;
+    }
+}
+
+bool
+tc_is_enabled(void) {
+    return tc->out != NULL;
+}
+
+void
+tc_name_threads(uint32_t thread_count) {
+    if (tc->out) {
+        pthread_mutex_lock(&tc->mutex);
+        for (uint32_t thread_idx = 0; thread_idx < thread_count; ++thread_idx) {
+            for (uint32_t track = TC_TRACK_PREPROCESSOR; track < TC_TRACK_COUNT; ++track) {
+                write_event_start(thread_idx, track, 'M');
+                fprintf(tc->out,
+                        ",\"name\":\"thread_name\",\"args\":{\"name\":\"worker %u %s\"}}",
+                        thread_idx, track_names[track]);
+            }
+        }
+        pthread_mutex_unlock(&tc->mutex);
+    }
+}
+
+void
+tc_set_thread(uint32_t thread_idx) {
+    for (uint32_t track = 0; track < TC_TRACK_COUNT; ++track) {
+        while (tc_depth[track]) {
+            tc_end(track);
+        }
+    }
+    tc_thread_idx = thread_idx;
+}
+
+void
+tc_begin(tc_track track, string name, string detail) {
+    if (tc->out) {
+        ++tc_depth[track];
+        pthread_mutex_lock(&tc->mutex);
+        write_event_start(tc_thread_idx, track, 'B');
+        fprintf(tc->out, ",\"name\":");
+        write_json_string(name);
+        if (detail.len) {
+            fprintf(tc->out, ",\"args\":{\"detail\":");
+            write_json_string(detail);
+            fprintf(tc->out, "}");
+        }
+        fprintf(tc->out, "}");
+        pthread_mutex_unlock(&tc->mutex);
+    }
+}
+
+void
+tc_begin_loc(tc_track track, string name, source_loc loc) {
+    if (tc->out) {
+        char buf[4096];
+        uint32_t len  = 0;
+        sm_location l = sm_resolve(loc);
+        if (l.buffer) {
+            len = snprintf(buf, sizeof(buf), "%.*s:%u:%u", l.buffer->name.len, l.buffer->name.data,
+                           l.line, l.col);
+            if (len >= sizeof(buf)) {
+                len = sizeof(buf) - 1;
+            }
+        }
+        tc_begin(track, name, (string){buf, len});
+    }
+}
+
+void
+tc_end(tc_track track) {
+    if (tc->out && tc_depth[track]) {
+        --tc_depth[track];
+        pthread_mutex_lock(&tc->mutex);
+        write_event_start(tc_thread_idx, track, 'E');
+        fprintf(tc->out, "}");
+        pthread_mutex_unlock(&tc->mutex);
+    }
+}
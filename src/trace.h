@@ -0,0 +1,54 @@
+// Trace of compilation in Chrome trace-event format. Trace is written as JSON
+// file that can be opened with chrome://tracing or Perfetto UI. It shows
+// nesting of included files, #if evaluations and top-level parses on time
+// axis, which makes it easy to see what headers dominate translation unit.
+//
+// Events are written with begin/end pairs, which must nest properly within
+// single track. Files and #if's nest with each other, but parse of top-level
+// node is driven by parser pulling tokens, so files can start and end in the
+// middle of it. That's why parser events are put on their own track.
+//
+// When translation units are processed in parallel, each worker thread gets
+// its own set of tracks, see tc_set_thread.
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "general.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+typedef enum {
+    TC_TRACK_PREPROCESSOR = 1,
+    TC_TRACK_PARSER       = 2,
+    TC_TRACK_COUNT
+} tc_track;
+
+typedef struct trace {
+    // Protects writes to file
+    pthread_mutex_t mutex;
+    FILE *out;
+    // Timestamps are written relative to time of opening trace
+    double start_time;
+    bool is_first_event;
+} trace;
+
+trace *get_trace(void);
+// Starts writing trace to file. Returns false if file can't be opened.
+bool tc_open(char *filename);
+// Ends all unfinished events and closes file
+void tc_close(void);
+bool tc_is_enabled(void);
+// Gives names to tracks of worker threads [0, thread_count)
+void tc_name_threads(uint32_t thread_count);
+// Makes events of current thread go to tracks of given worker thread.
+// Unfinished events of current thread are ended first.
+void tc_set_thread(uint32_t thread_idx);
+// Begins event with given name. Detail is written as event argument and can
+// be empty. Does nothing if trace is not open.
+void tc_begin(tc_track track, string name, string detail);
+// Same as tc_begin, with location in source written as detail
+void tc_begin_loc(tc_track track, string name, source_loc loc);
+void tc_end(tc_track track);
+
+#endif
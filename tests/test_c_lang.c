@@ -0,0 +1,50 @@
+#include "general.h"
+#include "c_lang.h"
+#include "str.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+bool
+test_all_keywords(void) {
+    bool result = true;
+    for (uint32_t kw = C_KW_AUTO; kw <= C_KW_PRAGMA; ++kw) {
+        token tok = {0};
+        tok.kind  = TOK_KW;
+        tok.kw    = kw;
+        char buf[64];
+        uint32_t len = fmt_token(buf, sizeof(buf), &tok);
+        if (get_kw_kind((string){buf, len}) != kw) {
+            printf("keyword '%.*s' is not classified correctly\n", len, buf);
+            result = false;
+        }
+    }
+    return result;
+}
+
+bool
+test_not_keywords(void) {
+    static string idents[] = {
+        WRAPZ(""),      WRAPZ("i"),         WRAPZ("_"),        WRAPZ("sizeo"),
+        WRAPZ("ifx"),   WRAPZ("unsigne"),   WRAPZ("Int"),      WRAPZ("_Decimal16"),
+        WRAPZ("whilE"), WRAPZ("_Alignast"), WRAPZ("restrict_"), WRAPZ("_Static_assertx"),
+    };
+    bool result = true;
+    for (uint32_t i = 0; i < ARRAY_SIZE(idents); ++i) {
+        if (get_kw_kind(idents[i]) != 0) {
+            printf("'%.*s' is classified as keyword\n", idents[i].len, idents[i].data);
+            result = false;
+        }
+    }
+    return result;
+}
+
+int
+main(void) {
+    TEST_CASE(test_all_keywords);
+    TEST_CASE(test_not_keywords);
+    return 0;
+}
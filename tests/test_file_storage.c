@@ -0,0 +1,262 @@
+#include "general.h"
+#include "file_storage.h"
+#include "filepath.h"
+#include "intern.h"
+#include "str.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+// Trigraphs are spelled with escaped question mark so that compiler does not
+// replace them.
+static char *corpus[] = {
+    "",
+    "int a;\n",
+    "int a;\r\nint b;\r\n",
+    "int a;\rint b;\r",
+    "\r\r\n\n\r",
+    "?\?=define X ?\?( 1 ?\?) ?\?< ?\?> ?\?' ?\?! ?\?-\n",
+    "?\?/\nint a;\n",
+    "?\?/\r\nint a;\r\n",
+    "?\?\?=\n",
+    "?\?\?\?=\n",
+    "?\?a ?\? ?\n?",
+    "?\?",
+    "?",
+    "#define X 1 \\\n + 2 \\\n + 3\nint a = X;\n",
+    "#define X 1 \\\r\n + 2 \\\r + 3\r\nint a = X;\r\n",
+    "\\\\\n\\\n\\",
+    "\"string \\n with \\\\ escapes\"\n",
+    "line splice at the end of file \\\n",
+    "line splice at the end of file \\",
+    "very long line that does not contain anything special and is used to check "
+    "vectorized scanning with both full and partial blocks; "
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ\n",
+    "very long line with splice at the middle of vectorized block 0123456789 \\\n"
+    "and trigraph at the end of it ?\?= 0123456789abcdefghijklmnopqrstuvwxyz\r\n",
+};
+
+// Separate implementations of translation phases, which are slower than
+// translate_phases_1_2 and are used as reference for it.
+
+// Does in-place replacement of \r\n and \r to \n
+static char *
+canonicalize_newline(char *p) {
+    char *read  = p;
+    char *write = p;
+    while (*read) {
+        if (read[0] == '\r' && read[1] == '\n') {
+            read += 2;
+            *write++ = '\n';
+        } else if (*read == '\r') {
+            ++read;
+            *write++ = '\n';
+        } else {
+            *write++ = *read++;
+        }
+    }
+    *write = 0;
+    return write;
+}
+
+// Replaces trigraphs with corresponding tokens
+static char *
+replace_trigraphs(char *p) {
+    char *read  = p;
+    char *write = p;
+    while (*read) {
+        if (read[0] == '?' && read[1] == '?') {
+            switch (read[2]) {
+            default: {
+                *write++ = *read++;
+                *write++ = *read++;
+            } break;
+            case '<': {
+                read += 3;
+                *write++ = '{';
+            } break;
+            case '>': {
+                read += 3;
+                *write++ = '}';
+            } break;
+            case '(': {
+                read += 3;
+                *write++ = '[';
+            } break;
+            case ')': {
+                read += 3;
+                *write++ = ']';
+            } break;
+            case '=': {
+                read += 3;
+                *write++ = '#';
+            } break;
+            case '/': {
+                read += 3;
+                *write++ = '\\';
+            } break;
+            case '\'': {
+                read += 3;
+                *write++ = '^';
+            } break;
+            case '!': {
+                read += 3;
+                *write++ = '|';
+            } break;
+            case '-': {
+                read += 3;
+                *write++ = '~';
+            } break;
+            }
+        } else {
+            *write++ = *read++;
+        }
+    }
+    *write = 0;
+    return write;
+}
+
+// Removes \ followed by \n, while keeping original logical lines
+static char *
+remove_backslash_newline(char *p) {
+    char *write = p;
+    char *read  = p;
+    uint32_t n  = 0;
+    while (*read) {
+        if (read[0] == '\\' && read[1] == '\n') {
+            read += 2;
+            ++n;
+        } else if (*read == '\n') {
+            *write++ = *read++;
+            while (n--) {
+                *write++ = '\n';
+            }
+            n = 0;
+        } else {
+            *write++ = *read++;
+        }
+    }
+
+    while (n--) {
+        *write++ = '\n';
+    }
+
+    *write = 0;
+    return write;
+}
+
+static bool
+check_same_as_reference(char *src, uint32_t len) {
+    char *expected = malloc(len + 1);
+    memcpy(expected, src, len);
+    expected[len] = 0;
+    canonicalize_newline(expected);
+    replace_trigraphs(expected);
+    char *expected_end = remove_backslash_newline(expected);
+
+    char *got = malloc(len + 1);
+    memcpy(got, src, len);
+    got[len]      = 0;
+    char *got_end = translate_phases_1_2(got, got + len);
+
+    bool result = expected_end - expected == got_end - got &&
+                  memcmp(expected, got, got_end - got + 1) == 0;
+    if (!result) {
+        printf("mismatch on input '%.*s'\n", len, src);
+    }
+
+    free(expected);
+    free(got);
+    return result;
+}
+
+bool
+test_corpus(void) {
+    bool result = true;
+    for (uint32_t i = 0; i < ARRAY_SIZE(corpus); ++i) {
+        result = check_same_as_reference(corpus[i], strlen(corpus[i])) && result;
+    }
+    return result;
+}
+
+bool
+test_random(void) {
+    // Alphabet is biased towards characters that are handled specially
+    static char alphabet[] = "\r\n?\\=/(<-! a";
+    bool result            = true;
+    char buffer[256];
+    srand(1);
+    for (uint32_t i = 0; i < 100000 && result; ++i) {
+        uint32_t len = rand() % sizeof(buffer);
+        for (uint32_t j = 0; j < len; ++j) {
+            buffer[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        result = check_same_as_reference(buffer, len);
+    }
+    return result;
+}
+
+bool
+test_embedded_zero(void) {
+    char src[] = "int a;\r\n\0int b;\r\n";
+    return check_same_as_reference(src, sizeof(src) - 1);
+}
+
+static void
+write_file(char *filename, char *contents) {
+    FILE *f = fopen(filename, "wb");
+    assert(f);
+    fwrite(contents, strlen(contents), 1, f);
+    fclose(f);
+}
+
+// Main file must not be found by its name among files included from other
+// directories that are spelled the same way
+bool
+test_main_file_is_resolved_by_path(void) {
+    mkdir("build/tests/fs_dir", 0777);
+    mkdir("build/tests/fs_dir/build", 0777);
+    mkdir("build/tests/fs_dir/build/tests", 0777);
+    write_file("build/tests/fs_dir/main.c", "#include \"build/tests/fs_name.h\"\n");
+    write_file("build/tests/fs_dir/build/tests/fs_name.h", "int from_dir;\n");
+    write_file("build/tests/fs_name.h", "int from_cwd;\n");
+
+    file *main_file = fs_get_file((string)WRAPZ("build/tests/fs_dir/main.c"), NULL);
+    file *included  = fs_get_file((string)WRAPZ("build/tests/fs_name.h"), main_file);
+    file *other     = fs_get_file((string)WRAPZ("build/tests/fs_name.h"), NULL);
+    return main_file && included && other && included != other &&
+           string_eq(included->contents, (string)WRAPZ("int from_dir;\n")) &&
+           string_eq(other->contents, (string)WRAPZ("int from_cwd;\n"));
+}
+
+// Hint of file that is not loaded yet is applied when file is loaded, and file
+// gets index reserved by hint
+bool
+test_hint_is_applied_on_load(void) {
+    write_file("build/tests/fs_hint.h", "int a;\n");
+    char path[4096];
+    get_current_dir(path, sizeof(path));
+    strcat(path, "/build/tests/fs_hint.h");
+
+    interned_string *include_guard = intern_string((string)WRAPZ("FS_HINT_H"));
+    uint32_t idx = fs_add_file_hint((string){path, strlen(path)}, include_guard, true);
+    file *f      = fs_get_file((string)WRAPZ("build/tests/fs_hint.h"), NULL);
+    return f && f->idx == idx && fs_get_include_guard(f) == include_guard &&
+           fs_has_pragma_once(f) &&
+           fs_add_file_hint((string){path, strlen(path)}, NULL, false) == idx;
+}
+
+int
+main(void) {
+    TEST_CASE(test_corpus);
+    TEST_CASE(test_random);
+    TEST_CASE(test_embedded_zero);
+    TEST_CASE(test_main_file_is_resolved_by_path);
+    TEST_CASE(test_hint_is_applied_on_load);
+    return 0;
+}
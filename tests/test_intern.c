@@ -0,0 +1,63 @@
+#include "general.h"
+#include "intern.h"
+#include "str.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+bool
+test_same_spelling(void) {
+    char a[]            = "identifier";
+    char b[]            = "identifier";
+    interned_string *ia = intern_string((string)WRAPZ(a));
+    interned_string *ib = intern_string((string)WRAPZ(b));
+    return ia == ib && ia->str.data != a && string_eq(ia->str, (string)WRAPZ("identifier")) &&
+           ia->str.data[ia->str.len] == 0 && ia->pp_kind == PP_IDENT_NONE;
+}
+
+bool
+test_different_spelling(void) {
+    interned_string *a = intern_stringz("abc");
+    interned_string *b = intern_stringz("abd");
+    interned_string *c = intern_stringz("ab");
+    return a != b && a != c && b != c;
+}
+
+bool
+test_pp_kinds(void) {
+    return intern_stringz("define")->pp_kind == PP_IDENT_DEFINE &&
+           intern_stringz("endif")->pp_kind == PP_IDENT_ENDIF &&
+           intern_stringz("__VA_ARGS__")->pp_kind == PP_IDENT_VA_ARGS &&
+           intern_stringz("defined")->pp_kind == PP_IDENT_DEFINED;
+}
+
+bool
+test_grow(void) {
+    // Enough strings to make table grow several times
+    static interned_string *strings[20000];
+    char buf[32];
+    for (uint32_t i = 0; i < ARRAY_SIZE(strings); ++i) {
+        uint32_t len = snprintf(buf, sizeof(buf), "ident_%u", i);
+        strings[i]   = intern_string((string){buf, len});
+    }
+
+    bool result = true;
+    for (uint32_t i = 0; i < ARRAY_SIZE(strings) && result; ++i) {
+        uint32_t len = snprintf(buf, sizeof(buf), "ident_%u", i);
+        result       = intern_string((string){buf, len}) == strings[i] &&
+                 intern_get(strings[i]->id) == strings[i];
+    }
+    return result && intern_stringz("if")->pp_kind == PP_IDENT_IF;
+}
+
+int
+main(void) {
+    TEST_CASE(test_same_spelling);
+    TEST_CASE(test_different_spelling);
+    TEST_CASE(test_pp_kinds);
+    TEST_CASE(test_grow);
+    return 0;
+}
@@ -1,4 +1,4 @@
-#include "types.h"
+#include "general.h"
 #include "llist.h"
 
 #include <assert.h>
@@ -77,7 +77,7 @@ test_constructor(void) {
 }
 
 int
-main(int argc, char **argv) {
+main(void) {
     TEST_CASE(test_appending_front);
     TEST_CASE(test_appending_back);
     TEST_CASE(test_constructor);
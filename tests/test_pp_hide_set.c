@@ -0,0 +1,86 @@
+#include "bump_allocator.h"
+#include "general.h"
+#include "pp_hide_set.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+static bool
+has_ids(pp_hide_set *set, uint32_t *ids, uint32_t count) {
+    bool result = set && set->count == count;
+    for (uint32_t i = 0; i < count && result; ++i) {
+        result = set->ids[i] == ids[i] && pphs_contains(set, ids[i]);
+    }
+    return result;
+}
+
+bool
+test_add(void) {
+    bump_allocator a        = {0};
+    pp_hide_set_table table = {0};
+    pphs_init(&table, &a);
+    pp_hide_set *set = pphs_add(&table, NULL, 5);
+    set              = pphs_add(&table, set, 1);
+    set              = pphs_add(&table, set, 9);
+    uint32_t ids[]   = {1, 5, 9};
+    bool result      = has_ids(set, ids, ARRAY_SIZE(ids)) && !pphs_contains(set, 4) &&
+                  !pphs_contains(NULL, 1) && pphs_add(&table, set, 5) == set;
+    // Sets are interned regardless of order of additions
+    pp_hide_set *other = pphs_add(&table, pphs_add(&table, pphs_add(&table, NULL, 9), 5), 1);
+    result             = result && other == set;
+    pphs_free(&table);
+    ba_free(&a);
+    return result;
+}
+
+bool
+test_union_and_intersect(void) {
+    bump_allocator a        = {0};
+    pp_hide_set_table table = {0};
+    pphs_init(&table, &a);
+    pp_hide_set *lhs = pphs_add(&table, pphs_add(&table, NULL, 1), 3);
+    pp_hide_set *rhs = pphs_add(&table, pphs_add(&table, NULL, 3), 7);
+
+    uint32_t union_ids[]      = {1, 3, 7};
+    uint32_t intersect_ids[]  = {3};
+    pp_hide_set *union_set    = pphs_union(&table, lhs, rhs);
+    pp_hide_set *intersection = pphs_intersect(&table, lhs, rhs);
+    bool result               = has_ids(union_set, union_ids, ARRAY_SIZE(union_ids)) &&
+                  has_ids(intersection, intersect_ids, ARRAY_SIZE(intersect_ids));
+    result = result && pphs_union(&table, rhs, lhs) == union_set &&
+             pphs_union(&table, NULL, lhs) == lhs && !pphs_intersect(&table, lhs, NULL) &&
+             !pphs_intersect(&table, lhs, pphs_add(&table, NULL, 2));
+    pphs_free(&table);
+    ba_free(&a);
+    return result;
+}
+
+bool
+test_many_sets(void) {
+    bump_allocator a        = {0};
+    pp_hide_set_table table = {0};
+    pphs_init(&table, &a);
+    // Enough sets for table to grow
+    pp_hide_set *sets[1000];
+    for (uint32_t i = 0; i < ARRAY_SIZE(sets); ++i) {
+        sets[i] = pphs_add(&table, pphs_add(&table, NULL, i), i + 1);
+    }
+    bool result = true;
+    for (uint32_t i = 0; i < ARRAY_SIZE(sets) && result; ++i) {
+        result = pphs_add(&table, pphs_add(&table, NULL, i + 1), i) == sets[i];
+    }
+    pphs_free(&table);
+    ba_free(&a);
+    return result;
+}
+
+int
+main(void) {
+    TEST_CASE(test_add);
+    TEST_CASE(test_union_and_intersect);
+    TEST_CASE(test_many_sets);
+    return 0;
+}
@@ -1,3 +1,202 @@
-int main(int argc, char **argv) {
+#include "general.h"
+#include "bump_allocator.h"
+#include "pp_lexer.h"
+#include "str.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+bool
+test_skip_to_directive(void) {
+    char src[] =
+        "int a; /* # comment\n"
+        "# in comment */ \"#\" '#'\n"
+        "// # line comment\n"
+        "\"/*\" x # y\n"
+        "  /* c */ # endif\n";
+    pp_lexer lex = {0};
+    pp_lexer_init(&lex, src, src + sizeof(src) - 1);
+
+    char buf[256];
+    uint32_t buf_len = 0;
+    pp_token tok     = {0};
+    pp_lexer_parse(&lex, &tok, buf, sizeof(buf), &buf_len);
+
+    bool result = pp_lexer_skip_to_directive(&lex);
+    memset(&tok, 0, sizeof(tok));
+    pp_lexer_parse(&lex, &tok, buf, sizeof(buf), &buf_len);
+    result = result && PP_TOK_IS_PUNCT(&tok, '#') && tok.at_line_start &&
+             tok.loc == (source_loc)(strstr(src, "# endif") - src);
+
+    memset(&tok, 0, sizeof(tok));
+    pp_lexer_parse(&lex, &tok, buf, sizeof(buf), &buf_len);
+    result = result && tok.kind == PP_TOK_ID && string_eq(tok.str, (string)WRAPZ("endif"));
+
+    result = result && !pp_lexer_skip_to_directive(&lex);
+    return result;
+}
+
+bool
+test_punctuators(void) {
+    // Each punctuator is separated with space, so longest match is the whole
+    // word. '>>>=' checks that longest punctuator is chosen first.
+    char src[] = ">>= <<= += -= *= /= %= &= |= ^= ++ -- >> << && || == != <= >= ... -> ## "
+                 "# ( ) . >>>= ->>";
+    static uint32_t expected[] = {
+        PP_TOK_PUNCT_IRSHIFT, PP_TOK_PUNCT_ILSHIFT, PP_TOK_PUNCT_IADD,    PP_TOK_PUNCT_ISUB,
+        PP_TOK_PUNCT_IMUL,    PP_TOK_PUNCT_IDIV,    PP_TOK_PUNCT_IMOD,    PP_TOK_PUNCT_IAND,
+        PP_TOK_PUNCT_IOR,     PP_TOK_PUNCT_IXOR,    PP_TOK_PUNCT_INC,     PP_TOK_PUNCT_DEC,
+        PP_TOK_PUNCT_RSHIFT,  PP_TOK_PUNCT_LSHIFT,  PP_TOK_PUNCT_LAND,    PP_TOK_PUNCT_LOR,
+        PP_TOK_PUNCT_EQ,      PP_TOK_PUNCT_NEQ,     PP_TOK_PUNCT_LEQ,     PP_TOK_PUNCT_GEQ,
+        PP_TOK_PUNCT_VARARGS, PP_TOK_PUNCT_ARROW,   PP_TOK_PUNCT_DHASH,   '#',
+        '(',                  ')',                  '.',                  PP_TOK_PUNCT_RSHIFT,
+        PP_TOK_PUNCT_GEQ,     PP_TOK_PUNCT_ARROW,   '>',
+    };
+    pp_lexer lex = {0};
+    pp_lexer_init(&lex, src, src + sizeof(src) - 1);
+
+    bool result = true;
+    for (uint32_t i = 0; i < ARRAY_SIZE(expected) && result; ++i) {
+        char buf[256];
+        uint32_t buf_len = 0;
+        pp_token tok     = {0};
+        pp_lexer_parse(&lex, &tok, buf, sizeof(buf), &buf_len);
+        result = tok.kind == PP_TOK_PUNCT && tok.punct_kind == expected[i];
+        if (!result) {
+            printf("punctuator %u is lexed incorrectly\n", i);
+        }
+    }
+    return result;
+}
+
+bool
+test_numbers_and_idents(void) {
+    char src[] = "1e+5 0x1p-3f .5 1'000 _a1 b_2\v\f c /*/ x */ 1e";
+    static struct {
+        pp_token_kind kind;
+        char *str;
+    } expected[] = {
+        {PP_TOK_NUM, "1e+5"},  {PP_TOK_NUM, "0x1p-3f"}, {PP_TOK_NUM, ".5"},
+        {PP_TOK_NUM, "1'000"}, {PP_TOK_ID, "_a1"},      {PP_TOK_ID, "b_2"},
+        {PP_TOK_ID, "c"},      {PP_TOK_NUM, "1e"},
+    };
+    pp_lexer lex = {0};
+    pp_lexer_init(&lex, src, src + sizeof(src) - 1);
+
+    bool result = true;
+    for (uint32_t i = 0; i < ARRAY_SIZE(expected) && result; ++i) {
+        char buf[256];
+        uint32_t buf_len = 0;
+        pp_token tok     = {0};
+        pp_lexer_parse(&lex, &tok, buf, sizeof(buf), &buf_len);
+        result = tok.kind == expected[i].kind &&
+                 string_eq(tok.str, (string){expected[i].str, strlen(expected[i].str)});
+        if (!result) {
+            printf("token %u is lexed incorrectly\n", i);
+        }
+    }
+    return result;
+}
+
+bool
+test_lex_all(void) {
+    char src[] = "x \"plain\" \"esc\\n\" 1.5e+3 'c' ' \"\\\"\"\n"
+                 "  # if u8\"s\"\n";
+    bump_allocator a = {0};
+    pp_lexer lex     = {0};
+    pp_lexer_init(&lex, src, src + sizeof(src) - 1);
+    lex.loc_base           = 100;
+    pp_token_array *tokens = pp_lexer_lex_all(&lex, &a);
+
+    // Tokens from array must be the same as lexed one by one
+    pp_lexer_init(&lex, src, src + sizeof(src) - 1);
+    lex.loc_base = 100;
+    bool result = tokens->token_count == 11;
+    for (uint32_t i = 0; i < tokens->token_count && result; ++i) {
+        char buf[256];
+        uint32_t buf_len  = 0;
+        pp_token expected = {0};
+        pp_token tok      = {0};
+        pp_lexer_parse(&lex, &expected, buf, sizeof(buf), &buf_len);
+        pp_token_array_get(tokens, i, &tok);
+        result = tok.kind == expected.kind && tok.str_kind == expected.str_kind &&
+                 tok.punct_kind == expected.punct_kind && tok.ident == expected.ident &&
+                 string_eq(tok.str, expected.str) && tok.loc == expected.loc &&
+                 tok.at_line_start == expected.at_line_start &&
+                 tok.has_whitespace == expected.has_whitespace;
+        if (!result) {
+            printf("token %u differs\n", i);
+        }
+    }
+
+    // Strings without escapes and numbers point to source, while unescaped
+    // strings are stored separately.
+    pp_token tok = {0};
+    pp_token_array_get(tokens, 1, &tok);
+    result = result && tok.str.data == src + 3;
+    pp_token_array_get(tokens, 2, &tok);
+    result = result && !(tok.str.data >= src && tok.str.data < src + sizeof(src));
+    pp_token_array_get(tokens, 3, &tok);
+    result = result && tok.str.data == src + 18;
+
+    result = result && pp_token_array_skip_to_directive(tokens, 1) == 7 &&
+             pp_token_array_skip_to_directive(tokens, 8) == 10;
+    ba_free(&a);
+    return result;
+}
+
+bool
+test_lex_groups(void) {
+    char src[] = "#ifdef X\n"
+                 "first second /* comment that makes group long enough to be left for lexing "
+                 "later, instead of being lexed in place, which happens for groups of "
+                 "few tokens */\n"
+                 "# if Y\n"
+                 "#endif\n";
+    bump_allocator a = {0};
+    pp_lexer lex     = {0};
+    pp_lexer_init(&lex, src, src + sizeof(src) - 1);
+    lex.loc_base           = 100;
+    pp_token_array *tokens = pp_lexer_lex_all(&lex, &a);
+
+    // The first token after directive is lexed, and the rest of lines up to
+    // the next conditional directive are a single group
+    bool result = tokens->token_count == 11 && tokens->group_count == 1;
+    for (uint32_t i = 0; i < tokens->token_count && result; ++i) {
+        pp_token_group *group = pp_token_array_get_group(tokens, i);
+        result                = (group != NULL) == (i == 4);
+    }
+    pp_token tok = {0};
+    pp_token_array_get(tokens, 3, &tok);
+    result = result && string_eq(tok.str, (string)WRAPZ("first"));
+    pp_token_array_get(tokens, 5, &tok);
+    result = result && PP_TOK_IS_PUNCT(&tok, '#') && tok.at_line_start;
+    result = result && pp_token_array_skip_to_directive(tokens, 4) == 5;
+
+    pp_token_group *group = pp_token_array_get_group(tokens, 4);
+    result                = result && !group->tokens;
+    pp_lexer_init(&lex, src, src + sizeof(src) - 1);
+    lex.loc_base                 = 100;
+    pp_token_array *group_tokens = pp_lexer_lex_group(&lex, group, &a);
+    result = result && group_tokens->token_count == 2 && !group_tokens->group_count;
+    pp_token_array_get(group_tokens, 0, &tok);
+    result = result && string_eq(tok.str, (string)WRAPZ("second")) &&
+             tok.loc == 100 + (source_loc)(strstr(src, "second") - src);
+    pp_token_array_get(group_tokens, 1, &tok);
+    result = result && tok.kind == PP_TOK_EOF;
+    ba_free(&a);
+    return result;
+}
+
+int
+main(void) {
+    TEST_CASE(test_skip_to_directive);
+    TEST_CASE(test_punctuators);
+    TEST_CASE(test_numbers_and_idents);
+    TEST_CASE(test_lex_all);
+    TEST_CASE(test_lex_groups);
     return 0;
 }
@@ -0,0 +1,127 @@
+#include "c_lang.h"
+#include "darray.h"
+#include "general.h"
+#include "intern.h"
+#include "pp_lexer.h"
+#include "pp_snapshot.h"
+#include "preprocessor.h"
+#include "str.h"
+#include "token_iter.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+#define TEST_HEADER "build/tests/pp_snapshot_test.h"
+#define TEST_SOURCE "build/tests/pp_snapshot_test.c"
+#define TEST_SNAPSHOT "build/tests/pp_snapshot_test.pch"
+
+static void
+write_file(char *filename, char *contents) {
+    FILE *f = fopen(filename, "wb");
+    assert(f);
+    fwrite(contents, strlen(contents), 1, f);
+    fclose(f);
+}
+
+static bool
+emit_snapshot(void) {
+    write_file(TEST_HEADER,
+               "#ifndef PP_SNAPSHOT_TEST_H\n"
+               "#define PP_SNAPSHOT_TEST_H\n"
+               "#define VALUE 1\n"
+               "#define SUM(_a, ...) _a + __VA_ARGS__\n"
+               "#define ADD(_a, _b) _a + _b\n"
+               "#endif\n");
+    token_iter ti = {0};
+    ti_init(&ti, (string)WRAPZ(TEST_HEADER));
+    while (ti_peek(&ti)->kind != TOK_EOF) {
+        ti_eat(&ti);
+    }
+    bool result = pps_write(ti.pp, TEST_SNAPSHOT);
+    ti_free(&ti);
+    return result;
+}
+
+static pp_macro *
+find_macro(pp_snapshot *snapshot, char *name) {
+    pp_macro *result = NULL;
+    for (uint32_t i = 0; i < da_size(snapshot->macros) && !result; ++i) {
+        if (string_eq(snapshot->macros[i]->name->str, (string){name, strlen(name)})) {
+            result = snapshot->macros[i];
+        }
+    }
+    return result;
+}
+
+static uint32_t
+count_tokens(pp_token *tok) {
+    uint32_t result = 0;
+    for (; tok->kind != PP_TOK_EOF; tok = tok->next) {
+        ++result;
+    }
+    return result;
+}
+
+bool
+test_write_and_load(void) {
+    bool result           = emit_snapshot();
+    pp_snapshot *snapshot = pps_load(TEST_SNAPSHOT);
+    result                = result && snapshot;
+    if (result) {
+        // Builtin macros are not written
+        pp_macro *guard = find_macro(snapshot, "PP_SNAPSHOT_TEST_H");
+        pp_macro *value = find_macro(snapshot, "VALUE");
+        pp_macro *sum   = find_macro(snapshot, "SUM");
+        result          = da_size(snapshot->macros) == 4 && guard && value && sum &&
+                 count_tokens(guard->definition) == 0 && count_tokens(value->definition) == 1 &&
+                 value->kind == PP_MACRO_OBJ && sum->kind == PP_MACRO_FUNC && sum->is_variadic &&
+                 sum->arg_count == 1 && count_tokens(sum->definition) == 3;
+        result = result && sum->args && sum->args->next && !sum->args->next->next &&
+                 sum->args->name == intern_stringz("_a") &&
+                 sum->args->next->name == intern_stringz("__VA_ARGS__");
+    }
+    return result;
+}
+
+bool
+test_snapshot_is_applied(void) {
+    bool result           = emit_snapshot();
+    pp_snapshot *snapshot = pps_load(TEST_SNAPSHOT);
+    result                = result && snapshot;
+    if (result) {
+        write_file(TEST_SOURCE, "ADD(VALUE, 2) ADD(3, 4)\n");
+        pp_set_snapshot(snapshot);
+        token_iter ti = {0};
+        ti_init(&ti, (string)WRAPZ(TEST_SOURCE));
+        uint64_t values[4] = {0};
+        uint32_t count     = 0;
+        for (token *tok = ti_peek(&ti); tok->kind != TOK_EOF; tok = ti_eat_peek(&ti)) {
+            if (tok->kind == TOK_NUM && count < ARRAY_SIZE(values)) {
+                values[count++] = tok->uint_value;
+            }
+        }
+        ti_free(&ti);
+        pp_set_snapshot(NULL);
+        result = count == 4 && values[0] == 1 && values[1] == 2 && values[2] == 3 &&
+                 values[3] == 4;
+    }
+    return result;
+}
+
+bool
+test_invalid_file_is_rejected(void) {
+    write_file(TEST_SNAPSHOT, "HOLOPCH1 is not followed by header");
+    bool result = pps_load(TEST_SNAPSHOT) == NULL;
+    return result && pps_load("build/tests/pp_snapshot_missing.pch") == NULL;
+}
+
+int
+main(void) {
+    TEST_CASE(test_write_and_load);
+    TEST_CASE(test_snapshot_is_applied);
+    TEST_CASE(test_invalid_file_is_rejected);
+    return 0;
+}
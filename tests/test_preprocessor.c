@@ -0,0 +1,245 @@
+#include "buffer_writer.h"
+#include "c_lang.h"
+#include "general.h"
+#include "str.h"
+#include "token_iter.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+// Files are cached by name, so each source gets its own file
+static uint32_t source_idx;
+
+// Preprocesses source and checks that spellings of resulting tokens,
+// separated with spaces, are equal to expected
+static bool
+expands_to(char *source, char *expected) {
+    char filename[256];
+    snprintf(filename, sizeof(filename), "build/tests/test_preprocessor_%u.c", source_idx++);
+    FILE *f = fopen(filename, "wb");
+    assert(f);
+    fwrite(source, strlen(source), 1, f);
+    fclose(f);
+
+    static char buffer[65536];
+    buffer_writer w = {buffer, buffer + sizeof(buffer)};
+    token_iter ti   = {0};
+    ti_init(&ti, (string){filename, strlen(filename)});
+    for (token *tok = ti_peek(&ti); tok->kind != TOK_EOF; tok = ti_eat_peek(&ti)) {
+        if (w.cursor != buffer) {
+            buf_write(&w, " ");
+        }
+        fmt_tokenw(&w, tok);
+    }
+    ti_free(&ti);
+
+    bool result = strcmp(buffer, expected) == 0;
+    if (!result) {
+        printf("  expected: %s\n  got:      %s\n", expected, buffer);
+    }
+    return result;
+}
+
+bool
+test_object_like(void) {
+    return expands_to("#define A 1 + 2\nint x = A;\n", "int x = 1 + 2 ;");
+}
+
+bool
+test_function_like(void) {
+    return expands_to("#define ADD(a, b) a + b\n"
+                      "ADD(1, 2) ADD((3, 4), 5) ADD(, 6)\n",
+                      "1 + 2 ( 3 , 4 ) + 5 + 6");
+}
+
+// Whitespace and newlines between name and '(' don't prevent invocation
+bool
+test_function_like_paren_after_space(void) {
+    return expands_to("#define m(a) a+1\n"
+                      "m (3)\n"
+                      "m\n"
+                      "(2) m\n",
+                      "3 + 1 2 + 1 m");
+}
+
+bool
+test_stringify(void) {
+    return expands_to("#define STR(x) #x\nSTR(abc) + STR()\n", "\"abc\" + \"\"");
+}
+
+// Whitespace between tokens becomes single space, and literals in argument
+// are escaped. Strings are separated, as adjacent ones are concatenated.
+bool
+test_stringify_spelling(void) {
+    return expands_to("#define s(x) #x\n"
+                      "s(a   b + c), s( x\n y ), s(\"q\\n\"), s('\"' '\\'' L\"\\\\\")\n",
+                      "\"a b + c\" , \"x y\" , \"\\\"q\\\\n\\\"\" , "
+                      "\"'\\\"' '\\\\'' L\\\"\\\\\\\\\\\"\"");
+}
+
+bool
+test_paste(void) {
+    return expands_to("#define CAT(a, b) a ## b\n"
+                      "#define CAT3(a, b, c) a ## b ## c\n"
+                      "#define OBJ x ## 1\n"
+                      "CAT(foo, bar) CAT3(1, 2, 3) OBJ CAT(<<, =) CAT(, y) CAT(z, )\n",
+                      "foobar 123 x1 <<= y z");
+}
+
+bool
+test_paste_empty_argument(void) {
+    return expands_to("#define CAT3(a, b, c) a ## b ## c\n"
+                      "CAT3(x, , y) CAT3(, , z) CAT3(, , )\n",
+                      "xy z");
+}
+
+bool
+test_nested_expansion(void) {
+    return expands_to("#define F(x) G(x) x\n"
+                      "#define G(y) [y]\n"
+                      "#define H F\n"
+                      "F(F(1)) H(2)\n",
+                      "[ [ 1 ] 1 ] [ 1 ] 1 [ 2 ] 2");
+}
+
+// Argument that is used both as written and macro-expanded
+bool
+test_argument_used_twice(void) {
+    return expands_to("#define ID(x) x\n"
+                      "#define B(x) x _ ## x #x\n"
+                      "B(ID(1)) B(B(a))\n",
+                      "1 _ID ( 1 ) \"ID(1)\" a _a \"a\" _B ( a ) \"B(a)\"");
+}
+
+bool
+test_variadic(void) {
+    return expands_to("#define SUM(a, ...) a + __VA_ARGS__\n"
+                      "#define F(...) f(__VA_ARGS__)\n"
+                      "SUM(1, 2, 3) F() F(a, (b, c))\n",
+                      "1 + 2 , 3 f ( ) f ( a , ( b , c ) )");
+}
+
+bool
+test_self_reference(void) {
+    return expands_to("#define A A + 1\n"
+                      "#define B C\n"
+                      "#define C B\n"
+                      "#define F(x) F(x + 1)\n"
+                      "A B C F(F(0))\n"
+                      "#if C\nnot_evaluated_as_zero\n#endif\n",
+                      "A + 1 B C F ( F ( 0 + 1 ) + 1 )");
+}
+
+// Example of rescanning from C99 6.10.3.5
+bool
+test_rescanning(void) {
+    return expands_to("#define x 3\n"
+                      "#define f(a) f(x * (a))\n"
+                      "#undef x\n"
+                      "#define x 2\n"
+                      "#define g f\n"
+                      "#define z z[0]\n"
+                      "#define t(a) a\n"
+                      "f(y+1) + f(f(z)) % t(t(g)(0) + t)(1);\n",
+                      "f ( 2 * ( y + 1 ) ) + f ( 2 * ( f ( 2 * ( z [ 0 ] ) ) ) ) % "
+                      "f ( 2 * ( 0 ) ) + t ( 1 ) ;");
+}
+
+// Enough macros for macro table to grow, with half of them removed
+bool
+test_many_macros(void) {
+    enum { MACRO_COUNT = 3000 };
+    static char source[MACRO_COUNT * 64];
+    static char expected[MACRO_COUNT * 16];
+    buffer_writer w = {source, source + sizeof(source)};
+    for (uint32_t i = 0; i < MACRO_COUNT; ++i) {
+        buf_write(&w, "#define M%u %u\n", i, i);
+    }
+    for (uint32_t i = 0; i < MACRO_COUNT; i += 2) {
+        buf_write(&w, "#undef M%u\n", i);
+    }
+    buffer_writer expected_w = {expected, expected + sizeof(expected)};
+    for (uint32_t i = 0; i < MACRO_COUNT; ++i) {
+        buf_write(&w, "M%u\n", i);
+        if (i) {
+            buf_write(&expected_w, " ");
+        }
+        if (i % 2) {
+            buf_write(&expected_w, "%u", i);
+        } else {
+            buf_write(&expected_w, "M%u", i);
+        }
+    }
+    return expands_to(source, expected);
+}
+
+bool
+test_macros_in_condition(void) {
+    return expands_to("#define F(x) x\n"
+                      "#define G(x, y) y\n"
+                      "#if F(1) && G(, 1)\nyes\n#else\nno\n#endif\n",
+                      "yes");
+}
+
+bool
+test_conditional_groups(void) {
+    // Padding makes lines between directives long enough to be lexed only
+    // when they are reached
+#define PAD "/* padding of lines, so that they are lexed only when reached */\n"
+    return expands_to("#if 0\n"
+                      "excluded " PAD PAD "/*\n#endif\n*/ '#' \"#else\"\n"
+                      "#elif 1\n"
+                      "#define TAKEN taken\n" PAD PAD
+                      "#if 1\nnested " PAD PAD "#endif\n"
+                      "after " PAD PAD
+                      "#else\n"
+                      "excluded " PAD PAD
+                      "#endif\n"
+                      "TAKEN\n"
+                      "#ifdef TAKEN\n"
+                      "#pragma ignored\n"
+                      "#define AFTER_PRAGMA pragma\n" PAD PAD
+                      "#endif\n"
+                      "AFTER_PRAGMA\n",
+                      "nested after taken pragma");
+#undef PAD
+}
+
+// File with #pragma once is included once per translation unit
+bool
+test_pragma_once(void) {
+    FILE *f = fopen("build/tests/test_preprocessor_once.h", "wb");
+    assert(f);
+    fputs("#pragma once\nonce\n", f);
+    fclose(f);
+
+    char *source = "#include \"test_preprocessor_once.h\"\n"
+                   "#include \"test_preprocessor_once.h\"\n"
+                   "main\n"
+                   "#include \"test_preprocessor_once.h\"\n";
+    return expands_to(source, "once main") && expands_to(source, "once main");
+}
+
+int
+main(void) {
+    TEST_CASE(test_object_like);
+    TEST_CASE(test_function_like);
+    TEST_CASE(test_function_like_paren_after_space);
+    TEST_CASE(test_stringify);
+    TEST_CASE(test_stringify_spelling);
+    TEST_CASE(test_paste);
+    TEST_CASE(test_paste_empty_argument);
+    TEST_CASE(test_nested_expansion);
+    TEST_CASE(test_argument_used_twice);
+    TEST_CASE(test_variadic);
+    TEST_CASE(test_self_reference);
+    TEST_CASE(test_rescanning);
+    TEST_CASE(test_many_macros);
+    TEST_CASE(test_macros_in_condition);
+    TEST_CASE(test_conditional_groups);
+    TEST_CASE(test_pragma_once);
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "error_reporter.h"
+#include "general.h"
+#include "source_manager.h"
+#include "str.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+bool
+test_buffer_locations(void) {
+    string a_contents = WRAPZ("int a;\nint b;\n\n  x");
+    string b_contents = WRAPZ("y");
+    source_loc a_base = sm_add_buffer((string)WRAPZ("a.c"), a_contents);
+    source_loc b_base = sm_add_buffer((string)WRAPZ("b.c"), b_contents);
+    // Ranges don't overlap, and end of file has its own location
+    bool result = a_base != 0 && b_base == a_base + a_contents.len + 1;
+
+    sm_location loc = sm_resolve(a_base);
+    result = result && string_eq(loc.buffer->name, (string)WRAPZ("a.c")) && loc.line == 1 &&
+             loc.col == 1 && loc.offset == 0;
+    loc    = sm_resolve(a_base + 11);
+    result = result && loc.line == 2 && loc.col == 5;
+    loc    = sm_resolve(a_base + 17);
+    result = result && loc.line == 4 && loc.col == 3;
+    loc    = sm_resolve(a_base + a_contents.len);
+    result = result && loc.buffer->base == a_base && loc.line == 4 && loc.col == 4;
+    loc    = sm_resolve(b_base);
+    result = result && string_eq(loc.buffer->name, (string)WRAPZ("b.c")) && loc.line == 1 &&
+             loc.col == 1;
+    return result;
+}
+
+bool
+test_invalid_location(void) {
+    sm_location loc = sm_resolve(0);
+    bool result     = !loc.buffer;
+    loc             = sm_resolve(get_source_manager()->next_loc);
+    result          = result && !loc.buffer;
+    return result;
+}
+
+bool
+test_expansion_locations(void) {
+    source_loc base       = sm_add_buffer((string)WRAPZ("m.c"), (string)WRAPZ("A\n  B\n"));
+    source_loc invocation = base + 4;
+    source_loc expansion  = sm_add_expansion(invocation, 3);
+    // Nested expansion, invoked from token of the first one
+    source_loc nested = sm_add_expansion(expansion + 1, 2);
+
+    bool result = expansion >= base + 7 && nested == expansion + 3;
+    for (uint32_t i = 0; i < 3; ++i) {
+        sm_location loc = sm_resolve(expansion + i);
+        result          = result && string_eq(loc.buffer->name, (string)WRAPZ("m.c")) &&
+                 loc.line == 2 && loc.col == 3;
+    }
+    sm_location loc = sm_resolve(nested + 1);
+    result          = result && loc.line == 2 && loc.col == 3;
+    return result;
+}
+
+#define THREAD_COUNT 4
+#define THREAD_EXPANSION_COUNT 5000
+
+static source_loc thread_invocation;
+
+// Gives out expansions, each invoked from the previous one, and checks that
+// they resolve to the first invocation while other threads add theirs
+static void *
+add_thread_expansions(void *data) {
+    bool *result        = data;
+    source_loc previous = thread_invocation;
+    *result             = true;
+    for (uint32_t i = 0; *result && i < THREAD_EXPANSION_COUNT; ++i) {
+        previous = sm_add_expansion(previous, 1 + i % 7);
+        if (i % 97 == 0) {
+            sm_location loc = sm_resolve(previous);
+            *result         = loc.buffer && loc.line == 1 && loc.col == 2;
+        }
+    }
+    return NULL;
+}
+
+bool
+test_expansions_from_threads(void) {
+    source_loc base   = sm_add_buffer((string)WRAPZ("t.c"), (string)WRAPZ("(T)"));
+    thread_invocation = base + 1;
+
+    pthread_t threads[THREAD_COUNT];
+    bool results[THREAD_COUNT] = {0};
+    for (uint32_t i = 0; i < THREAD_COUNT; ++i) {
+        pthread_create(threads + i, NULL, add_thread_expansions, results + i);
+    }
+    bool result = true;
+    for (uint32_t i = 0; i < THREAD_COUNT; ++i) {
+        pthread_join(threads[i], NULL);
+        result = result && results[i];
+    }
+    return result;
+}
+
+// Must be the last test, as no locations are left after it
+bool
+test_exhausted_locations(void) {
+    uint32_t error_count = get_error_reporter()->error_count;
+    source_loc base      = sm_add_buffer((string)WRAPZ("a.c"), (string)WRAPZ("a"));
+    // Contents are not read, so size of buffer can be made up
+    source_loc huge      = sm_add_buffer((string)WRAPZ("huge.c"), (string){"", UINT32_MAX - 1});
+    source_loc expansion = sm_add_expansion(base, SM_CHUNK_SIZE + 1);
+    // Locations given out before are still valid
+    sm_location loc = sm_resolve(base);
+    return base && !huge && !expansion && loc.buffer &&
+           get_error_reporter()->error_count == error_count + 1;
+}
+
+int
+main(void) {
+    TEST_CASE(test_buffer_locations);
+    TEST_CASE(test_invalid_location);
+    TEST_CASE(test_expansion_locations);
+    TEST_CASE(test_expansions_from_threads);
+    TEST_CASE(test_exhausted_locations);
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "general.h"
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+#define JOB_COUNT 100
+
+static uint32_t job_results[JOB_COUNT];
+static uint32_t job_runs[JOB_COUNT];
+
+static void
+square_job(void *data, uint32_t job_idx, uint32_t worker_idx) {
+    uint32_t worker_count = *(uint32_t *)data;
+    assert(worker_idx < worker_count);
+    job_results[job_idx] = job_idx * job_idx;
+    ++job_runs[job_idx];
+}
+
+static bool
+run_jobs(uint32_t worker_count) {
+    memset(job_results, 0, sizeof(job_results));
+    memset(job_runs, 0, sizeof(job_runs));
+    thread_pool pool;
+    tp_start(&pool, worker_count, JOB_COUNT, square_job, &worker_count);
+    bool result = true;
+    // Results are consumed in order, while later jobs may still run
+    for (uint32_t job_idx = 0; job_idx < JOB_COUNT; ++job_idx) {
+        tp_wait_job(&pool, job_idx);
+        result = result && job_results[job_idx] == job_idx * job_idx;
+    }
+    tp_finish(&pool);
+    for (uint32_t job_idx = 0; job_idx < JOB_COUNT; ++job_idx) {
+        result = result && job_runs[job_idx] == 1;
+    }
+    return result;
+}
+
+bool
+test_single_worker(void) {
+    return run_jobs(1);
+}
+
+bool
+test_multiple_workers(void) {
+    return run_jobs(4);
+}
+
+bool
+test_more_workers_than_jobs(void) {
+    thread_pool pool;
+    uint32_t worker_count = 8;
+    job_runs[0]           = 0;
+    tp_start(&pool, worker_count, 1, square_job, &worker_count);
+    tp_wait_job(&pool, 0);
+    tp_finish(&pool);
+    return job_runs[0] == 1;
+}
+
+int
+main(void) {
+    TEST_CASE(test_single_worker);
+    TEST_CASE(test_multiple_workers);
+    TEST_CASE(test_more_workers_than_jobs);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include "general.h"
+#include "time_report.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+bool
+test_disabled(void) {
+    TR_BEGIN(TR_PHASE_LEXING);
+    TR_END(TR_PHASE_LEXING);
+    return !tr_->phase_depth && !tr_->phase_calls[TR_PHASE_LEXING];
+}
+
+bool
+test_nested_phases(void) {
+    tr_enable();
+    TR_BEGIN(TR_PHASE_PARSING);
+    TR_BEGIN(TR_PHASE_PREPROCESSING);
+    TR_BEGIN(TR_PHASE_FILE_LOADING);
+    bool is_nested = tr_->phase_depth == 3;
+    TR_END(TR_PHASE_FILE_LOADING);
+    TR_END(TR_PHASE_PREPROCESSING);
+    TR_BEGIN(TR_PHASE_PREPROCESSING);
+    TR_END(TR_PHASE_PREPROCESSING);
+    TR_END(TR_PHASE_PARSING);
+    return is_nested && !tr_->phase_depth && tr_->phase_calls[TR_PHASE_PARSING] == 1 &&
+           tr_->phase_calls[TR_PHASE_PREPROCESSING] == 2 &&
+           tr_->phase_calls[TR_PHASE_FILE_LOADING] == 1;
+}
+
+bool
+test_counters(void) {
+    uint64_t before = tr_->counters[TR_COUNTER_BYTES_READ];
+    TR_COUNT(TR_COUNTER_BYTES_READ, 100);
+    TR_COUNT(TR_COUNTER_BYTES_READ, 20);
+    return tr_->counters[TR_COUNTER_BYTES_READ] == before + 120;
+}
+
+int
+main(void) {
+    TEST_CASE(test_disabled);
+    TEST_CASE(test_nested_phases);
+    TEST_CASE(test_counters);
+    return 0;
+}
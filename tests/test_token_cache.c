@@ -0,0 +1,74 @@
+#include "file_storage.h"
+#include "general.h"
+#include "pp_lexer.h"
+#include "str.h"
+#include "token_cache.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CASE(_func) { printf("test: " #_func "\n"); assert(_func()); }
+
+bool
+test_same_file_is_lexed_once(void) {
+    char src[] = "int x = \"a\\n\";\n";
+    file f     = {0};
+    f.contents = (string){src, sizeof(src) - 1};
+    f.loc_base = 100;
+
+    pp_token_array *first  = ptc_get_file_tokens(&f);
+    pp_token_array *second = ptc_get_file_tokens(&f);
+    pp_token tok           = {0};
+    pp_token_array_get(first, 1, &tok);
+    return first == second && first->token_count == 6 && tok.loc == 104;
+}
+
+bool
+test_same_contents_share_tokens(void) {
+    // Contents are in separate buffers, as they would be for different files
+    char src1[] = "#define A \"\\t\" 1\nA\n";
+    char src2[] = "#define A \"\\t\" 1\nA\n";
+    file f1     = {0};
+    f1.contents = (string){src1, sizeof(src1) - 1};
+    f1.loc_base = 1000;
+    file f2     = {0};
+    f2.contents = (string){src2, sizeof(src2) - 1};
+    f2.loc_base = 2000;
+
+    pp_token_array *tokens1 = ptc_get_file_tokens(&f1);
+    pp_token_array *tokens2 = ptc_get_file_tokens(&f2);
+    bool result = tokens1 != tokens2 && tokens1->kinds == tokens2->kinds &&
+                  tokens1->token_count == tokens2->token_count;
+
+    // Tokens have locations and spellings of their own file
+    pp_token tok1 = {0};
+    pp_token tok2 = {0};
+    pp_token_array_get(tokens1, 4, &tok1);
+    pp_token_array_get(tokens2, 4, &tok2);
+    result = result && tok1.kind == PP_TOK_NUM && tok1.loc == 1015 && tok2.loc == 2015 &&
+             tok1.str.data == src1 + 15 && tok2.str.data == src2 + 15;
+    pp_token_array_get(tokens1, 3, &tok1);
+    pp_token_array_get(tokens2, 3, &tok2);
+    result = result && tok1.kind == PP_TOK_STR && string_eq(tok1.str, tok2.str);
+    return result;
+}
+
+bool
+test_different_contents(void) {
+    char src1[] = "a b c";
+    char src2[] = "a b d";
+    file f1     = {0};
+    f1.contents = (string){src1, sizeof(src1) - 1};
+    file f2     = {0};
+    f2.contents = (string){src2, sizeof(src2) - 1};
+    return ptc_get_file_tokens(&f1)->kinds != ptc_get_file_tokens(&f2)->kinds;
+}
+
+int
+main(void) {
+    TEST_CASE(test_same_file_is_lexed_once);
+    TEST_CASE(test_same_contents_share_tokens);
+    TEST_CASE(test_different_contents);
+    return 0;
+}